@@ -1,6 +1,7 @@
 #include <fr/fr.hpp>
 
 #include <chrono>
+#include <cstdlib>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -64,12 +65,14 @@ std::vector<frImage*>       offscreenImages{};
 std::vector<frImage*>       depthImages{};
 std::vector<frFramebuffer*> swapchainFramebuffers{};
 
-frCommands         *commands = nullptr;
+frThreadPool       *threads = nullptr;
+frFrameManager     *frames = nullptr;
 frDescriptors      *descriptors = nullptr;
+frUploadManager    *uploader = nullptr;
+frTextureLoader    *textureLoader = nullptr;
 
-frDescriptorLayout        *uboLayout = nullptr;
-std::vector<frBuffer*>     uboBuffers{};
-std::vector<frDescriptor*> ubos{};
+frDescriptorLayout *uboLayout = nullptr;
+frDescriptor       *ubo = nullptr;
 
 frDescriptorLayout *textureLayout = nullptr;
 frImage            *textureImage = nullptr;
@@ -127,17 +130,17 @@ glm::mat4 projection;
 VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT;
 
 bool recordCommandBuffer(VkCommandBuffer cmdBuf, uint32_t imageIndex);
+void recordFace(VkCommandBuffer cmdBuf, uint32_t face, const frRingAllocation &uboSlice);
 void createSwapchainFirst();
 void createSwapchainLast();
 void cleanupSwapchain();
 void recreateSwapchain();
-void updateUbos();
+frRingAllocation updateUbos();
 
 frWindow *window = nullptr;
 
 const char *const textureFilePath = "./assets/textures/prototype.png";
-
-uint32_t frame = 0;
+const char *const textureContainerPath = "./assets/textures/prototype.frtex"; // ./build/frtex -format bc7 -o ... prototype.png
 
 int main(void) {
   try {
@@ -151,12 +154,14 @@ int main(void) {
   renderer->setApplicationName("fr example");
   renderer->addLayer("VK_LAYER_KHRONOS_validation");
   renderer->addExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+  renderer->enableTransferQueue();
+  renderer->enableTimelineSemaphores();
+  renderer->enableSubmitThread();
+  renderer->setPipelineCachePath("./build/pipeline.cache");
+  if (getenv("FR_SHADER_OBJECTS")) renderer->enableShaderObjects(); // Needs a driver exposing VK_EXT_shader_object
 
   window->addExtensions(renderer);
 
-  std::vector<frSynchronization *> synchronizations;
-  commands = new frCommands();
-
   try {
     VkPhysicalDeviceFeatures physicalDeviceFeatures{};
     physicalDeviceFeatures.samplerAnisotropy = VK_TRUE;
@@ -229,13 +234,13 @@ int main(void) {
 
     descriptors = new frDescriptors();
     descriptors->initialize(renderer, {
-      { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, swapchain->imageCount() },
+      { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
       { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
     });
     
     uboLayout = new frDescriptorLayout();
     uboLayout->addBinding(VkDescriptorSetLayoutBinding{
-      0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
+      0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1,
       VK_SHADER_STAGE_VERTEX_BIT,
       VK_NULL_HANDLE
     });
@@ -304,6 +309,11 @@ int main(void) {
         static_cast<uint32_t>(dynamicStates.size()), dynamicStates.data()
       });
 
+      // Set per draw where extended dynamic state is available, baked from the states below otherwise
+      pipeline->addDynamicState(renderer, VK_DYNAMIC_STATE_CULL_MODE);
+      pipeline->addDynamicState(renderer, VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE);
+      pipeline->addDynamicState(renderer, VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE);
+
       pipeline->setViewportState(VkPipelineViewportStateCreateInfo{
         VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO, VK_NULL_HANDLE, 0,
         1, nullptr, 1, nullptr
@@ -326,110 +336,74 @@ int main(void) {
       delete fragmentShader;
     }
 
-    commands->initialize(renderer);
+    uploader = new frUploadManager();
+    uploader->initialize(renderer);
+
+    threads = new frThreadPool();
+    threads->initialize();
 
     {
       VkDeviceSize bufferSize = sizeof(cubeVertices[0]) * cubeVertices.size();
 
-      frBuffer *stagingBuffer = new frBuffer();
-      stagingBuffer->initialize(renderer, frBuffer::frBufferInfo{
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, {}
-      });
-      stagingBuffer->copyData(0, bufferSize, cubeVertices.data());
-     
       squareVBuf = new frBuffer();
       squareVBuf->initialize(renderer, frBuffer::frBufferInfo{
         bufferSize,
-        (VkBufferUsageFlagBits)(VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, {}
+        (VkBufferUsageFlagBits)(VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, {}
       });
-      squareVBuf->copyFromBuffer(renderer, commands, stagingBuffer, bufferSize);
-
-      delete stagingBuffer;
+      uploader->uploadBuffer(squareVBuf, 0, cubeVertices.data(), bufferSize);
     }
 
     {
       VkDeviceSize bufferSize = sizeof(cubeIndices[0]) * cubeIndices.size();
 
-      frBuffer *stagingBuffer = new frBuffer();
-      stagingBuffer->initialize(renderer, frBuffer::frBufferInfo{
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, {}
-      });
-      stagingBuffer->copyData(0, bufferSize, cubeIndices.data());
-     
       squareIBuf = new frBuffer();
       squareIBuf->initialize(renderer, frBuffer::frBufferInfo{
         bufferSize,
-        (VkBufferUsageFlagBits)(VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, {}
+        (VkBufferUsageFlagBits)(VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, {}
       });
-      squareIBuf->copyFromBuffer(renderer, commands, stagingBuffer, bufferSize);
-
-      delete stagingBuffer;
+      uploader->uploadBuffer(squareIBuf, 0, cubeIndices.data(), bufferSize);
     }
 
-    { // Create UBO buffers
-      for (size_t i = 0; i < swapchain->imageCount(); ++i) {
-        frBuffer *buf = new frBuffer();
-        buf->initialize(renderer, frBuffer::frBufferInfo{
-          sizeof(UBO), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, {}
-        });
-        uboBuffers.push_back(buf);
-      }
-    }
+    { // Create ubo descriptor, the offset into the ring buffer is bound dynamically per frame
+      VkDescriptorBufferInfo bufferInfo{};
+      bufferInfo.buffer = renderer->getRingBuffer()->get();
+      bufferInfo.offset = 0;
+      bufferInfo.range = sizeof(UBO);
 
-    { // Create ubo descriptors
-      ubos = descriptors->allocate(swapchain->imageCount(), uboLayout);
-      size_t i = 0;
-      for (auto ubo : ubos) {
-        VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = uboBuffers[i++]->get();
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UBO);
-
-        ubo->update(frDescriptor::frDescriptorWriteInfo{
-          0, 0, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-          VK_NULL_HANDLE, &bufferInfo, VK_NULL_HANDLE
-        });
-      }
+      ubo = descriptors->allocate(1, uboLayout)[0];
+      ubo->update(frDescriptor::frDescriptorWriteInfo{
+        0, 0, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        VK_NULL_HANDLE, &bufferInfo, VK_NULL_HANDLE
+      });
     }
 
-    { // Create texture
-      int width, height, channels;
-      stbi_uc* pixels = stbi_load(textureFilePath, &width, &height, &channels, STBI_rgb_alpha);
+    frTextureFile textureFile;
+    if (textureFile.initialize(textureContainerPath) && // Precomputed (possibly BC) mips, no decode and no blits
+        renderer->FindSupportedFormat({ textureFile.format() }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != VK_FORMAT_UNDEFINED) {
+      textureImage = new frImage();
+      textureImage->initialize(renderer, textureFile.imageInfo(VK_IMAGE_USAGE_SAMPLED_BIT));
+      textureImage->setName(renderer, "textureImage");
+      uploader->uploadTexture(textureImage, textureFile);
+    } else { // Create texture, decoded and expanded to RGBA on the worker pool
+      textureLoader = new frTextureLoader();
+      textureLoader->initialize(renderer, uploader, threads, frImageDecoder{
+        [](const char *path, int *width, int *height, int *channels) { return stbi_load(path, width, height, channels, 0); },
+        [](uint8_t *pixels) { stbi_image_free(pixels); }
+      });
 
-      if (!pixels) {
+      frTextureHandle handle = textureLoader->load(textureFilePath);
+      textureLoader->finish();
+      if (textureLoader->hasFailed(handle)) {
         fprintf(stderr, "Failed to load image %s\n", textureFilePath);
         exit(1);
       }
-
-      VkDeviceSize bufferSize = width * height * 4;
-
-      frBuffer *stagingBuffer = new frBuffer();
-      stagingBuffer->initialize(renderer, frBuffer::frBufferInfo{
-        bufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, {}
-      });
-      stagingBuffer->copyData(0, bufferSize, pixels);
-
-      textureImage = new frImage();
-      textureImage->initialize(renderer, frImage::frImageInfo{
-        width, height, VK_FORMAT_R8G8B8A8_SRGB,
-        (VkImageUsageFlagBits)(VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT),
-        true, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        VK_IMAGE_ASPECT_COLOR_BIT, true
-      });
+      textureImage = textureLoader->takeImage(handle);
       textureImage->setName(renderer, "textureImage");
-      textureImage->transitionLayout(renderer, commands, frImage::frImageTransitionInfo{
-        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-        0, VK_ACCESS_TRANSFER_WRITE_BIT
-      });
-      textureImage->copyFromBuffer(renderer, commands, stagingBuffer, bufferSize);
-      delete stagingBuffer;
-      textureImage->generateMipmaps(renderer, commands);
     }
 
+    // Frame submissions come after the upload batch on the same queue, no CPU wait needed.
+    uploader->flush();
+
     { // Create texture sampler
       textureSampler = new frSampler();
       textureSampler->initialize(renderer, frSampler::frSamplerInfo{
@@ -455,12 +429,9 @@ int main(void) {
       });
     }
     
-    VkCommandBuffer *commandBuffers = commands->allocateBuffers(VK_COMMAND_BUFFER_LEVEL_PRIMARY, swapchain->imageCount());
-    for (size_t i = 0; i < swapchain->imageCount(); ++i) {
-      frSynchronization *sync = new frSynchronization();
-      sync->initialize(renderer);
-      synchronizations.push_back(sync);
-    }
+    // Two frames in flight no matter how many images the presentation engine hands out
+    frames = new frFrameManager();
+    frames->initialize(renderer, 2, threads);
 
     // size_t frameCount = 0;
     // double previousTime = glfwGetTime();
@@ -475,33 +446,25 @@ int main(void) {
 
       glfwPollEvents();
 
-      synchronizations[frame]->wait();
-
-      uint32_t imageIndex;
+      frFrame *frame = nullptr;
       try {
-        imageIndex = renderer->acquireNextImage(swapchain, synchronizations[frame]);
+        frame = frames->beginFrame(swapchain);
       } catch (fr::frSwapchainResizeException &ex) {
         recreateSwapchain();
         continue;
       }
 
-      synchronizations[frame]->reset();
-
-      vkResetCommandBuffer(commandBuffers[frame], 0);
-      if (!recordCommandBuffer(commandBuffers[frame], imageIndex)) {
+      if (!recordCommandBuffer(frame->cmdBuf, frame->imageIndex)) {
         fprintf(stderr, "Failed to record command buffer!\n");
         return 1;
       }
 
-      frCommands::submit(renderer, commandBuffers[frame], synchronizations[frame]);
       try {
-        renderer->present(swapchain, synchronizations[frame], &imageIndex);
+        frames->endFrame(swapchain);
       } catch (fr::frSwapchainResizeException &ex) {
         recreateSwapchain();
         continue;
       }
-
-      frame = (frame+1) % swapchain->imageCount();
     }
 
     renderer->waitIdle();
@@ -512,8 +475,7 @@ int main(void) {
 
   cleanupSwapchain();
 
-  for (auto buf : uboBuffers) delete buf;
-  for (auto ubo : ubos) delete ubo;
+  delete ubo;
 
   delete textureSampler;
   delete textureImage;
@@ -530,9 +492,11 @@ int main(void) {
   delete pipeline;
   delete renderPass;
 
-  for (auto sync : synchronizations) delete sync;
+  delete frames;
+  delete textureLoader;
+  delete threads;
 
-  delete commands;
+  delete uploader;
 
   delete renderer;
   delete window;
@@ -541,16 +505,27 @@ int main(void) {
 }
 
 bool recordCommandBuffer(VkCommandBuffer cmdBuf, uint32_t imageIndex) {
-  updateUbos();
-
-  frCommands::begin(cmdBuf);
+  frRingAllocation uboSlice = updateUbos();
 
   std::vector<VkClearValue> clearValues = {};
   clearValues.push_back({{{0.0f, 0.0f, 0.0f, 1.0f}}});
   clearValues.push_back(VkClearValue{{1.0f, 0}});
 
-  renderPass->begin(cmdBuf, swapchain->extent(), swapchainFramebuffers[imageIndex], clearValues);
+  renderPass->begin(cmdBuf, swapchain->extent(), swapchainFramebuffers[imageIndex], clearValues,
+                    VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+  // One secondary command buffer per cube face, recorded across the worker threads
+  const uint32_t faceCount = static_cast<uint32_t>(cubeIndices.size() / 6);
+  frames->recordParallel(renderPass, swapchainFramebuffers[imageIndex], 0, faceCount, [&](VkCommandBuffer cmdBuf, uint32_t face) {
+    recordFace(cmdBuf, face, uboSlice);
+  });
+
+  renderPass->end(cmdBuf);
+
+  return true;
+}
 
+void recordFace(VkCommandBuffer cmdBuf, uint32_t face, const frRingAllocation &uboSlice) {
   pipeline->bind(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS);
 
   auto scExtent = swapchain->extent();
@@ -562,12 +537,16 @@ bool recordCommandBuffer(VkCommandBuffer cmdBuf, uint32_t imageIndex) {
   viewport.height = static_cast<float>(scExtent.height);
   viewport.minDepth = 0.0f;
   viewport.maxDepth = 1.0f;
-  vkCmdSetViewport(cmdBuf, 0, 1, &viewport);
+  frCommands::setViewports(renderer, cmdBuf, { viewport });
 
   VkRect2D scissor{};
   scissor.offset = {0, 0};
   scissor.extent = scExtent;
-  vkCmdSetScissor(cmdBuf, 0, 1, &scissor);
+  frCommands::setScissors(renderer, cmdBuf, { scissor });
+
+  if (pipeline->isDynamic(VK_DYNAMIC_STATE_CULL_MODE)) frCommands::setCullMode(renderer, cmdBuf, VK_CULL_MODE_BACK_BIT);
+  if (pipeline->isDynamic(VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE)) frCommands::setDepthTestEnable(renderer, cmdBuf, true);
+  if (pipeline->isDynamic(VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE)) frCommands::setDepthWriteEnable(renderer, cmdBuf, true);
 
   VkDeviceSize offsets[] = {0};
   VkBuffer vbufs[] = { squareVBuf->get() };
@@ -575,16 +554,10 @@ bool recordCommandBuffer(VkCommandBuffer cmdBuf, uint32_t imageIndex) {
 
   vkCmdBindIndexBuffer(cmdBuf, squareIBuf->get(), 0, VK_INDEX_TYPE_UINT32);
 
-  pipeline->bindDescriptor(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, 0, ubos[frame]);
+  pipeline->bindDescriptor(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, 0, ubo, {uboSlice.dynamicOffset()});
   pipeline->bindDescriptor(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, 1, texture);
 
-  vkCmdDrawIndexed(cmdBuf, static_cast<uint32_t>(cubeIndices.size()), 1, 0, 0, 0);
-
-  renderPass->end(cmdBuf);
-
-  frCommands::end(cmdBuf);
-
-  return true;
+  vkCmdDrawIndexed(cmdBuf, 6, 1, face * 6, 0, 0);
 }
 
 void createSwapchainFirst() {
@@ -694,7 +667,7 @@ void recreateSwapchain() {
   createSwapchainLast();
 }
 
-void updateUbos() {
+frRingAllocation updateUbos() {
   static auto startTime = std::chrono::high_resolution_clock::now();
   auto currentTime = std::chrono::high_resolution_clock::now();
   float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
@@ -705,5 +678,5 @@ void updateUbos() {
     glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f))
   };
 
-  for (auto buf : uboBuffers) buf->copyData(0, sizeof(ubo), (void*)&ubo);
+  return renderer->getRingBuffer()->push(ubo);
 }
\ No newline at end of file
@@ -3,6 +3,16 @@
 
 #include <iostream>
 #include <vector>
+#include <functional>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <exception>
+#include <map>
+#include <unordered_map>
+#include <string>
 
 #ifdef _WIN32
 #define VK_USE_PLATFORM_WIN32_KHR
@@ -143,6 +153,7 @@ namespace fr {
   class frRenderPass {
     friend class frFramebuffer;
     friend class frPipeline;
+    friend class frFrameManager;
   public:
     frRenderPass();
     ~frRenderPass();
@@ -150,7 +161,11 @@ namespace fr {
     void initialize(frRenderer *renderer);
     void cleanup();
 
-    void begin(VkCommandBuffer cmdBuf, VkExtent2D extent, frFramebuffer *fb, std::vector<VkClearValue> clearValues);
+    // Use VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS when the subpass is recorded with frFrameManager::recordParallel.
+    // With shader objects the pass begins with vkCmdBeginRendering instead and does its layout transitions and
+    // external dependencies with barriers, which limits it to one subpass without input attachments.
+    void begin(VkCommandBuffer cmdBuf, VkExtent2D extent, frFramebuffer *fb, std::vector<VkClearValue> clearValues,
+               VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
     void end(VkCommandBuffer cmdBuf);
 
     void setName(frRenderer *renderer, const char *name);
@@ -164,6 +179,18 @@ namespace fr {
     std::vector<VkSubpassDependency>     mDependencies{};
   private:
     VkRenderPass mRenderPass = VK_NULL_HANDLE;
+    std::string mCompatibilityKey{}; // What makes two render passes compatible, see frPipelineRegistry
+  private: // Dynamic rendering, copied out of the subpass since its references usually point at the caller's stack
+    void transitionAttachments(VkCommandBuffer cmdBuf, frFramebuffer *fb, bool begin);
+
+    bool mDynamicRendering = false;
+    std::vector<VkAttachmentReference> mColorRefs{};
+    std::vector<VkAttachmentReference> mResolveRefs{};       // VK_ATTACHMENT_UNUSED where a color attachment isn't resolved
+    VkAttachmentReference mDepthRef{ VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+    std::vector<VkImageLayout> mSubpassLayouts{};            // Per attachment, VK_IMAGE_LAYOUT_UNDEFINED when not referenced
+    frFramebuffer *mActiveFramebuffer = nullptr;             // Between begin and end
+    PFN_vkCmdBeginRendering mCmdBeginRendering = nullptr;
+    PFN_vkCmdEndRendering   mCmdEndRendering = nullptr;
 
     VkDevice mDevice = VK_NULL_HANDLE;
   };
@@ -171,6 +198,7 @@ namespace fr {
   class frImage;
   class frFramebuffer {
     friend class frRenderPass;
+    friend class frFrameManager;
   public:
     frFramebuffer();
     ~frFramebuffer();
@@ -183,12 +211,15 @@ namespace fr {
     uint8_t* mData;
 
     VkFramebuffer mFramebuffer = VK_NULL_HANDLE;
+    std::vector<frImage *> mImages{}; // What vkCmdBeginRendering renders to with shader objects
+    uint32_t mLayers = 1;
 
     VkDevice mDevice = VK_NULL_HANDLE;
   };
 
   class frShader {
     friend class frPipeline;
+    friend class frMipGenerator;
   public:
     frShader();
     ~frShader();
@@ -199,6 +230,8 @@ namespace fr {
   private:
     VkShaderModule mModule = VK_NULL_HANDLE;
     VkPipelineShaderStageCreateInfo mStageInfo{};
+    uint64_t mCodeHash = 0;
+    std::vector<char> mCode{}; // Kept for VkShaderEXT creation when the renderer uses shader objects
 
     VkDevice mDevice = VK_NULL_HANDLE;
   };
@@ -265,7 +298,19 @@ namespace fr {
     VkDevice mDevice = VK_NULL_HANDLE;
   };
 
+  // The pieces VK_EXT_graphics_pipeline_library compiles separately, see frPipelineLibrary
+  enum frPipelinePart {
+    FR_PIPELINE_PART_VERTEX_INPUT,
+    FR_PIPELINE_PART_PRE_RASTERIZATION, // Every stage but the fragment shader, viewport, rasterization
+    FR_PIPELINE_PART_FRAGMENT_SHADER,   // Fragment shader, depth/stencil
+    FR_PIPELINE_PART_FRAGMENT_OUTPUT,   // Blending, multisampling
+    FR_PIPELINE_PART_COUNT,
+  };
+
   class frPipeline {
+    friend class frPipelineCompiler;
+    friend class frPipelineRegistry;
+    friend class frPipelineLibrary;
   public: // Structures
     struct frPipelineMultisamplingInfo {
       VkSampleCountFlagBits rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
@@ -283,11 +328,19 @@ namespace fr {
 
     void bind(VkCommandBuffer cmdBuf, VkPipelineBindPoint bindPoint);
     void bindDescriptor(VkCommandBuffer cmdBuf, VkPipelineBindPoint bindPoint, uint32_t firstSet, frDescriptor *descriptor);
+    void bindDescriptor(VkCommandBuffer cmdBuf, VkPipelineBindPoint bindPoint, uint32_t firstSet, frDescriptor *descriptor, std::vector<uint32_t> dynamicOffsets);
     void pushConstant(VkCommandBuffer cmdBuf, VkShaderStageFlags stage, uint32_t offset, uint32_t size, const void *value);
 
     void setName(frRenderer *renderer, const char *name);
   public:
-    void addShader(frShader *shader) { mShaders.push_back(shader->mStageInfo); }
+    // `specialization` has to stay valid until initialize
+    void addShader(frShader *shader, const VkSpecializationInfo *specialization = nullptr) {
+      VkPipelineShaderStageCreateInfo stage = shader->mStageInfo;
+      stage.pSpecializationInfo = specialization;
+      mShaders.push_back(stage);
+      mShaderHashes.push_back(shader->mCodeHash);
+      mShaderSources.push_back(shader);
+    }
     void addDescriptor(frDescriptorLayout *layout) { mDescLayouts.push_back(layout->mLayout); }
     void addPushConstant(VkPushConstantRange range) { mPCRanges.push_back(range); }
 
@@ -342,11 +395,19 @@ namespace fr {
       mDynamicState = new VkPipelineDynamicStateCreateInfo();
       memcpy(mDynamicState, &info, sizeof(info));
     }
+
+    // Makes `state` dynamic if the renderer can record it (frRenderer::supportsDynamicState), false keeps the
+    // value from the fixed function state. Dynamic fields don't split pipelines in frPipelineRegistry.
+    bool addDynamicState(frRenderer *renderer, VkDynamicState state);
+    bool isDynamic(VkDynamicState state) const;
   private:
     std::vector<VkVertexInputAttributeDescription> mAttributes{};
     std::vector<VkPipelineShaderStageCreateInfo> mShaders{};
+    std::vector<uint64_t> mShaderHashes{};
+    std::vector<frShader*> mShaderSources{}; // Until initialize, for shader objects
     std::vector<VkDescriptorSetLayout> mDescLayouts{};
     std::vector<VkPushConstantRange> mPCRanges{};
+    std::vector<VkDynamicState> mAddedDynamicStates{};
 
     VkPipelineVertexInputStateCreateInfo   *mVertexInputState = VK_NULL_HANDLE;
     VkPipelineInputAssemblyStateCreateInfo *mInputAssemblyState = VK_NULL_HANDLE;
@@ -357,13 +418,128 @@ namespace fr {
     VkPipelineDepthStencilStateCreateInfo  *mDepthStencilState = VK_NULL_HANDLE;
     VkPipelineColorBlendStateCreateInfo    *mColorBlendState = VK_NULL_HANDLE;
     VkPipelineDynamicStateCreateInfo       *mDynamicState = VK_NULL_HANDLE;
+
+    std::vector<VkDynamicState>      mResolvedDynamicStates{};
+    VkPipelineDynamicStateCreateInfo mResolvedDynamicState{};
+  private:
+    // Sorted and without duplicates
+    std::vector<VkDynamicState> dynamicStates() const;
+    // Creates the layout, the returned info points into this pipeline's state until releaseState()
+    VkGraphicsPipelineCreateInfo prepare(frRenderer *renderer, frRenderPass *renderPass);
+    void releaseState();
+    // Every piece of state that ends up in the VkPipeline, serialized
+    std::string stateKey(frRenderPass *renderPass) const;
+    std::string partKey(frPipelinePart part, frRenderPass *renderPass) const;
+    std::string layoutKey() const;
+  private: // VK_EXT_shader_object, bind() sets every state the pipeline doesn't leave dynamic
+    struct frShaderObjectState {
+      std::vector<VkVertexInputBindingDescription2EXT>   bindings{};
+      std::vector<VkVertexInputAttributeDescription2EXT> attributes{};
+      VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+      uint32_t                               patchControlPoints = 0;
+      std::vector<VkViewport>                viewports{};
+      std::vector<VkRect2D>                  scissors{};
+      VkPipelineRasterizationStateCreateInfo rasterization{};
+      VkPipelineMultisampleStateCreateInfo   multisample{};
+      std::vector<VkSampleMask>              sampleMask{};
+      VkPipelineDepthStencilStateCreateInfo  depthStencil{};
+      VkBool32                               logicOpEnable = VK_FALSE;
+      VkLogicOp                              logicOp = VK_LOGIC_OP_COPY;
+      std::vector<VkBool32>                  blendEnables{};
+      std::vector<VkColorBlendEquationEXT>   blendEquations{};
+      std::vector<VkColorComponentFlags>     writeMasks{};
+      float                                  blendConstants[4] = {};
+    };
+
+    void initializeShaderObjects(frRenderer *renderer, frRenderPass *renderPass);
+    void bindShaderObjects(VkCommandBuffer cmdBuf);
+    bool hasDynamicState(VkDynamicState state) const;
+
+    std::vector<VkShaderStageFlagBits> mObjectStages{};
+    std::vector<VkShaderEXT>           mObjects{};
+    frShaderObjectState                mObjectState{};
+    frRenderer                        *mRenderer = nullptr;
   private:
-    VkPipelineLayout mLayout;
-    VkPipeline mPipeline;
+    VkPipelineLayout mLayout = VK_NULL_HANDLE;
+    VkPipeline mPipeline = VK_NULL_HANDLE;
 
     VkDevice mDevice = VK_NULL_HANDLE;
   };
 
+  // Builds pipelines out of VK_EXT_graphics_pipeline_library parts. Each part is compiled once per distinct state
+  // and cached, link() then only has to combine four parts. With a thread pool every linked pipeline is also
+  // re-linked with link time optimization in the background and swapped in by update().
+  // Without the extension link() creates complete pipelines.
+  class frThreadPool;
+  class frPipelineLibrary {
+  public:
+    frPipelineLibrary();
+    ~frPipelineLibrary();
+
+    void initialize(frRenderer *renderer, frThreadPool *threads = nullptr);
+    // Waits for the background links and installs them through update(), so every linked frPipeline (and the
+    // frPipelineRegistry owning them) has to outlive this call.
+    void cleanup();
+
+    // Replaces frPipeline::initialize. With `threads`, `pipeline` has to stay alive until update() or cleanup().
+    void link(frPipeline *pipeline, frRenderPass *renderPass);
+    // Installs optimized pipelines that finished since the last call. Call it between frames, after the last
+    // frame was submitted and before recording the next: the fast-linked pipelines are deferred behind the
+    // submitted work only, a recorded but unsubmitted command buffer could still bind them.
+    void update();
+
+    bool   enabled() const { return mEnabled; }
+    size_t partCount() const;
+  private:
+    VkPipeline createPart(frPipelinePart part, frPipeline *pipeline, const VkGraphicsPipelineCreateInfo &full, VkPipelineLayout layout);
+    VkPipelineLayout getLayout(frPipeline *pipeline);
+  private:
+    struct frOptimizedPipeline {
+      frPipeline *pipeline;
+      VkPipeline  optimized;
+    };
+
+    std::unordered_map<std::string, VkPipeline> mParts[FR_PIPELINE_PART_COUNT]{};
+    std::unordered_map<std::string, VkPipelineLayout> mLayouts{};
+
+    std::mutex mOptimizedMutex{};
+    std::condition_variable mOptimizedCond{};
+    std::vector<frOptimizedPipeline> mOptimized{};
+    uint32_t mOptimizing = 0;
+
+    bool mEnabled = false;
+
+    frRenderer   *mRenderer = nullptr;
+    frThreadPool *mThreads = nullptr;
+  };
+
+  // Deduplicates pipelines. The key covers shader code, specialization constants, every fixed function state,
+  // the layout and the render pass up to compatibility, so a hit can be bound anywhere the miss could.
+  // Descriptor set layouts are keyed by handle and have to outlive the registry.
+  class frPipelineRegistry {
+  public:
+    frPipelineRegistry();
+    ~frPipelineRegistry();
+
+    // Misses are linked by `library` when given
+    void initialize(frRenderer *renderer, frPipelineLibrary *library = nullptr);
+    // With a library, clean that up first, it still writes into the pipelines owned here
+    void cleanup();
+
+    // Takes ownership of `pipeline`, which is set up but not initialized. Returns the registered pipeline
+    // with the same state and deletes `pipeline`, or initializes and registers it. Owned by the registry.
+    frPipeline *acquire(frPipeline *pipeline, frRenderPass *renderPass);
+
+    size_t size() const { return mPipelines.size(); }
+    uint64_t hits() const { return mHits; }
+  private:
+    std::unordered_map<std::string, frPipeline*> mPipelines{};
+    uint64_t mHits = 0;
+
+    frRenderer        *mRenderer = nullptr;
+    frPipelineLibrary *mLibrary = nullptr;
+  };
+
   class frSynchronization;
   class frCommands {
   public:
@@ -373,26 +549,119 @@ namespace fr {
     void initialize(frRenderer *renderer);
     void cleanup();
 
-    VkCommandBuffer *allocateBuffers(VkCommandBufferLevel level, uint32_t count = 1);
+    std::vector<VkCommandBuffer> allocateBuffers(VkCommandBufferLevel level, uint32_t count = 1);
+    void freeBuffers(const std::vector<VkCommandBuffer> &buffers);
 
     void beginSingleTimeFrame();
     void endSingleTimeFrame(frRenderer *renderer);
     bool singleTimeFrameActive() const { return mSingleTimeCommandBuf; }
     VkCommandBuffer getSingleTime() { return mSingleTimeCommandBuf?mSingleTimeCommandBuf:beginSingleTime(); }
 
+    // Single-time command buffers are recycled, each one is reused once the fence of its last submit signaled.
     VkCommandBuffer beginSingleTime();
-    void endSingleTime(frRenderer *renderer, VkCommandBuffer cmdBuf);
+    void endSingleTime(frRenderer *renderer, VkCommandBuffer cmdBuf, bool wait = true);
   public:
     static void begin(VkCommandBuffer cmdBuf, VkCommandBufferUsageFlags flags = 0);
     static void end(VkCommandBuffer cmdBuf);
 
     static void submit(frRenderer *renderer, VkCommandBuffer cmdBuf, frSynchronization *sync=nullptr);
+  public: // Dynamic state, only for states the bound pipeline has dynamic (frPipeline::addDynamicState)
+    // VK_DYNAMIC_STATE_VIEWPORT/SCISSOR from index 0, under shader objects also sets the count to their size.
+    static void setViewports(frRenderer *renderer, VkCommandBuffer cmdBuf, const std::vector<VkViewport> &viewports);
+    static void setScissors(frRenderer *renderer, VkCommandBuffer cmdBuf, const std::vector<VkRect2D> &scissors);
+    static void setCullMode(frRenderer *renderer, VkCommandBuffer cmdBuf, VkCullModeFlags cullMode);
+    static void setFrontFace(frRenderer *renderer, VkCommandBuffer cmdBuf, VkFrontFace frontFace);
+    static void setPrimitiveTopology(frRenderer *renderer, VkCommandBuffer cmdBuf, VkPrimitiveTopology topology);
+    static void setDepthTestEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable);
+    static void setDepthWriteEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable);
+    static void setDepthCompareOp(frRenderer *renderer, VkCommandBuffer cmdBuf, VkCompareOp compareOp);
+    static void setDepthBoundsTestEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable);
+    static void setStencilTestEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable);
+    static void setStencilOp(frRenderer *renderer, VkCommandBuffer cmdBuf, VkStencilFaceFlags faces,
+                             VkStencilOp failOp, VkStencilOp passOp, VkStencilOp depthFailOp, VkCompareOp compareOp);
+    static void setRasterizerDiscardEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable);
+    static void setDepthBiasEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable);
+    static void setPrimitiveRestartEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable);
+    static void setLogicOp(frRenderer *renderer, VkCommandBuffer cmdBuf, VkLogicOp logicOp);
+    static void setPatchControlPoints(frRenderer *renderer, VkCommandBuffer cmdBuf, uint32_t controlPoints);
+    static void setPolygonMode(frRenderer *renderer, VkCommandBuffer cmdBuf, VkPolygonMode polygonMode);
+    static void setDepthClampEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable);
+    static void setColorBlendEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, uint32_t firstAttachment, const std::vector<VkBool32> &enables);
+    static void setColorBlendEquation(frRenderer *renderer, VkCommandBuffer cmdBuf, uint32_t firstAttachment, const std::vector<VkColorBlendEquationEXT> &equations);
+    static void setColorWriteMask(frRenderer *renderer, VkCommandBuffer cmdBuf, uint32_t firstAttachment, const std::vector<VkColorComponentFlags> &masks);
+  private:
+    struct frRecycledBuffer {
+      VkCommandBuffer cmdBuf = VK_NULL_HANDLE;
+      VkFence         fence = VK_NULL_HANDLE;
+    };
+
+    void recycle();
   private:
     VkCommandPool mPool = VK_NULL_HANDLE;
     VkCommandBuffer mSingleTimeCommandBuf = VK_NULL_HANDLE;
+
+    std::vector<frRecycledBuffer> mFreeBuffers{};
+    std::vector<frRecycledBuffer> mRecordingBuffers{};
+    std::vector<frRecycledBuffer> mPendingBuffers{}; // Submitted without waiting, fence not yet signaled
+
     VkDevice mDevice = VK_NULL_HANDLE;
   };
 
+  // One VkSubmitInfo worth of work, values are only read for timeline semaphores (0 for binary ones).
+  struct frSubmission {
+    std::vector<VkCommandBuffer>      commandBuffers{};
+    std::vector<VkSemaphore>          waitSemaphores{};
+    std::vector<VkPipelineStageFlags> waitStages{};
+    std::vector<uint64_t>             waitValues{};
+    std::vector<VkSemaphore>          signalSemaphores{};
+    std::vector<uint64_t>             signalValues{};
+
+    void wait(VkSemaphore semaphore, VkPipelineStageFlags stage, uint64_t value = 0) {
+      waitSemaphores.push_back(semaphore);
+      waitStages.push_back(stage);
+      waitValues.push_back(value);
+    }
+
+    void signal(VkSemaphore semaphore, uint64_t value = 0) {
+      signalSemaphores.push_back(semaphore);
+      signalValues.push_back(value);
+    }
+  };
+
+  // Wraps a VK_SEMAPHORE_TYPE_TIMELINE semaphore, every signal uses a strictly increasing value.
+  class frTimeline {
+    friend class frRenderer;
+  public:
+    frTimeline();
+    ~frTimeline();
+
+    void initialize(frRenderer *renderer, uint64_t initialValue = 0);
+    void cleanup();
+
+    // Reserves the value the next submission signals, must be called in queue submission order.
+    uint64_t next() { return ++mLastSignaled; }
+
+    uint64_t completedValue();
+    bool     isComplete(uint64_t value) { return value <= mCompleted || value <= completedValue(); }
+    void     wait(uint64_t value, uint64_t timeout = UINT64_MAX);
+  public:
+    VkSemaphore get() const { return mSemaphore; }
+    uint64_t    lastSignaled() const { return mLastSignaled; }
+  private:
+    VkSemaphore mSemaphore = VK_NULL_HANDLE;
+    uint64_t    mLastSignaled = 0;
+    uint64_t    mCompleted = 0;
+
+    PFN_vkWaitSemaphores           mWaitSemaphores = nullptr;
+    PFN_vkGetSemaphoreCounterValue mGetSemaphoreCounterValue = nullptr;
+
+    VkDevice mDevice = VK_NULL_HANDLE;
+  };
+
+  // In timeline mode (frRenderer::enableTimelineSemaphores) the in-flight fence is replaced by a
+  // value on the renderer's timeline, the binary semaphores stay since presentation requires them.
+  // Without timelines every fenced submit gets the next renderer frame number instead and wait()
+  // marks it complete, which is what deferred deletions are keyed on.
   class frSynchronization {
     friend class frRenderer;
     friend class frCommands;
@@ -405,11 +674,163 @@ namespace fr {
 
     void wait();
     void reset();
+
+    // Adds the frame semaphores (and the next timeline value) to `submission`,
+    // returns the fence the submit has to signal, VK_NULL_HANDLE in timeline mode.
+    VkFence attach(frSubmission &submission);
+  public:
+    bool        isTimeline() const { return mTimeline != nullptr; }
+    frTimeline *getTimeline() const { return mTimeline; }
+    uint64_t    value() const { return mValue; } // Timeline value (frame number without timelines) of the last submission using this sync
   private:
     VkSemaphore mImageAvailableSemaphore = VK_NULL_HANDLE;
     VkSemaphore mRenderFinishedSemaphore = VK_NULL_HANDLE;
     VkFence     mInFlightFence = VK_NULL_HANDLE;
 
+    frTimeline *mTimeline = nullptr;
+    uint64_t    mValue = 0;
+
+    frRenderer *mRenderer = nullptr;
+    VkDevice mDevice = VK_NULL_HANDLE;
+  };
+
+  struct frMemoryBlock;
+  struct frAllocation {
+    frMemoryBlock *block  = nullptr;
+    VkDeviceSize   offset = 0;
+    VkDeviceSize   size   = 0;
+  };
+
+  // One VkDeviceMemory carved into sub-allocations, free ranges are kept sorted by offset.
+  struct frMemoryBlock {
+    struct frRange {
+      VkDeviceSize offset;
+      VkDeviceSize size;
+    };
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize   size = 0;
+    uint32_t       memoryTypeIndex = 0;
+    bool           linear = true;     // Holds buffers/linear images (only relevant when bufferImageGranularity > 1)
+    bool           dedicated = false; // Single resource that did not fit into a regular block
+
+    std::vector<frRange> freeRanges{};
+    VkDeviceSize used = 0;
+    uint32_t     allocationCount = 0;
+
+    void    *mapped = nullptr;
+    uint32_t mapCount = 0;
+  };
+
+  class frAllocator {
+    friend class frRenderer;
+  public:
+    struct frBlockStats {
+      uint32_t     memoryTypeIndex;
+      VkDeviceSize size;
+      VkDeviceSize used;
+      uint32_t     allocationCount;
+      uint32_t     freeRangeCount;
+      VkDeviceSize largestFreeRange;
+      bool         dedicated;
+    };
+  public:
+    frAllocator();
+    ~frAllocator();
+
+    void initialize(frRenderer *renderer);
+    void cleanup();
+
+    // `linear` must be true for buffers and linear-tiled images, false for optimal-tiled images.
+    frAllocation allocate(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties, bool linear);
+    void free(frAllocation &allocation);
+
+    void *map(frAllocation &allocation);
+    void unmap(frAllocation &allocation);
+
+    // No-ops for HOST_COHERENT memory, ranges are relative to the allocation.
+    void flush(const frAllocation &allocation, VkDeviceSize offset, VkDeviceSize size);
+    void invalidate(const frAllocation &allocation, VkDeviceSize offset, VkDeviceSize size);
+    bool isCoherent(const frAllocation &allocation) const;
+
+    std::vector<frBlockStats> getStats() const;
+
+    void setBlockSize(VkDeviceSize size) { mBlockSize = size; }
+  private:
+    frMemoryBlock *createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool linear, bool dedicated);
+    void destroyBlock(frMemoryBlock *block);
+    bool allocateFromBlock(frMemoryBlock *block, VkMemoryRequirements requirements, frAllocation *allocation);
+    VkMappedMemoryRange alignedRange(const frAllocation &allocation, VkDeviceSize offset, VkDeviceSize size) const;
+  private:
+    std::vector<frMemoryBlock*> mBlocks{};
+
+    VkDeviceSize mBlockSize = 64ull * 1024 * 1024;
+    VkDeviceSize mBufferImageGranularity = 1;
+    VkDeviceSize mNonCoherentAtomSize = 1;
+    VkPhysicalDeviceMemoryProperties mMemoryProperties{};
+
+    frRenderer *mRenderer = nullptr;
+    VkDevice mDevice = VK_NULL_HANDLE;
+  };
+
+  // Collects image, buffer and global memory barriers and records them with a single
+  // vkCmdPipelineBarrier2 (synchronization2) or vkCmdPipelineBarrier. Masks are sync2 flags per barrier,
+  // without synchronization2 only the bits that also exist in the original flags are used.
+  class frBarrierBatch {
+    friend class frSplitBarrier;
+  public:
+    frBarrierBatch();
+
+    void initialize(frRenderer *renderer);
+
+    // Adjacent mips of the same layer with identical masks and layouts are merged into one barrier.
+    void addImage(VkImage image, VkImageSubresourceRange range, VkImageLayout oldLayout, VkImageLayout newLayout,
+                  VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess,
+                  uint32_t srcQueueFamily = VK_QUEUE_FAMILY_IGNORED, uint32_t dstQueueFamily = VK_QUEUE_FAMILY_IGNORED);
+    void addBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                   VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess,
+                   uint32_t srcQueueFamily = VK_QUEUE_FAMILY_IGNORED, uint32_t dstQueueFamily = VK_QUEUE_FAMILY_IGNORED);
+    void addMemory(VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess);
+
+    // Records everything collected so far and clears the batch, does nothing when empty.
+    void flush(VkCommandBuffer cmdBuf);
+  public:
+    bool empty() const { return mImageBarriers.empty() && mBufferBarriers.empty() && mMemoryBarriers.empty(); }
+  private:
+    void clear();
+    void mergeLayers();
+    VkDependencyInfo dependencyInfo() const;
+    void legacyBarriers(std::vector<VkImageMemoryBarrier> &images, std::vector<VkBufferMemoryBarrier> &buffers,
+                        std::vector<VkMemoryBarrier> &memory, VkPipelineStageFlags &srcStages, VkPipelineStageFlags &dstStages) const;
+  private:
+    std::vector<VkImageMemoryBarrier2>  mImageBarriers{};
+    std::vector<VkBufferMemoryBarrier2> mBufferBarriers{};
+    std::vector<VkMemoryBarrier2>       mMemoryBarriers{};
+
+    frRenderer *mRenderer = nullptr;
+  };
+
+  // Split barrier on one queue: release() signals an event once the source stages are done, acquire()
+  // waits on it, so independent work recorded in between is not held up. Fill barriers() before release().
+  class frSplitBarrier {
+  public:
+    frSplitBarrier();
+    ~frSplitBarrier();
+
+    void initialize(frRenderer *renderer);
+    void cleanup();
+
+    void release(VkCommandBuffer cmdBuf);
+    // Waits, then resets the event so the barrier can be released again by a later command buffer.
+    void acquire(VkCommandBuffer cmdBuf);
+  public:
+    frBarrierBatch &barriers() { return mBarriers; }
+  private:
+    frBarrierBatch mBarriers{};
+    VkEvent        mEvent = VK_NULL_HANDLE;
+    bool           mReleased = false;
+
+    frRenderer *mRenderer = nullptr;
     VkDevice mDevice = VK_NULL_HANDLE;
   };
 
@@ -420,25 +841,120 @@ namespace fr {
       VkBufferUsageFlagBits usage;
       VkMemoryPropertyFlags properties;
       std::vector<uint32_t> queueFamilyIndices;
+      bool persistentMap = false; // Map once at initialize, requires HOST_VISIBLE properties
     };
   public:
     frBuffer();
     ~frBuffer();
 
     void copyData(VkDeviceSize offset, VkDeviceSize size, void *data);
+
+    // Only needed for memory without HOST_COHERENT, size defaults to the rest of the buffer.
+    void flush(VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+    void invalidate(VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
     void copyFromBuffer(frRenderer *renderer, frCommands *commands, frBuffer *buffer, VkDeviceSize size);
+    void copyFromBuffer(VkCommandBuffer cmdBuf, VkBuffer buffer, VkDeviceSize srcOffset, VkDeviceSize dstOffset, VkDeviceSize size);
+
+    // Queues a barrier for [offset, offset + size), e.g. a copy's transfer write before a vertex fetch.
+    void barrier(frBarrierBatch &batch, VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess,
+                 VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
 
     void initialize(frRenderer *renderer, frBufferInfo info, bool bindMemory = true);
     void cleanup();
   public:
-    VkBuffer get() const { return mBuffer; }
+    VkBuffer     get() const { return mBuffer; }
+    VkDeviceSize size() const { return mSize; }
+
+    // Persistently mapped pointer, nullptr unless initialized with persistentMap.
+    template <typename T = void>
+    T *mapped(VkDeviceSize offset = 0) const { return mMapped ? static_cast<T*>(static_cast<void*>(mMapped + offset)) : nullptr; }
   private:
-    VkBuffer       mBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory mMemory = VK_NULL_HANDLE;
+    VkBuffer     mBuffer = VK_NULL_HANDLE;
+    VkDeviceSize mSize = 0;
+    frAllocation mAllocation{};
+    uint8_t     *mMapped = nullptr;
 
+    frAllocator *mAllocator = nullptr;
     VkDevice mDevice = VK_NULL_HANDLE;
   };
 
+  struct frRingAllocation {
+    VkBuffer     buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    void        *data   = nullptr;
+
+    template <typename T>
+    T *as() const { return static_cast<T*>(data); }
+
+    uint32_t dynamicOffset() const { return static_cast<uint32_t>(offset); }
+  };
+
+  // Linear allocator over one persistently mapped buffer, regions are recycled per frame.
+  class frRingBuffer {
+  public:
+    frRingBuffer();
+    ~frRingBuffer();
+
+    void initialize(frRenderer *renderer, VkDeviceSize size, VkBufferUsageFlags usage);
+    void cleanup();
+
+    // Call after `sync` has been waited on: everything allocated up to its previous use is reclaimed.
+    void beginFrame(frSynchronization *sync);
+
+    // Value based recycling for users that are not tied to frames (e.g. uploads), don't mix with beginFrame.
+    void closeRegion(uint64_t value);
+    void retire(uint64_t completedValue);
+
+    frRingAllocation allocate(VkDeviceSize size, VkDeviceSize alignment = 0);
+    bool tryAllocate(VkDeviceSize size, VkDeviceSize alignment, frRingAllocation *allocation);
+
+    template <typename T>
+    frRingAllocation push(const T &value) {
+      frRingAllocation allocation = allocate(sizeof(T));
+      memcpy(allocation.data, &value, sizeof(T));
+      return allocation;
+    }
+  public:
+    VkBuffer     get() const { return mBuffer.get(); }
+    VkDeviceSize size() const { return mSize; }
+    VkDeviceSize used() const { return mUsed; }
+  private:
+    struct frFrameRegion {
+      frSynchronization *sync;
+      uint64_t           value;
+      VkDeviceSize       end;
+      VkDeviceSize       used;
+    };
+
+    void retireRegions(size_t count);
+
+    frBuffer mBuffer{};
+
+    std::vector<frFrameRegion> mRegions{};
+    frSynchronization *mCurrentSync = nullptr;
+    VkDeviceSize       mFrameUsed = 0;
+
+    VkDeviceSize mSize = 0;
+    VkDeviceSize mHead = 0;
+    VkDeviceSize mTail = 0;
+    VkDeviceSize mUsed = 0; // Includes alignment padding and bytes skipped on wrap
+    VkDeviceSize mAlignment = 1;
+  };
+
+  // What the next command does with an image, see frImage::require.
+  enum frImageUsage {
+    FR_IMAGE_USAGE_TRANSFER_SRC,
+    FR_IMAGE_USAGE_TRANSFER_DST,
+    FR_IMAGE_USAGE_SAMPLED_FRAGMENT,
+    FR_IMAGE_USAGE_SAMPLED_COMPUTE,
+    FR_IMAGE_USAGE_STORAGE_READ,
+    FR_IMAGE_USAGE_STORAGE_WRITE,
+    FR_IMAGE_USAGE_COLOR_ATTACHMENT,
+    FR_IMAGE_USAGE_DEPTH_ATTACHMENT,
+    FR_IMAGE_USAGE_DEPTH_READ,
+    FR_IMAGE_USAGE_PRESENT,
+  };
+
   class frImage {
     friend class frFramebuffer;
   public:
@@ -447,12 +963,13 @@ namespace fr {
       int layers;                             // arrayLayers
       VkFormat format;                        // Format of the image.
       VkImageUsageFlagBits usage;             // Image usage flags
-      bool memory;                            // Determine whether create mImageMemory or not.
+      bool memory;                            // Determine whether allocate image memory or not.
       VkMemoryPropertyFlags memoryProperties; // Memory properties, if (memory == false) continue;
       VkImageAspectFlagBits imageAspect = VK_IMAGE_ASPECT_COLOR_BIT;
       bool generateMipmaps = false;           // Generate mipmaps
-      uint32_t mipLevels = 1;
+      uint32_t mipLevels = 1;                 // Ignored with generateMipmaps, the full chain is allocated
       VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+      bool cube = false;                      // Cube view over every 6 layers, a 2D array view otherwise
     };
 
     struct frImageTransitionInfo {
@@ -462,6 +979,31 @@ namespace fr {
       VkPipelineStageFlags dstStage;
       VkAccessFlags        srcAccess;
       VkAccessFlags        dstAccess;
+      uint32_t             srcQueueFamily = VK_QUEUE_FAMILY_IGNORED; // Set both for a queue family ownership transfer
+      uint32_t             dstQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+    };
+
+    struct frImageAccess {
+      VkImageLayout        layout;
+      VkPipelineStageFlags stages;
+      VkAccessFlags        access;
+    };
+
+    // Where one mip of one or more layers sits in a buffer. rowLength/imageHeight are in texels, 0 means tightly packed.
+    struct frCopyRegion {
+      uint32_t     mip = 0;
+      uint32_t     layer = 0;
+      VkDeviceSize offset = 0;
+      uint32_t     rowLength = 0;
+      uint32_t     imageHeight = 0;
+      uint32_t     layerCount = 1;
+    };
+
+    struct frSubresourceRange {
+      uint32_t baseMip = 0;
+      uint32_t mipCount = VK_REMAINING_MIP_LEVELS;
+      uint32_t baseLayer = 0;
+      uint32_t layerCount = VK_REMAINING_ARRAY_LAYERS;
     };
   public:
     frImage();
@@ -475,24 +1017,838 @@ namespace fr {
     void transitionLayout(frRenderer *renderer, frCommands *commands, frImageTransitionInfo info);
     void generateMipmaps(frRenderer *renderer, frCommands *commands);
     void copyFromBuffer(frRenderer *renderer, frCommands *commands, frBuffer *buffer, uint32_t baseArrayLayer);
+
+    // Record into an existing command buffer instead of a single-time submission.
+    void transitionLayout(VkCommandBuffer cmdBuf, frImageTransitionInfo info, frSubresourceRange range = {});
+    void generateMipmaps(frRenderer *renderer, VkCommandBuffer cmdBuf);
+    void copyFromBuffer(VkCommandBuffer cmdBuf, VkBuffer buffer, VkDeviceSize offset, uint32_t baseArrayLayer);
+    // Whole mips (e.g. a precomputed chain or all cube faces) in one vkCmdCopyBufferToImage, the regions must be in TRANSFER_DST_OPTIMAL.
+    void copyFromBuffer(VkCommandBuffer cmdBuf, VkBuffer buffer, const std::vector<frCopyRegion> &regions);
+    // Only `rect` of one mip/layer, `rowLength` is the source row pitch in texels (0 = rect width).
+    void copyRectFromBuffer(VkCommandBuffer cmdBuf, VkBuffer buffer, VkDeviceSize offset, uint32_t rowLength,
+                            VkRect2D rect, uint32_t mip = 0, uint32_t layer = 0);
     void copyToBuffer(frRenderer *renderer, frCommands *commands, frBuffer *buffer, VkDeviceSize offset);
 
     void setName(frRenderer *renderer, const char *imageName);
+
+    // Layout and last access are tracked per mip and layer in recording order, so command buffers that touch
+    // the image must be submitted in the order they were recorded. require() queues the barriers needed
+    // before `access` (nothing for a read after a read in the same layout), flushBarriers() records all
+    // queued barriers as one pipeline barrier. `discard` drops the current contents (oldLayout UNDEFINED).
+    void require(frImageAccess access, frSubresourceRange range = {}, bool discard = false);
+    void require(frImageUsage usage, frSubresourceRange range = {}, bool discard = false);
+    // Same, but into a batch shared with other resources (or an frSplitBarrier's).
+    void require(frBarrierBatch &batch, frImageAccess access, frSubresourceRange range = {}, bool discard = false);
+    void require(frBarrierBatch &batch, frImageUsage usage, frSubresourceRange range = {}, bool discard = false);
+    void flushBarriers(VkCommandBuffer cmdBuf);
+    // require() + flushBarriers()
+    void transition(VkCommandBuffer cmdBuf, frImageUsage usage, frSubresourceRange range = {}, bool discard = false);
+    // Records a layout change done behind the tracker's back, e.g. by a render pass' finalLayout.
+    void setState(frImageAccess access, frSubresourceRange range = {});
+
+    static frImageAccess usageAccess(frImageUsage usage);
+
+    // For images initialized with `memory == false`: the view is created once memory is bound.
+    VkMemoryRequirements getMemoryRequirements() const;
+    void bindMemory(VkDeviceMemory memory, VkDeviceSize offset);
   public:
+    VkImage     get() const { return mImage; }
     VkImageView getView() const { return mImageView; }
     uint32_t getMipLevels() const { return mInfo.mipLevels; }
+    uint32_t getLayers() const { return mInfo.layers > 1 ? static_cast<uint32_t>(mInfo.layers) : 1; }
+    VkFormat getFormat() const { return mInfo.format; }
+    VkExtent2D getExtent() const { return { static_cast<uint32_t>(mInfo.width), static_cast<uint32_t>(mInfo.height) }; }
+    VkSampleCountFlagBits getSamples() const { return mInfo.samples; }
+    VkImageAspectFlags getAspect() const { return mInfo.imageAspect; }
+    VkImageLayout getLayout(uint32_t mip = 0, uint32_t layer = 0) const { return mState[layer * mInfo.mipLevels + mip].layout; }
   private:
+    // Last write and the reads since then, what a barrier before the next access has to wait for
+    struct frSubresourceState {
+      VkImageLayout        layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      VkPipelineStageFlags writeStages = 0;
+      VkAccessFlags        writeAccess = 0;
+      VkPipelineStageFlags readStages = 0;
+      VkAccessFlags        readAccess = 0;
+    };
+
     void createView();
+    void initializeState();
+    VkImageSubresourceRange resolveRange(frSubresourceRange range) const;
 
     bool hasStencilComponent(VkFormat format);
   private:
     frImageInfo mInfo{};
 
-    bool           mDestroyImage = true;
-    VkImage        mImage        = VK_NULL_HANDLE;
-    VkDeviceMemory mImageMemory  = VK_NULL_HANDLE;
-    VkImageView    mImageView    = VK_NULL_HANDLE;
+    bool         mDestroyImage = true;
+    VkImage      mImage        = VK_NULL_HANDLE;
+    frAllocation mAllocation{};
+    VkImageView  mImageView    = VK_NULL_HANDLE;
+
+    std::vector<frSubresourceState> mState{}; // layer * mipLevels + mip
+    frBarrierBatch                  mBarriers{};
     
+    frAllocator *mAllocator = nullptr;
+    VkDevice mDevice = VK_NULL_HANDLE;
+  };
+
+  enum frMipFilter {
+    FR_MIP_FILTER_BOX,    // 2x2 average, up to 6 levels per dispatch
+    FR_MIP_FILTER_KAISER, // 4x4 Kaiser-windowed sinc, sharper, one dispatch per level
+  };
+
+  // Compute replacement for frImage::generateMipmaps: a workgroup reduces a 64x64 tile to 1x1 in shared
+  // memory, so a 4096x4096 chain takes two dispatches instead of twelve blits. Works for formats without
+  // linear blit support, needs shaderStorageImageWriteWithoutFormat and STORAGE | SAMPLED image usage.
+  class frMipGenerator {
+  public:
+    struct frMipOptions {
+      frMipFilter  filter = FR_MIP_FILTER_BOX;
+      bool         srgb = false; // Average in linear space for UNORM data holding sRGB colors, always on for _SRGB formats
+      frImageUsage finalUsage = FR_IMAGE_USAGE_SAMPLED_FRAGMENT;
+    };
+  public:
+    frMipGenerator();
+    ~frMipGenerator();
+
+    // `shaderPath` is the compiled assets/shaders/mipgen.comp
+    bool initialize(frRenderer *renderer, const char *shaderPath);
+    void cleanup();
+
+    // The views and descriptors the recorded dispatches read, they must outlive the command buffer's execution.
+    struct frMipResources {
+      VkDescriptorPool         pool = VK_NULL_HANDLE;
+      std::vector<VkImageView> views{};
+    };
+
+    // Fills every mip below 0 of every layer. Hand the result to release() once cmdBuf has been submitted.
+    frMipResources generate(VkCommandBuffer cmdBuf, frImage *image, frMipOptions options = {});
+    // `sync` is the one attached to the submit carrying cmdBuf (frFrame::sync when recorded into the frame),
+    // the renderer destroys the resources once that submit has finished.
+    void release(frMipResources resources, frSynchronization *sync);
+  private:
+    struct frMipConstants {
+      int32_t  srcWidth;
+      int32_t  srcHeight;
+      uint32_t levels;
+      uint32_t filter;
+      uint32_t srgb;
+    };
+
+    VkImageView createView(frImage *image, VkFormat format, uint32_t mip);
+  private:
+    VkDescriptorSetLayout mSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout      mLayout = VK_NULL_HANDLE;
+    VkPipeline            mPipeline = VK_NULL_HANDLE;
+
+    frRenderer *mRenderer = nullptr;
+    VkDevice mDevice = VK_NULL_HANDLE;
+  };
+
+  // On-disk layout of .frtex files (tools/frtex.cpp writes them): header, one frTextureLevel per mip, then
+  // the level data in upload order (mip 0 of every layer, then mip 1, ...), each level 16-byte aligned.
+  static const uint32_t FR_TEXTURE_MAGIC = 0x58545246; // "FRTX"
+  static const uint32_t FR_TEXTURE_VERSION = 1;
+
+  enum frTextureFlags {
+    FR_TEXTURE_CUBE = 1 << 0,
+  };
+
+  struct frTextureHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;     // VkFormat
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint32_t layers;
+    uint32_t flags;      // frTextureFlags
+    uint64_t dataOffset; // From the start of the file
+    uint64_t dataSize;
+  };
+
+  struct frTextureLevel {
+    uint64_t offset;     // From dataOffset
+    uint64_t size;       // All layers
+  };
+
+  // Read-only memory mapping of a .frtex file, level data goes to staging memory as is.
+  class frTextureFile {
+  public:
+    frTextureFile();
+    ~frTextureFile();
+
+    // False if the file is missing, truncated or not a supported .frtex, every level must hold all its layers.
+    bool initialize(const char *path);
+    void cleanup();
+
+    // Image description matching the file from `firstMip` down, which becomes the image's mip 0.
+    frImage::frImageInfo imageInfo(VkImageUsageFlags usage, uint32_t firstMip = 0) const;
+    // One copy region per mip from `firstMip` covering every layer, offsets relative to data(firstMip).
+    std::vector<frImage::frCopyRegion> regions(uint32_t firstMip = 0) const;
+  public:
+    const frTextureHeader &header() const { return *mHeader; }
+    VkFormat format() const { return static_cast<VkFormat>(mHeader->format); }
+    uint32_t mipLevels() const { return mHeader->mipLevels; }
+    const uint8_t *data(uint32_t firstMip = 0) const { return mMapping + mHeader->dataOffset + mLevels[firstMip].offset; }
+    VkDeviceSize dataSize(uint32_t firstMip = 0) const { return mHeader->dataSize - mLevels[firstMip].offset; }
+  private:
+    const uint8_t         *mMapping = nullptr;
+    size_t                 mSize = 0;
+    const frTextureHeader *mHeader = nullptr;
+    const frTextureLevel  *mLevels = nullptr;
+
+#ifdef _WIN32
+    void *mFile = nullptr;
+    void *mFileMapping = nullptr;
+#endif
+  };
+
+  typedef uint64_t frUploadToken;
+
+  // Batches staging copies into one command buffer per submission instead of a queue idle per copy.
+  class frUploadManager {
+  public:
+    struct frStagingAllocation {
+      VkBuffer     buffer;
+      VkDeviceSize offset;
+      void        *data;
+    };
+  public:
+    frUploadManager();
+    ~frUploadManager();
+
+    void initialize(frRenderer *renderer, VkDeviceSize stagingSize = 32ull * 1024 * 1024);
+    void cleanup();
+
+    // Returned tokens belong to the batch currently being recorded, it is submitted on flush().
+    frUploadToken uploadBuffer(frBuffer *dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size);
+    // Copies mip 0 of `layer` and leaves it in `finalLayout` (TRANSFER_DST_OPTIMAL to generate mips afterwards).
+    frUploadToken uploadImage(frImage *dst, const void *data, VkDeviceSize size, uint32_t layer = 0,
+                              VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Every region (offsets relative to `data`) in one staging allocation and one copy. Only the covered mips
+    // and layers are discarded and transitioned, the others keep their contents and tracked layout.
+    frUploadToken uploadImage(frImage *dst, const void *data, VkDeviceSize size, const std::vector<frImage::frCopyRegion> &regions,
+                              VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Every mip and layer of a .frtex file straight from the mapping, `dst` created from file.imageInfo().
+    frUploadToken uploadTexture(frImage *dst, const frTextureFile &file, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Same as uploadImage() from staging the caller filled itself (region offsets into `src`), which must stay
+    // untouched until the returned token completed.
+    frUploadToken uploadImageFromBuffer(frImage *dst, VkBuffer src, const std::vector<frImage::frCopyRegion> &regions,
+                                        VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Dirty rectangle of a live texture (atlas page, video frame), the rest of the image is preserved.
+    // Recorded on the graphics queue, `rowLength` is the pitch of `data` in texels (0 = rect width).
+    // For BC formats `texelSize` is the size of a 4x4 block and `rect` must be block aligned. An empty `rect` records nothing.
+    frUploadToken updateImage(frImage *dst, const void *data, uint32_t texelSize, uint32_t rowLength, VkRect2D rect,
+                              uint32_t mip = 0, uint32_t layer = 0, frImageUsage finalUsage = FR_IMAGE_USAGE_SAMPLED_FRAGMENT);
+
+    // Raw staging memory and command buffer for custom copies, valid until the next flush().
+    // getCommandBuffer() records on the transfer queue when the renderer has one, work that needs
+    // a graphics queue (blits, mip generation) goes into getGraphicsCommandBuffer() after the
+    // uploaded resources have been acquired there.
+    frStagingAllocation stage(VkDeviceSize size, VkDeviceSize alignment = 16);
+    VkCommandBuffer getCommandBuffer();
+    VkCommandBuffer getGraphicsCommandBuffer();
+
+    frUploadToken flush();
+    bool isComplete(frUploadToken token);
+    void wait(frUploadToken token);
+  public:
+    frUploadToken currentToken() const { return mNextToken; }
+  private:
+    struct frUploadBatch {
+      uint64_t        timelineValue = 0; // Replaces the fence when the renderer uses timeline semaphores
+      VkCommandBuffer cmdBuf = VK_NULL_HANDLE;
+      VkCommandBuffer acquireCmdBuf = VK_NULL_HANDLE; // Graphics queue side of ownership transfers
+      VkSemaphore     transferDone = VK_NULL_HANDLE;
+      VkFence         fence = VK_NULL_HANDLE;
+      frUploadToken   token = 0;
+      std::vector<frBuffer*> overflowBuffers{}; // Dedicated staging for uploads larger than the ring
+    };
+
+    frUploadBatch *acquireBatch();
+    bool isDone(frUploadBatch *batch);
+    void poll();
+  private:
+    frRingBuffer mStaging{};
+
+    std::vector<frUploadBatch*> mFreeBatches{};
+    std::vector<frUploadBatch*> mInFlight{};
+    frUploadBatch *mCurrent = nullptr;
+
+    frUploadToken mNextToken = 1;
+    frUploadToken mCompletedToken = 0;
+
+    VkCommandPool mPool = VK_NULL_HANDLE;
+    VkCommandPool mAcquirePool = VK_NULL_HANDLE;
+    bool mDedicatedTransfer = false;
+    frTimeline *mTimeline = nullptr;
+    frBarrierBatch mBarriers{};
+
+    frRenderer *mRenderer = nullptr;
+    VkDevice mDevice = VK_NULL_HANDLE;
+  };
+
+  // Fixed set of worker threads draining a FIFO of jobs. Jobs receive the index of the worker running
+  // them so they can use per-thread resources (command pools, scratch memory) without locking.
+  class frThreadPool {
+  public:
+    frThreadPool();
+    ~frThreadPool();
+
+    void initialize(uint32_t threadCount = 0); // 0 uses hardware_concurrency() - 1, at least one worker
+    void cleanup();
+
+    void submit(std::function<void(uint32_t worker)> job);
+    // Blocks until every submitted job finished, rethrows the first exception a job raised.
+    void wait();
+    // Runs job(index, worker) for every index in [0, count) and waits for just these jobs. Safe to call from
+    // a job of this pool, the calling worker then runs indices itself instead of only blocking.
+    void parallelFor(uint32_t count, std::function<void(uint32_t index, uint32_t worker)> job);
+  public:
+    uint32_t threadCount() const { return static_cast<uint32_t>(mThreads.size()); }
+  private:
+    void workerLoop(uint32_t worker);
+  private:
+    std::vector<std::thread> mThreads{};
+    std::deque<std::function<void(uint32_t)>> mJobs{};
+
+    std::mutex              mMutex;
+    std::condition_variable mJobAvailable;
+    std::condition_variable mIdle;
+    uint32_t                mRunning = 0;
+    bool                    mStopping = false;
+    std::exception_ptr      mError = nullptr;
+  };
+
+  // Compiles frPipelines on a thread pool. compile() creates the layout right away and queues the pipeline,
+  // every `batchSize` queued pipelines go to one worker as a single vkCreateGraphicsPipelines call. They all
+  // share the renderer's pipeline cache, which Vulkan synchronizes internally.
+  class frPipelineCompiler {
+  public:
+    frPipelineCompiler();
+    ~frPipelineCompiler();
+
+    void initialize(frRenderer *renderer, frThreadPool *threads, uint32_t batchSize = 8);
+    void cleanup();
+
+    // Resolves to `pipeline` once it can be bound or throws frVulkanException. The pipeline and its
+    // shader modules have to stay alive until then.
+    std::shared_future<frPipeline*> compile(frPipeline *pipeline, frRenderPass *renderPass);
+    // Hands a partial batch to the pool
+    void flush();
+    // flush() and block until everything compiled, rethrows the first failure
+    void wait();
+  private:
+    struct frPendingPipeline {
+      frPipeline                   *pipeline;
+      VkGraphicsPipelineCreateInfo  createInfo;
+      std::shared_ptr<std::promise<frPipeline*>> promise;
+    };
+
+    void compileBatch(std::vector<frPendingPipeline> &batch);
+  private:
+    std::vector<frPendingPipeline> mQueued{};
+    std::vector<std::shared_future<frPipeline*>> mOutstanding{};
+    uint32_t mBatchSize = 8;
+
+    frRenderer   *mRenderer = nullptr;
+    frThreadPool *mThreads = nullptr;
+  };
+
+  // Supplied by the application (stb_image, a codec library ...), called from worker threads.
+  struct frImageDecoder {
+    // Tightly packed 8-bit pixels with 1 to 4 channels (gray, gray+alpha, RGB, RGBA), nullptr on failure
+    std::function<uint8_t*(const char *path, int *width, int *height, int *channels)> decode;
+    std::function<void(uint8_t *pixels)> release;
+  };
+
+  struct frTextureLoadInfo {
+    bool              srgb = true;             // R8G8B8A8_SRGB, UNORM for data (normal maps, masks)
+    bool              premultiplyAlpha = false; // In linear space for sRGB textures
+    bool              generateMipmaps = true;
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+  };
+
+  typedef uint32_t frTextureHandle;
+
+  // Decodes images on a thread pool and converts them to RGBA8 straight into a persistently mapped staging
+  // ring of its own. update() creates the images of everything decoded since the last call and records all
+  // their copies into one upload batch. Only decoding and conversion run on the workers, load(), update()
+  // and the getters belong to the thread that owns the upload manager.
+  class frTextureLoader {
+  public:
+    frTextureLoader();
+    ~frTextureLoader();
+
+    void initialize(frRenderer *renderer, frUploadManager *uploader, frThreadPool *threads, frImageDecoder decoder,
+                    VkDeviceSize stagingSize = 64ull * 1024 * 1024);
+    void cleanup();
+
+    frTextureHandle load(const char *path, frTextureLoadInfo info = {});
+    // Returns how many textures became ready, work submitted afterwards can sample them.
+    uint32_t update();
+    // Calls update() until nothing is pending, for loading screens.
+    void finish();
+
+    bool isReady(frTextureHandle handle) const;
+    bool hasFailed(frTextureHandle handle) const;
+    // The caller owns the image afterwards, nullptr until ready. Images never taken die with the loader.
+    frImage *takeImage(frTextureHandle handle);
+  public:
+    uint32_t pendingCount() const { return mPending; }
+  private:
+    enum frRequestState {
+      FR_REQUEST_DECODING,
+      FR_REQUEST_DECODED,
+      FR_REQUEST_READY,
+      FR_REQUEST_FAILED,
+    };
+
+    struct frTextureRequest {
+      std::string          path;
+      frTextureLoadInfo    info;
+      frRequestState       state = FR_REQUEST_DECODING;
+      uint32_t             width = 0;
+      uint32_t             height = 0;
+      frRingAllocation     staging{};         // No data when the ring was full
+      uint64_t             stagingSequence = 0;
+      std::vector<uint8_t> pixels{};          // Converted pixels if the ring had no room
+      frImage             *image = nullptr;
+    };
+
+    void decode(frTextureRequest *request);
+    void retireStaging();
+  private:
+    frRingBuffer mStaging{};
+    uint64_t     mStagingSequence = 0;
+    std::map<uint64_t, frUploadToken> mStagingUses{}; // Per allocation, 0 until its copy is recorded
+
+    std::deque<frTextureRequest>   mRequests{};
+    std::vector<frTextureRequest*> mDecoded{};
+    uint32_t mPending = 0;  // Loaded but not yet through update()
+    uint32_t mDecoding = 0; // Jobs still on the pool
+
+    mutable std::mutex      mMutex;
+    std::condition_variable mDecodeDone;
+
+    frImageDecoder   mDecoder{};
+    frRenderer      *mRenderer = nullptr;
+    frUploadManager *mUploader = nullptr;
+    frThreadPool    *mThreads = nullptr;
+  };
+
+  // Texture streamed from a .frtex file. Only mips from residentMip() down are in memory, frTextureStreamer
+  // moves that floor by building a replacement image in the background and swapping it in once its upload
+  // completed, so neither direction waits on the GPU. Descriptors holding getView() have to be rewritten
+  // whenever viewVersion() changes.
+  class frStreamingTexture {
+    friend class frTextureStreamer;
+  public:
+    frStreamingTexture();
+    ~frStreamingTexture();
+
+    // Only maps the file, the streamer it is added to makes the tail resident.
+    bool initialize(frRenderer *renderer, const char *path, VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT);
+    void cleanup();
+
+    // Finest mip needed by this frame (camera distance, sampler feedback), the minimum of all calls since
+    // the last streamer update wins. Textures nobody asked for are the first to lose mips.
+    void requestMip(uint32_t mip);
+
+    // Mip a surface `worldSize` across needs at `distance` from a camera with vertical `fovY` (radians)
+    static uint32_t mipForDistance(uint32_t textureSize, float worldSize, float distance, float fovY, uint32_t viewportHeight);
+  public:
+    bool        isResident() const { return mImage != nullptr; }
+    frImage    *getImage() { return mImage; }
+    VkImageView getView() { return mImage ? mImage->getView() : VK_NULL_HANDLE; }
+    uint32_t    residentMip() const { return mResidentMip; }
+    uint32_t    mipLevels() const { return mFile.mipLevels(); }
+    uint32_t    viewVersion() const { return mVersion; }
+  private:
+    frTextureFile mFile{};
+    VkImageUsageFlags mUsage = 0;
+    frRenderer   *mRenderer = nullptr;
+
+    frImage  *mImage = nullptr;
+    uint32_t  mResidentMip = 0;
+    uint32_t  mVersion = 0;
+
+    frImage      *mPending = nullptr;      // Replacement being uploaded
+    uint32_t      mPendingMip = 0;
+    frUploadToken mPendingToken = 0;
+
+    uint32_t mTailMip = 0;       // First mip of the always resident tail (64 texels or less)
+    uint32_t mRequestedMip = ~0u;
+    uint32_t mDesiredMip = ~0u;
+  };
+
+  // Keeps the mips of its streaming textures within a memory budget, raising resolution where it was
+  // requested and dropping it where it wasn't (or least needed) under pressure, one mip per texture and
+  // update. Residency changes re-upload the new chain from the mapped file instead of copying the
+  // remaining mips between images, the smaller mips are a third of the top one at most.
+  class frTextureStreamer {
+  public:
+    frTextureStreamer();
+    ~frTextureStreamer();
+
+    void initialize(frRenderer *renderer, frUploadManager *uploader, VkDeviceSize budget,
+                    VkDeviceSize uploadBytesPerUpdate = 16ull * 1024 * 1024);
+    void cleanup();
+
+    void add(frStreamingTexture *texture);
+    void remove(frStreamingTexture *texture);
+
+    // Once per frame before recording: swaps in finished replacements, then starts new ones. Returns
+    // how many textures changed view.
+    uint32_t update();
+
+    void setBudget(VkDeviceSize budget) { mBudget = budget; }
+  public:
+    VkDeviceSize budget() const { return mBudget; }
+    VkDeviceSize committedBytes() const;
+  private:
+    void startTransition(frStreamingTexture *texture, uint32_t mip);
+    static VkDeviceSize targetBytes(const frStreamingTexture *texture);
+  private:
+    std::vector<frStreamingTexture*> mTextures{};
+    VkDeviceSize mBudget = 0;
+    VkDeviceSize mUploadBytesPerUpdate = 0;
+    bool         mStarted = false; // Transitions recorded since the last flush
+
+    frRenderer      *mRenderer = nullptr;
+    frUploadManager *mUploader = nullptr;
+  };
+
+  struct frFrame {
+    uint32_t           index = 0;      // Frame-in-flight slot, in [0, framesInFlight)
+    uint32_t           imageIndex = 0; // Acquired swapchain image, unrelated to `index`
+    VkCommandBuffer    cmdBuf = VK_NULL_HANDLE;
+    frSynchronization *sync = nullptr;
+  };
+
+  // Owns a fixed number of frames in flight, independent of how many images the swapchain has.
+  // Every frame has one command pool per recording thread (reset as a whole once the frame retired)
+  // and its own sync objects, and opens its region of the renderer ring buffer.
+  class frFrameManager {
+  public:
+    frFrameManager();
+    ~frFrameManager();
+
+    // With `threads` every worker gets its own pool per frame, enabling recordParallel across them.
+    void initialize(frRenderer *renderer, uint32_t framesInFlight = 2, frThreadPool *threads = nullptr);
+    void cleanup();
+
+    // Waits for the next slot, acquires a swapchain image and begins the frame's command buffer.
+    // Throws frSwapchainResizeException like frRenderer::acquireNextImage.
+    frFrame *beginFrame(frSwapchain *swapchain);
+    // Ends, submits and presents the frame returned by beginFrame.
+    void endFrame(frSwapchain *swapchain);
+
+    // Extra command buffers from the current frame's pool of `thread` (0 is the calling thread, worker
+    // `w` of the thread pool uses w + 1), recycled when the slot comes around again.
+    VkCommandBuffer allocateCommandBuffer(VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_SECONDARY, uint32_t thread = 0);
+
+    // Records `taskCount` secondary command buffers for `subpass` on the thread pool (inline without one),
+    // then executes them in task order on the current frame's command buffer. The render pass must have
+    // been begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS and the callbacks must only touch
+    // thread-safe state, everything recorded into a secondary starts from scratch (pipeline, dynamic state).
+    void recordParallel(frRenderPass *renderPass, frFramebuffer *framebuffer, uint32_t subpass, uint32_t taskCount,
+                        std::function<void(VkCommandBuffer cmdBuf, uint32_t task)> record);
+
+    // Extra graphics work for this frame, submitted ahead of the frame command buffer in the same vkQueueSubmit.
+    void addSubmission(frSubmission submission) { mSubmissions.push_back(std::move(submission)); }
+  public:
+    uint32_t framesInFlight() const { return static_cast<uint32_t>(mFrames.size()); }
+    uint32_t frameIndex() const { return mFrameIndex; }
+    frFrame *current() { return &mFrames[mFrameIndex]; }
+  private:
+    struct frFramePool {
+      VkCommandPool pool = VK_NULL_HANDLE;
+      std::vector<VkCommandBuffer> buffers[2]{}; // Indexed by VkCommandBufferLevel
+      uint32_t used[2]{};
+    };
+
+    std::vector<frFrame>     mFrames{};
+    std::vector<frFramePool> mPools{}; // framesInFlight * mThreadSlots, grouped by frame
+
+    frThreadPool *mThreads = nullptr;
+    uint32_t      mThreadSlots = 1;
+
+    std::vector<frSubmission> mSubmissions{};
+
+    // Sync of the frame that last rendered to each swapchain image, waited on before reusing the image.
+    std::vector<frSynchronization*> mImagesInFlight{};
+
+    uint32_t mFrameIndex = 0;
+
+    frRenderer *mRenderer = nullptr;
+    VkDevice mDevice = VK_NULL_HANDLE;
+  };
+
+  typedef uint32_t frGraphResource;
+
+  // How a render graph pass touches a resource, decides stages, access masks and image layouts.
+  enum frGraphUsage {
+    FR_GRAPH_COLOR_ATTACHMENT,
+    FR_GRAPH_DEPTH_ATTACHMENT,
+    FR_GRAPH_RESOLVE_ATTACHMENT,
+    FR_GRAPH_SAMPLED,        // Sampled image in fragment or compute shaders
+    FR_GRAPH_STORAGE_READ,
+    FR_GRAPH_STORAGE_WRITE,
+    FR_GRAPH_TRANSFER_SRC,
+    FR_GRAPH_TRANSFER_DST,
+    FR_GRAPH_VERTEX_BUFFER,
+    FR_GRAPH_INDEX_BUFFER,
+    FR_GRAPH_UNIFORM_BUFFER,
+    FR_GRAPH_INDIRECT_BUFFER,
+  };
+
+  class frRenderGraph;
+  // Handed to a pass' setup callback to declare the resources it reads and writes.
+  class frGraphPassBuilder {
+    friend class frRenderGraph;
+  public:
+    struct frGraphImageInfo {
+      uint32_t              width;
+      uint32_t              height;
+      VkFormat              format;
+      VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+      VkImageAspectFlagBits aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    };
+  public:
+    // Transient image owned by the graph, its memory is shared with transients that are never alive at the same time.
+    frGraphResource createImage(const char *name, frGraphImageInfo info);
+
+    void read(frGraphResource resource, frGraphUsage usage);
+    // Writes keep the earlier contents (and their writers) unless `discard` says the pass overwrites all of it.
+    void write(frGraphResource resource, frGraphUsage usage, bool discard = false);
+
+    // Attachments are bound in declaration order, the pass runs inside a render pass built from them.
+    void colorAttachment(frGraphResource image, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR, VkClearValue clear = {});
+    void depthAttachment(frGraphResource image, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR, VkClearValue clear = {});
+    void resolveAttachment(frGraphResource image);
+
+    void secondaryCommandBuffers(); // Render pass contents come from secondaries (frFrameManager::recordParallel)
+    void sideEffects();             // Never culled, even if nothing reads what it writes
+  private:
+    frGraphPassBuilder(frRenderGraph *graph, uint32_t pass):
+      mGraph(graph), mPass(pass) {}
+
+    frRenderGraph *mGraph;
+    uint32_t       mPass;
+  };
+
+  // Frame graph: passes declare what they touch, compile() culls passes whose results are never used,
+  // derives one batched barrier per pass from the declared accesses, builds render passes for the
+  // attachments and places transient images with disjoint lifetimes in the same memory.
+  // Imported resources count as outputs, their writers always survive culling.
+  class frRenderGraph {
+    friend class frGraphPassBuilder;
+  public:
+    frRenderGraph();
+    ~frRenderGraph();
+
+    void initialize(frRenderer *renderer);
+    void cleanup();
+
+    frGraphResource importImage(const char *name, frImage *image, VkImageLayout initialLayout, VkImageLayout finalLayout);
+    frGraphResource importBuffer(const char *name, frBuffer *buffer);
+    // Swaps the image behind an imported resource, e.g. the acquired swapchain image, without recompiling.
+    void setImage(frGraphResource resource, frImage *image);
+    void markOutput(frGraphResource resource);
+
+    void addPass(const char *name, std::function<void(frGraphPassBuilder &builder)> setup, std::function<void(VkCommandBuffer cmdBuf)> execute);
+
+    // Must be called again after passes or imported image formats/sizes change, the GPU has to be done with the previous compile.
+    void compile();
+    void execute(VkCommandBuffer cmdBuf);
+    // Drops every pass and resource (and their GPU objects) so the graph can be declared again.
+    void reset();
+  public:
+    // Valid inside the execute callback of a pass with attachments.
+    frRenderPass  *currentRenderPass() const { return mCurrentRenderPass; }
+    frFramebuffer *currentFramebuffer() const { return mCurrentFramebuffer; }
+
+    uint32_t     culledPassCount() const { return mCulledPasses; }
+    VkDeviceSize transientMemorySize() const { return mTransientMemory; }
+  private:
+    struct frGraphAccess {
+      frGraphResource    resource;
+      frGraphUsage       usage;
+      bool               write;
+      bool               attachment = false;
+      VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+      VkClearValue       clear{};
+      bool               discard = false; // Non-attachment write replacing the whole resource
+
+      // Whether nothing written before this access survives it
+      bool overwrites() const { return write && (attachment ? loadOp != VK_ATTACHMENT_LOAD_OP_LOAD : discard); }
+    };
+
+    struct frGraphBarrier {
+      frGraphResource resource;
+      VkImageLayout   oldLayout;
+      VkImageLayout   newLayout;
+      VkAccessFlags   srcAccess;
+      VkAccessFlags   dstAccess;
+    };
+
+    struct frGraphBarrierBatch {
+      std::vector<frGraphBarrier> barriers{};
+      VkPipelineStageFlags srcStages = 0;
+      VkPipelineStageFlags dstStages = 0;
+    };
+
+    // Last access of a resource, what the next barrier has to wait for
+    struct frGraphState {
+      VkImageLayout        layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      VkPipelineStageFlags writeStages = 0;
+      VkAccessFlags        writeAccess = 0;
+      VkPipelineStageFlags readStages = 0;  // Readers since the last write, already synchronized with it
+      VkAccessFlags        readAccess = 0;
+    };
+
+    struct frGraphResourceData {
+      std::string name;
+      bool        image = true;
+      bool        imported = false;
+      bool        output = false;
+
+      frImage  *imageHandle = nullptr;
+      frBuffer *bufferHandle = nullptr;
+
+      frGraphPassBuilder::frGraphImageInfo info{};
+      VkImageUsageFlags usage = 0;
+      VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+      // Filled by compile()
+      bool     live = false;
+      uint32_t firstPass = UINT32_MAX;
+      uint32_t lastPass = 0;
+      int32_t  aliasSlot = -1;
+    };
+
+    struct frGraphPass {
+      std::string name;
+      std::function<void(VkCommandBuffer)> execute;
+      std::vector<frGraphAccess> accesses{};
+      bool sideEffects = false;
+      bool secondaries = false;
+
+      // Filled by compile()
+      bool culled = false;
+      frGraphBarrierBatch barriers{};
+      frRenderPass *renderPass = nullptr;
+      std::vector<frGraphResource> attachments{};
+      std::vector<VkClearValue>    clearValues{};
+      std::map<std::vector<VkImageView>, frFramebuffer*> framebuffers{};
+    };
+
+    struct frAliasSlot {
+      VkMemoryRequirements requirements{};
+      uint32_t             lastPass = 0;
+      frAllocation         allocation{};
+    };
+
+    void releaseCompiled();
+    void cull();
+    void createTransients();
+    void computeBarriers();
+    void createRenderPasses();
+    void recordBarriers(VkCommandBuffer cmdBuf, const frGraphBarrierBatch &batch);
+    frFramebuffer *getFramebuffer(frGraphPass &pass);
+  private:
+    std::vector<frGraphResourceData> mResources{};
+    std::vector<frGraphPass>         mPasses{};
+    std::vector<frAliasSlot>         mAliasSlots{};
+    std::vector<frImage*>            mTransientImages{};
+    frGraphBarrierBatch              mFinalBarriers{};
+    frBarrierBatch                   mBarriers{};
+
+    bool         mCompiled = false;
+    uint32_t     mCulledPasses = 0;
+    VkDeviceSize mTransientMemory = 0;
+
+    frRenderPass  *mCurrentRenderPass = nullptr;
+    frFramebuffer *mCurrentFramebuffer = nullptr;
+
+    frRenderer *mRenderer = nullptr;
+    VkDevice mDevice = VK_NULL_HANDLE;
+  };
+
+  // Every vkQueueSubmit/vkQueuePresentKHR of the renderer goes through here. Submissions for a queue
+  // are collected with add() and flushed as one vkQueueSubmit, either directly or on a dedicated
+  // thread (frRenderer::enableSubmitThread) so the caller never blocks inside the driver. Work is
+  // executed in call order across all queues, which keeps timeline values and binary semaphore
+  // signal-before-wait ordering intact.
+  class frSubmitQueue {
+  public:
+    frSubmitQueue();
+    ~frSubmitQueue();
+
+    void initialize(frRenderer *renderer, bool threaded = false);
+    void cleanup();
+
+    void add(VkQueue queue, frSubmission submission);
+    void flush(VkQueue queue, VkFence fence = VK_NULL_HANDLE);
+    void submit(VkQueue queue, frSubmission submission, VkFence fence = VK_NULL_HANDLE);
+
+    // In threaded mode the result is the one of an earlier present, errors surface one frame late.
+    VkResult present(VkQueue queue, VkSwapchainKHR swapchain, uint32_t imageIndex, VkSemaphore waitSemaphore);
+    // vkAcquireNextImageKHR without a timeout. In threaded mode it runs on the submit thread behind the queued
+    // presents, which keeps the swapchain externally synchronized without the queue lock, the caller just blocks.
+    VkResult acquire(VkSwapchainKHR swapchain, VkSemaphore semaphore, uint32_t *imageIndex);
+
+    // Blocks until the submit thread handed everything to the driver, rethrows its errors.
+    void drain();
+
+    // Held while talking to a queue, take it for anything else that needs the queues externally
+    // synchronized (vkQueueWaitIdle, vkDeviceWaitIdle).
+    std::unique_lock<std::mutex> lock() { return std::unique_lock<std::mutex>(mQueueMutex); }
+  public:
+    bool threaded() const { return mThread.joinable(); }
+  private:
+    struct frAcquire {
+      VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+      VkSemaphore    semaphore = VK_NULL_HANDLE;
+      uint32_t       imageIndex = 0;
+      VkResult       result = VK_SUCCESS;
+      bool           done = false;
+    };
+
+    struct frQueueWork {
+      VkQueue                   queue = VK_NULL_HANDLE;
+      std::vector<frSubmission> submissions{};
+      VkFence                   fence = VK_NULL_HANDLE;
+
+      VkSwapchainKHR swapchain = VK_NULL_HANDLE; // Present instead of submit when set
+      uint32_t       imageIndex = 0;
+      VkSemaphore    presentWait = VK_NULL_HANDLE;
+
+      frAcquire     *acquire = nullptr;          // Acquire instead, owned by the waiting caller
+    };
+
+    VkResult execute(frQueueWork &work);
+    void threadLoop();
+    void rethrow();
+  private:
+    std::vector<frQueueWork> mPending{}; // One entry per queue with submissions not flushed yet
+
+    std::thread                mThread;
+    std::deque<frQueueWork>    mWork{};
+    std::mutex                 mWorkMutex;
+    std::condition_variable    mWorkAvailable;
+    std::condition_variable    mDrained;
+    std::condition_variable    mAcquired;
+    bool                       mBusy = false;
+    bool                       mStopping = false;
+    VkResult                   mPresentResult = VK_SUCCESS;
+    std::exception_ptr         mError = nullptr;
+
+    std::mutex mQueueMutex;
+
+    bool mTimelineSemaphores = false;
     VkDevice mDevice = VK_NULL_HANDLE;
   };
 
@@ -510,6 +1866,17 @@ namespace fr {
     friend class frCommands;
     friend class frSynchronization;
     friend class frBuffer;
+    friend class frAllocator;
+    friend class frRingBuffer;
+    friend class frUploadManager;
+    friend class frTimeline;
+    friend class frFrameManager;
+    friend class frSubmitQueue;
+    friend class frRenderGraph;
+    friend class frBarrierBatch;
+    friend class frMipGenerator;
+    friend class frPipelineCompiler;
+    friend class frPipelineLibrary;
   public:
     frRenderer();
     ~frRenderer();
@@ -521,6 +1888,12 @@ namespace fr {
     void addExtension(const char *extensionName) { mExtensions.push_back(extensionName); }
     void setApplicationName(const char *appName) { mApplicationName = appName; }
     void enableValidation() { mValidation = true; }
+    void setRingBufferSize(VkDeviceSize size) { mRingBufferSize = size; } // 0 disables the renderer-owned ring buffer
+    void enableTransferQueue() { mTransferQueueRequested = true; } // Falls back to the graphics queue if no other family can transfer
+    void enableTimelineSemaphores() { mTimelineRequested = true; }  // Vulkan 1.2 or VK_KHR_timeline_semaphore, ignored if unsupported
+    void enableSubmitThread() { mSubmitThreadRequested = true; }     // Queue submits and presents run on a dedicated thread
+    void setPipelineCachePath(const char *path) { mPipelineCachePath = path; } // Loaded at initialize, saved at cleanup
+    void enableShaderObjects() { mShaderObjectRequested = true; } // frPipeline binds VkShaderEXTs, frRenderPass uses dynamic rendering, Vulkan 1.3 and VK_EXT_shader_object
 
     void setSurfaceFormat(VkFormat format) { mSurfaceFormat = format; }
 
@@ -529,9 +1902,42 @@ namespace fr {
     void present(frSwapchain *swapchain, frSynchronization *sync, uint32_t *imageIndex);
 
     void waitIdle();
+
+    // Runs `deleter` once the GPU has finished everything submitted so far. Without timelines that is once
+    // the next fenced submit (frSynchronization::attach) has been waited on, frFrameManager::beginFrame does so
+    // every frame, or at waitIdle.
+    void deferDeletion(std::function<void()> deleter);
+    // Runs `deleter` once the last submission using `sync` has finished, call it after that submit.
+    void deferDeletion(std::function<void()> deleter, frSynchronization *sync);
+    void collectDeletions();
+
+    frAllocator   *getAllocator()   { return &mAllocator; }
+    frRingBuffer  *getRingBuffer()  { return mRingBufferSize ? &mRingBuffer : nullptr; }
+    frSubmitQueue *getSubmitQueue() { return &mSubmitQueue; }
+
+    // Shared by every pipeline the renderer creates. Writes it to the path given to setPipelineCachePath(),
+    // false without one or if the file can't be written.
+    bool savePipelineCache();
+    VkPipelineCache getPipelineCache() const { return mPipelineCache; }
+
+    VkQueue  getGraphicsQueue() const       { return mGraphicsQueue; }
+    VkQueue  getTransferQueue() const       { return mTransferQueue; }
+    uint32_t getTransferQueueFamily() const { return mTransferQueueFamily; }
+    uint32_t getGraphicsQueueFamily() const { return mGraphicsQueueFamily; }
+    bool     hasDedicatedTransferQueue() const { return mTransferQueueFamily != mGraphicsQueueFamily; }
+
+    bool        supportsTimelineSemaphores() const { return mTimelineSemaphores; }
+    bool        supportsSynchronization2() const { return mSynchronization2; }
+    bool        supportsTextureCompressionBC() const { return mTextureCompressionBC; }
+    bool        supportsGraphicsPipelineLibrary() const { return mGraphicsPipelineLibrary; }
+    // Whether frCommands can record `state`: always for Vulkan 1.0 states, extended dynamic state 1/2/3 otherwise
+    bool        supportsDynamicState(VkDynamicState state) const;
+    bool        usesShaderObjects() const { return mShaderObject; }
+    frTimeline *getTimeline() { return mTimelineSemaphores ? &mTimeline : nullptr; }
+    uint32_t    getApiVersion() const { return mApiVersion; }
   public: // Utilities
     uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
-    void CreateBuffer(VkDeviceSize size, VkBufferUsageFlagBits usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory *bufferMemory);
+    void CreateBuffer(VkDeviceSize size, VkBufferUsageFlagBits usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, frAllocation *allocation);
     VkSampleCountFlagBits GetMaxUsableSampleCount();
     VkSampleCountFlagBits GetMaxUsableSampleCount(VkPhysicalDeviceProperties properties);
     VkFormat FindSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
@@ -548,12 +1954,99 @@ namespace fr {
     std::vector<const char *> mDeviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
     VkFormat mSurfaceFormat = VK_FORMAT_UNDEFINED;
+
+    VkDeviceSize mRingBufferSize = 4 * 1024 * 1024;
+    bool mTransferQueueRequested = false;
+    bool mTimelineRequested = false;
+    bool mSubmitThreadRequested = false;
+    bool mShaderObjectRequested = false;
+    const char *mPipelineCachePath = nullptr;
   private:
+    bool hasDeviceExtension(const char *extensionName) const;
+
     VkInstance mInstance = VK_NULL_HANDLE;
     VkSurfaceKHR mSurface = VK_NULL_HANDLE;
     VkPhysicalDevice mPhysicalDevice = VK_NULL_HANDLE;
     VkDevice mDevice = VK_NULL_HANDLE;
 
+    uint32_t mApiVersion = VK_API_VERSION_1_1;
+    std::vector<VkExtensionProperties> mAvailableDeviceExtensions{};
+
+    bool       mTimelineSemaphores = false;
+    frTimeline mTimeline{};
+
+    // Vulkan 1.3 or VK_KHR_synchronization2, used by frBarrierBatch when present
+    bool mSynchronization2 = false;
+    PFN_vkCmdPipelineBarrier2 mCmdPipelineBarrier2 = nullptr;
+    PFN_vkCmdSetEvent2        mCmdSetEvent2 = nullptr;
+    PFN_vkCmdWaitEvents2      mCmdWaitEvents2 = nullptr;
+    PFN_vkCmdResetEvent2      mCmdResetEvent2 = nullptr;
+
+    bool mTextureCompressionBC = false;
+
+    // VK_EXT_graphics_pipeline_library, used by frPipelineLibrary when present
+    bool mGraphicsPipelineLibrary = false;
+    bool mGraphicsPipelineFastLinking = false;
+
+    // Vulkan 1.3 or VK_EXT_extended_dynamic_state, VK_EXT_extended_dynamic_state2/3
+    bool mExtendedDynamicState = false;
+    bool mExtendedDynamicState2 = false;
+    bool mExtendedDynamicState2LogicOp = false;
+    bool mExtendedDynamicState2PatchControlPoints = false;
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT mExtendedDynamicState3{};
+    PFN_vkCmdSetCullMode                  mCmdSetCullMode = nullptr;
+    PFN_vkCmdSetFrontFace                 mCmdSetFrontFace = nullptr;
+    PFN_vkCmdSetPrimitiveTopology         mCmdSetPrimitiveTopology = nullptr;
+    PFN_vkCmdSetDepthTestEnable           mCmdSetDepthTestEnable = nullptr;
+    PFN_vkCmdSetDepthWriteEnable          mCmdSetDepthWriteEnable = nullptr;
+    PFN_vkCmdSetDepthCompareOp            mCmdSetDepthCompareOp = nullptr;
+    PFN_vkCmdSetDepthBoundsTestEnable     mCmdSetDepthBoundsTestEnable = nullptr;
+    PFN_vkCmdSetStencilTestEnable         mCmdSetStencilTestEnable = nullptr;
+    PFN_vkCmdSetStencilOp                 mCmdSetStencilOp = nullptr;
+    PFN_vkCmdSetRasterizerDiscardEnable   mCmdSetRasterizerDiscardEnable = nullptr;
+    PFN_vkCmdSetDepthBiasEnable           mCmdSetDepthBiasEnable = nullptr;
+    PFN_vkCmdSetPrimitiveRestartEnable    mCmdSetPrimitiveRestartEnable = nullptr;
+    PFN_vkCmdSetLogicOpEXT                mCmdSetLogicOp = nullptr;
+    PFN_vkCmdSetPatchControlPointsEXT     mCmdSetPatchControlPoints = nullptr;
+    PFN_vkCmdSetPolygonModeEXT            mCmdSetPolygonMode = nullptr;
+    PFN_vkCmdSetDepthClampEnableEXT       mCmdSetDepthClampEnable = nullptr;
+    PFN_vkCmdSetColorBlendEnableEXT       mCmdSetColorBlendEnable = nullptr;
+    PFN_vkCmdSetColorBlendEquationEXT     mCmdSetColorBlendEquation = nullptr;
+    PFN_vkCmdSetColorWriteMaskEXT         mCmdSetColorWriteMask = nullptr;
+
+    // VK_EXT_shader_object, which also provides every dynamic state command above
+    bool mShaderObject = false;
+    VkPhysicalDeviceFeatures mEnabledFeatures{};
+    PFN_vkCreateShadersEXT                    mCreateShaders = nullptr;
+    PFN_vkDestroyShaderEXT                    mDestroyShader = nullptr;
+    PFN_vkCmdBindShadersEXT                   mCmdBindShaders = nullptr;
+    PFN_vkCmdSetVertexInputEXT                mCmdSetVertexInput = nullptr;
+    PFN_vkCmdSetViewportWithCount             mCmdSetViewportWithCount = nullptr;
+    PFN_vkCmdSetScissorWithCount              mCmdSetScissorWithCount = nullptr;
+    PFN_vkCmdSetRasterizationSamplesEXT       mCmdSetRasterizationSamples = nullptr;
+    PFN_vkCmdSetSampleMaskEXT                 mCmdSetSampleMask = nullptr;
+    PFN_vkCmdSetAlphaToCoverageEnableEXT      mCmdSetAlphaToCoverageEnable = nullptr;
+    PFN_vkCmdSetAlphaToOneEnableEXT           mCmdSetAlphaToOneEnable = nullptr;
+    PFN_vkCmdSetLogicOpEnableEXT              mCmdSetLogicOpEnable = nullptr;
+    PFN_vkCmdSetTessellationDomainOriginEXT   mCmdSetTessellationDomainOrigin = nullptr;
+    PFN_vkCmdBeginRendering                   mCmdBeginRendering = nullptr; // Shader objects only draw in dynamic rendering
+    PFN_vkCmdEndRendering                     mCmdEndRendering = nullptr;
+
+    VkPipelineCache mPipelineCache = VK_NULL_HANDLE;
+
+    struct frDeferredDeletion {
+      uint64_t              value; // Timeline value, frame number without timelines
+      std::function<void()> deleter;
+    };
+    std::vector<frDeferredDeletion> mDeferredDeletions{};
+    // Without timelines, the clock deferred deletions run on: fenced submits so far and the newest one waited on
+    uint64_t mFrameNumber = 0;
+    uint64_t mFramesCompleted = 0;
+
+    frAllocator   mAllocator{};
+    frRingBuffer  mRingBuffer{};
+    frSubmitQueue mSubmitQueue{};
+
     VkQueue mGraphicsQueue        = VK_NULL_HANDLE;
     uint32_t mGraphicsQueueFamily = 0;
     bool mGraphicsQueueSet        = false;
@@ -561,6 +2054,9 @@ namespace fr {
     VkQueue mPresentQueue        = VK_NULL_HANDLE;
     uint32_t mPresentQueueFamily = 0;
     bool mPresentQueueSet        = false;
+
+    VkQueue mTransferQueue        = VK_NULL_HANDLE;
+    uint32_t mTransferQueueFamily = 0;
   public: // Debug Utilities
     PFN_vkSetDebugUtilsObjectNameEXT getSetDebugUtilsObjectNameFunc() {
       static PFN_vkSetDebugUtilsObjectNameEXT sSetDebugUtilsObjectNameFunc;
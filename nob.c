@@ -108,6 +108,16 @@ int example() {
   return 0;
 }
 
+int tools() {
+  Nob_Cmd cmd = {0};
+  nob_cmd_append(&cmd, "g++", CXXFLAGS, "-O2", INCLUDES, "-I./example/", "-o", "./build/frtex", "./tools/frtex.cpp", "./tools/bcenc.cpp");
+  if (!nob_cmd_run_sync(cmd)) return 1;
+
+  nob_log(NOB_INFO, "successfully built tools");
+
+  return 0;
+}
+
 int main(int argc, char **argv) {
   NOB_GO_REBUILD_URSELF(argc, argv);
 
@@ -120,6 +130,8 @@ int main(int argc, char **argv) {
     const char *flag = nob_shift_args(&argc, &argv);
     if (strcmp(flag, "example") == 0) {
       result = example();
+    } else if (strcmp(flag, "tools") == 0) {
+      result = tools();
     } else {
       nob_log(NOB_ERROR, "unknown subcommand %s", flag);
     }
@@ -5,11 +5,47 @@
 #include <set>
 #include <limits>
 #include <algorithm>
+#include <type_traits>
 
 #include <sstream>
 
 #include <cmath>
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FR_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#define FR_SSSE3 1
+#include <tmmintrin.h>
+#elif defined(FR_SSE2) && (defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER))
+// Built for plain SSE2: SSSE3 kernels are compiled for it on their own and picked at runtime
+#define FR_SSSE3_DISPATCH 1
+#include <tmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+#if defined(FR_SSSE3_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define FR_TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define FR_TARGET_SSSE3
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FR_NEON 1
+#include <arm_neon.h>
+#endif
+
 #undef max
 
 namespace fr {
@@ -232,6 +268,43 @@ namespace fr {
   // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frSampler]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
   // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frImage]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  // UNORM format with the same bits as an sRGB one, `format` itself otherwise
+  static VkFormat UnormFormat(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_R8_SRGB:        return VK_FORMAT_R8_UNORM;
+    case VK_FORMAT_R8G8_SRGB:      return VK_FORMAT_R8G8_UNORM;
+    case VK_FORMAT_R8G8B8A8_SRGB:  return VK_FORMAT_R8G8B8A8_UNORM;
+    case VK_FORMAT_B8G8R8A8_SRGB:  return VK_FORMAT_B8G8R8A8_UNORM;
+    case VK_FORMAT_A8B8G8R8_SRGB_PACK32: return VK_FORMAT_A8B8G8R8_UNORM_PACK32;
+    default: return format;
+    }
+  }
+
+  // Bytes per 4x4 block of a BC format, 0 for formats addressed per texel
+  static uint32_t BlockSize(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+      return 8;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+      return 16;
+    default: return 0;
+    }
+  }
+
   frImage::frImage()
   {}
 
@@ -240,7 +313,14 @@ namespace fr {
   }
 
   void frImage::initialize(frRenderer *renderer, frImageInfo info) {
-    info.mipLevels = info.generateMipmaps ? static_cast<uint32_t>(std::floor(std::log2(std::max(info.width, info.height)))) + 1 : 1;
+    if (BlockSize(info.format)) { // Blits and storage writes can't target BC formats, mips come precomputed
+      if (info.generateMipmaps) throw fr::frVulkanException("Block-compressed images can't generate mipmaps!");
+      if (renderer->FindSupportedFormat({ info.format }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) == VK_FORMAT_UNDEFINED) {
+        throw fr::frVulkanException("Block-compressed format not supported by the device!");
+      }
+    }
+
+    if (info.generateMipmaps) info.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(info.width, info.height)))) + 1;
 
     { // Create image
       VkImageCreateInfo createInfo{};
@@ -257,53 +337,53 @@ namespace fr {
       createInfo.usage = info.usage;
       createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
       createInfo.samples = info.samples;
-      createInfo.flags = info.layers>1?VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT:0;
+      createInfo.flags = (info.cube || (info.layers>=6 && info.width==info.height))?VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT:0;
+      if ((info.usage & VK_IMAGE_USAGE_STORAGE_BIT) && UnormFormat(info.format) != info.format) {
+        // sRGB can't be a storage format, frMipGenerator writes through a UNORM view and the sRGB view drops the usage
+        createInfo.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT | VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
+      }
 
       VK_WRAPPER(vkCreateImage(renderer->mDevice, &createInfo, nullptr, &mImage));
     }
 
-    if (info.memory) { // Create and bind image memory
+    if (info.memory) { // Allocate and bind image memory
       VkMemoryRequirements memRequirements;
       vkGetImageMemoryRequirements(renderer->mDevice, mImage, &memRequirements);
 
-      VkMemoryAllocateInfo allocInfo{};
-      allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-      allocInfo.allocationSize = memRequirements.size;
-      allocInfo.memoryTypeIndex = renderer->FindMemoryType(memRequirements.memoryTypeBits, info.memoryProperties);
-
-      VK_WRAPPER(vkAllocateMemory(renderer->mDevice, &allocInfo, nullptr, &mImageMemory));
+      mAllocation = renderer->mAllocator.allocate(memRequirements, info.memoryProperties, false);
 
-      vkBindImageMemory(renderer->mDevice, mImage, mImageMemory, 0);
+      VK_WRAPPER(vkBindImageMemory(renderer->mDevice, mImage, mAllocation.block->memory, mAllocation.offset));
     }
 
     mInfo = info;
+    mAllocator = &renderer->mAllocator;
     mDevice = renderer->mDevice;
+    mBarriers.initialize(renderer);
+    initializeState();
 
-    createView();
+    if (info.memory) createView(); // Otherwise bindMemory() creates it
   }
 
   void frImage::initialize(frRenderer *renderer, VkImage image, frImageInfo info) {
     mDestroyImage = false;
     mImage = image;
 
-    info.mipLevels = info.generateMipmaps ? static_cast<uint32_t>(std::floor(std::log2(std::max(info.width, info.height)))) + 1 : 1;
+    if (info.generateMipmaps) info.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(info.width, info.height)))) + 1;
 
-    if (info.memory) { // Create and bind image memory
+    if (info.memory) { // Allocate and bind image memory
       VkMemoryRequirements memRequirements;
       vkGetImageMemoryRequirements(renderer->mDevice, mImage, &memRequirements);
 
-      VkMemoryAllocateInfo allocInfo{};
-      allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-      allocInfo.allocationSize = memRequirements.size;
-      allocInfo.memoryTypeIndex = renderer->FindMemoryType(memRequirements.memoryTypeBits, info.memoryProperties);
-
-      VK_WRAPPER(vkAllocateMemory(renderer->mDevice, &allocInfo, nullptr, &mImageMemory));
+      mAllocation = renderer->mAllocator.allocate(memRequirements, info.memoryProperties, false);
 
-      vkBindImageMemory(renderer->mDevice, mImage, mImageMemory, 0);
+      VK_WRAPPER(vkBindImageMemory(renderer->mDevice, mImage, mAllocation.block->memory, mAllocation.offset));
     }
 
     mInfo = info;
+    mAllocator = &renderer->mAllocator;
     mDevice = renderer->mDevice;
+    mBarriers.initialize(renderer);
+    initializeState();
 
     createView();
   }
@@ -311,37 +391,35 @@ namespace fr {
   void frImage::cleanup() {
     if (mImageView) vkDestroyImageView(mDevice, mImageView, nullptr);
     if (mImage && mDestroyImage) vkDestroyImage(mDevice, mImage, nullptr);
-    if (mImageMemory) vkFreeMemory(mDevice, mImageMemory, nullptr);
+    if (mAllocator) mAllocator->free(mAllocation);
   }
 
   void frImage::transitionLayout(frRenderer *renderer, frCommands *commands, frImageTransitionInfo info) {
     VkCommandBuffer cmdBuf = commands->getSingleTime();
 
-    VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = info.oldLayout;
-    barrier.newLayout = info.newLayout;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = mImage;
-    barrier.subresourceRange.aspectMask = mInfo.imageAspect;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = mInfo.mipLevels;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = static_cast<uint32_t>(mInfo.layers);
-    barrier.srcAccessMask = info.srcAccess;
-    barrier.dstAccessMask = info.dstAccess;
-    
-    vkCmdPipelineBarrier(
-      cmdBuf,
-      info.srcStage, info.dstStage,
-      0, 0, nullptr, 0, nullptr, 1, &barrier
-    );
+    transitionLayout(cmdBuf, info);
 
     if (!commands->singleTimeFrameActive()) commands->endSingleTime(renderer, cmdBuf);
   }
 
+  void frImage::transitionLayout(VkCommandBuffer cmdBuf, frImageTransitionInfo info, frSubresourceRange range) {
+    mBarriers.addImage(mImage, resolveRange(range), info.oldLayout, info.newLayout,
+      info.srcStage, info.srcAccess, info.dstStage, info.dstAccess,
+      info.srcQueueFamily, info.dstQueueFamily);
+    mBarriers.flush(cmdBuf);
+
+    setState(frImageAccess{ info.newLayout, info.dstStage, info.dstAccess }, range);
+  }
+
   void frImage::generateMipmaps(frRenderer *renderer, frCommands *commands) {
+    VkCommandBuffer cmdBuf = commands->getSingleTime();
+
+    generateMipmaps(renderer, cmdBuf);
+
+    if (!commands->singleTimeFrameActive()) commands->endSingleTime(renderer, cmdBuf);
+  }
+
+  void frImage::generateMipmaps(frRenderer *renderer, VkCommandBuffer cmdBuf) {
     VkFormatProperties formatProperties;
     vkGetPhysicalDeviceFormatProperties(renderer->mPhysicalDevice, mInfo.format, &formatProperties);
 
@@ -349,33 +427,15 @@ namespace fr {
       throw fr::frVulkanException("Texture image format does not support linear blitting!");
     }
 
-    VkCommandBuffer cmdBuf = commands->getSingleTime();
-    
-    VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.image = mImage;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.subresourceRange.levelCount = 1;
-
+    uint32_t layers = static_cast<uint32_t>(std::max(mInfo.layers, 1));
     int32_t mipWidth = mInfo.width;
     int32_t mipHeight = mInfo.height;
 
+    // Mip 0 may be in any layout, the levels below are overwritten completely
     for (uint32_t i = 1; i < mInfo.mipLevels; i++) {
-      barrier.subresourceRange.baseMipLevel = i - 1;
-      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-      barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-      barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-      vkCmdPipelineBarrier(cmdBuf,
-        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier);
+      require(FR_IMAGE_USAGE_TRANSFER_SRC, frSubresourceRange{ i - 1, 1 });
+      require(FR_IMAGE_USAGE_TRANSFER_DST, frSubresourceRange{ i, 1 }, true);
+      flushBarriers(cmdBuf);
 
       VkImageBlit blit{};
       blit.srcOffsets[0] = {0, 0, 0};
@@ -383,13 +443,13 @@ namespace fr {
       blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
       blit.srcSubresource.mipLevel = i - 1;
       blit.srcSubresource.baseArrayLayer = 0;
-      blit.srcSubresource.layerCount = 1;
+      blit.srcSubresource.layerCount = layers;
       blit.dstOffsets[0] = {0, 0, 0};
       blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1 };
       blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
       blit.dstSubresource.mipLevel = i;
       blit.dstSubresource.baseArrayLayer = 0;
-      blit.dstSubresource.layerCount = 1;
+      blit.dstSubresource.layerCount = layers;
 
       vkCmdBlitImage(cmdBuf,
         mImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
@@ -397,66 +457,74 @@ namespace fr {
         1, &blit,
         VK_FILTER_LINEAR);
 
-      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-      barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-      vkCmdPipelineBarrier(cmdBuf,
-        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier);
-
       if (mipWidth > 1) mipWidth /= 2;
       if (mipHeight > 1) mipHeight /= 2;
     }
 
-    barrier.subresourceRange.baseMipLevel = mInfo.mipLevels - 1;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    vkCmdPipelineBarrier(cmdBuf,
-      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-      0, nullptr,
-      0, nullptr,
-      1, &barrier);
-
-    if (!commands->singleTimeFrameActive()) commands->endSingleTime(renderer, cmdBuf);
+    // Levels that end up in the same state share one barrier
+    transition(cmdBuf, FR_IMAGE_USAGE_SAMPLED_FRAGMENT);
   }
 
   void frImage::copyFromBuffer(frRenderer *renderer, frCommands *commands, frBuffer *buffer, uint32_t baseArrayLayer) {
     VkCommandBuffer cmdBuf = commands->getSingleTime();
 
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
+    copyFromBuffer(cmdBuf, buffer->get(), 0, baseArrayLayer);
 
-    region.imageSubresource.aspectMask = mInfo.imageAspect;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = baseArrayLayer;
-    region.imageSubresource.layerCount = 1;
+    if (!commands->singleTimeFrameActive()) commands->endSingleTime(renderer, cmdBuf);
+  }
 
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {
-      static_cast<uint32_t>(mInfo.width), 
-      static_cast<uint32_t>(mInfo.height), 
-      1
-    };
+  void frImage::copyFromBuffer(VkCommandBuffer cmdBuf, VkBuffer buffer, VkDeviceSize offset, uint32_t baseArrayLayer) {
+    copyFromBuffer(cmdBuf, buffer, std::vector<frCopyRegion>{ frCopyRegion{ 0, baseArrayLayer, offset } });
+  }
+
+  void frImage::copyFromBuffer(VkCommandBuffer cmdBuf, VkBuffer buffer, const std::vector<frCopyRegion> &regions) {
+    std::vector<VkBufferImageCopy> copies(regions.size());
+    for (size_t i = 0; i < regions.size(); ++i) {
+      const frCopyRegion &region = regions[i];
+      VkBufferImageCopy &copy = copies[i];
+      copy.bufferOffset = region.offset;
+      copy.bufferRowLength = region.rowLength;
+      copy.bufferImageHeight = region.imageHeight;
+
+      copy.imageSubresource.aspectMask = mInfo.imageAspect;
+      copy.imageSubresource.mipLevel = region.mip;
+      copy.imageSubresource.baseArrayLayer = region.layer;
+      copy.imageSubresource.layerCount = region.layerCount;
+
+      copy.imageOffset = {0, 0, 0};
+      copy.imageExtent = {
+        std::max(1u, static_cast<uint32_t>(mInfo.width) >> region.mip),
+        std::max(1u, static_cast<uint32_t>(mInfo.height) >> region.mip),
+        1
+      };
+    }
 
     vkCmdCopyBufferToImage(
       cmdBuf,
-      buffer->get(),
+      buffer,
       mImage,
       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-      1,
-      &region
+      static_cast<uint32_t>(copies.size()),
+      copies.data()
     );
+  }
 
-    if (!commands->singleTimeFrameActive()) commands->endSingleTime(renderer, cmdBuf);
+  void frImage::copyRectFromBuffer(VkCommandBuffer cmdBuf, VkBuffer buffer, VkDeviceSize offset, uint32_t rowLength,
+                                   VkRect2D rect, uint32_t mip, uint32_t layer) {
+    VkBufferImageCopy region{};
+    region.bufferOffset = offset;
+    region.bufferRowLength = rowLength;
+    region.bufferImageHeight = 0;
+
+    region.imageSubresource.aspectMask = mInfo.imageAspect;
+    region.imageSubresource.mipLevel = mip;
+    region.imageSubresource.baseArrayLayer = layer;
+    region.imageSubresource.layerCount = 1;
+
+    region.imageOffset = { rect.offset.x, rect.offset.y, 0 };
+    region.imageExtent = { rect.extent.width, rect.extent.height, 1 };
+
+    vkCmdCopyBufferToImage(cmdBuf, buffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
   }
 
   void frImage::copyToBuffer(frRenderer *renderer, frCommands *commands, frBuffer *buffer, VkDeviceSize offset) {
@@ -503,12 +571,12 @@ namespace fr {
       VK_WRAPPER(renderer->getSetDebugUtilsObjectNameFunc()(mDevice, &objectNameInfo));
     }
 
-    if (mImageMemory) { // Set name for mImageMemory
+    if (mAllocation.block && mAllocation.block->dedicated) { // Set name for dedicated image memory
       VkDebugUtilsObjectNameInfoEXT objectNameInfo = {};
       objectNameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
       objectNameInfo.pNext = nullptr;
       objectNameInfo.objectType = VK_OBJECT_TYPE_DEVICE_MEMORY;
-      objectNameInfo.objectHandle = reinterpret_cast<uint64_t>(mImageMemory);
+      objectNameInfo.objectHandle = reinterpret_cast<uint64_t>(mAllocation.block->memory);
       objectNameInfo.pObjectName = imageName;
 
       VK_WRAPPER(renderer->getSetDebugUtilsObjectNameFunc()(mDevice, &objectNameInfo));
@@ -530,7 +598,8 @@ namespace fr {
     VkImageViewCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     createInfo.image = mImage;
-    createInfo.viewType = mInfo.layers>1?VK_IMAGE_VIEW_TYPE_CUBE:VK_IMAGE_VIEW_TYPE_2D;
+    createInfo.viewType = mInfo.cube ? (mInfo.layers>6 ? VK_IMAGE_VIEW_TYPE_CUBE_ARRAY : VK_IMAGE_VIEW_TYPE_CUBE)
+                                     : (mInfo.layers>1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D);
     createInfo.format = mInfo.format;
     createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
     createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -542,15 +611,388 @@ namespace fr {
     createInfo.subresourceRange.baseArrayLayer = 0;
     createInfo.subresourceRange.layerCount = static_cast<uint32_t>(mInfo.layers);
 
+    VkImageViewUsageCreateInfo usageInfo{};
+    if ((mInfo.usage & VK_IMAGE_USAGE_STORAGE_BIT) && UnormFormat(mInfo.format) != mInfo.format) {
+      usageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO;
+      usageInfo.usage = mInfo.usage & ~VK_IMAGE_USAGE_STORAGE_BIT;
+      createInfo.pNext = &usageInfo;
+    }
+
     VK_WRAPPER(vkCreateImageView(mDevice, &createInfo, nullptr, &mImageView));
   }
 
+  VkMemoryRequirements frImage::getMemoryRequirements() const {
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(mDevice, mImage, &memRequirements);
+    return memRequirements;
+  }
+
+  void frImage::bindMemory(VkDeviceMemory memory, VkDeviceSize offset) {
+    VK_WRAPPER(vkBindImageMemory(mDevice, mImage, memory, offset));
+    createView();
+  }
+
+  frImage::frImageAccess frImage::usageAccess(frImageUsage usage) {
+    switch (usage) {
+    case FR_IMAGE_USAGE_TRANSFER_SRC:
+      return { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT };
+    case FR_IMAGE_USAGE_TRANSFER_DST:
+      return { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT };
+    case FR_IMAGE_USAGE_SAMPLED_FRAGMENT:
+      return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT };
+    case FR_IMAGE_USAGE_SAMPLED_COMPUTE:
+      return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT };
+    case FR_IMAGE_USAGE_STORAGE_READ:
+      return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT };
+    case FR_IMAGE_USAGE_STORAGE_WRITE:
+      return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT };
+    case FR_IMAGE_USAGE_COLOR_ATTACHMENT:
+      return { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+               VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT };
+    case FR_IMAGE_USAGE_DEPTH_ATTACHMENT:
+      return { VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT };
+    case FR_IMAGE_USAGE_DEPTH_READ:
+      return { VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+               VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT };
+    case FR_IMAGE_USAGE_PRESENT:
+      return { VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0 };
+    }
+    return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT };
+  }
+
+  static const VkAccessFlags kImageWriteAccess =
+    VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+  void frImage::require(frImageUsage usage, frSubresourceRange range, bool discard) {
+    require(mBarriers, usageAccess(usage), range, discard);
+  }
+
+  void frImage::require(frImageAccess access, frSubresourceRange range, bool discard) {
+    require(mBarriers, access, range, discard);
+  }
+
+  void frImage::require(frBarrierBatch &batch, frImageUsage usage, frSubresourceRange range, bool discard) {
+    require(batch, usageAccess(usage), range, discard);
+  }
+
+  void frImage::require(frBarrierBatch &batch, frImageAccess access, frSubresourceRange range, bool discard) {
+    VkImageSubresourceRange subresources = resolveRange(range);
+    VkAccessFlags writeAccess = access.access & kImageWriteAccess;
+
+    for (uint32_t layer = subresources.baseArrayLayer; layer < subresources.baseArrayLayer + subresources.layerCount; ++layer) {
+      for (uint32_t mip = subresources.baseMipLevel; mip < subresources.baseMipLevel + subresources.levelCount; ++mip) {
+        frSubresourceState &state = mState[layer * mInfo.mipLevels + mip];
+        bool layoutChange = state.layout != access.layout;
+
+        VkPipelineStageFlags srcStages = 0;
+        VkAccessFlags srcAccess = 0;
+        if (layoutChange || writeAccess) { // Wait for the last write and everyone who read it (WAR only needs execution order)
+          srcStages = state.writeStages | state.readStages;
+          srcAccess = state.writeAccess;
+        } else if (state.writeStages && ((access.stages & ~state.readStages) || (access.access & ~state.readAccess))) {
+          srcStages = state.writeStages; // New reader of the last write
+          srcAccess = state.writeAccess;
+        } else {
+          continue; // Already visible to this kind of read
+        }
+
+        // Neighbouring mips end up in one barrier, see frBarrierBatch::addImage
+        batch.addImage(mImage, VkImageSubresourceRange{ subresources.aspectMask, mip, 1, layer, 1 },
+          discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout, access.layout,
+          srcStages ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, srcAccess, access.stages, access.access);
+
+        state.layout = access.layout;
+        if (writeAccess || layoutChange) { // A layout transition counts as a write
+          state.writeStages = access.stages;
+          state.writeAccess = writeAccess;
+          state.readStages = writeAccess ? 0 : access.stages;
+          state.readAccess = writeAccess ? 0 : access.access;
+        } else {
+          state.readStages |= access.stages;
+          state.readAccess |= access.access;
+        }
+      }
+    }
+  }
+
+  void frImage::flushBarriers(VkCommandBuffer cmdBuf) {
+    mBarriers.flush(cmdBuf);
+  }
+
+  void frImage::transition(VkCommandBuffer cmdBuf, frImageUsage usage, frSubresourceRange range, bool discard) {
+    require(usage, range, discard);
+    flushBarriers(cmdBuf);
+  }
+
+  void frImage::setState(frImageAccess access, frSubresourceRange range) {
+    VkImageSubresourceRange subresources = resolveRange(range);
+
+    for (uint32_t layer = subresources.baseArrayLayer; layer < subresources.baseArrayLayer + subresources.layerCount; ++layer) {
+      for (uint32_t mip = subresources.baseMipLevel; mip < subresources.baseMipLevel + subresources.levelCount; ++mip) {
+        // Whatever made the change synchronized it with `access`, later readers of the same kind need no barrier
+        frSubresourceState &state = mState[layer * mInfo.mipLevels + mip];
+        state.layout = access.layout;
+        state.writeStages = access.stages;
+        state.writeAccess = access.access & kImageWriteAccess;
+        state.readStages = access.stages;
+        state.readAccess = access.access;
+      }
+    }
+  }
+
+  void frImage::initializeState() {
+    mState.assign(static_cast<size_t>(std::max(mInfo.layers, 1)) * mInfo.mipLevels, frSubresourceState{});
+  }
+
+  VkImageSubresourceRange frImage::resolveRange(frSubresourceRange range) const {
+    uint32_t layers = static_cast<uint32_t>(std::max(mInfo.layers, 1));
+
+    VkImageSubresourceRange resolved{};
+    resolved.aspectMask = mInfo.imageAspect;
+    if ((mInfo.imageAspect & VK_IMAGE_ASPECT_DEPTH_BIT) &&
+        (mInfo.format == VK_FORMAT_D32_SFLOAT_S8_UINT || mInfo.format == VK_FORMAT_D24_UNORM_S8_UINT)) {
+      resolved.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT; // Both aspects change layout together
+    }
+    resolved.baseMipLevel = range.baseMip;
+    resolved.levelCount = range.mipCount == VK_REMAINING_MIP_LEVELS ? mInfo.mipLevels - range.baseMip : range.mipCount;
+    resolved.baseArrayLayer = range.baseLayer;
+    resolved.layerCount = range.layerCount == VK_REMAINING_ARRAY_LAYERS ? layers - range.baseLayer : range.layerCount;
+    return resolved;
+  }
+
   bool frImage::hasStencilComponent(VkFormat format) {
     return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
   }  
   // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frImage]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frMipGenerator]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  static const uint32_t kMipLevelsPerDispatch = 6; // 64x64 tile -> 1x1, matches mipgen.comp
+  static const uint32_t kMipTileSize = 64;
+
+  frMipGenerator::frMipGenerator()
+  {}
+
+  frMipGenerator::~frMipGenerator() {
+    cleanup();
+  }
+
+  bool frMipGenerator::initialize(frRenderer *renderer, const char *shaderPath) {
+    frShader shader{};
+    if (!shader.initialize(renderer, shaderPath, VK_SHADER_STAGE_COMPUTE_BIT)) return false;
+
+    mRenderer = renderer;
+    mDevice = renderer->mDevice;
+
+    { // Descriptor set layout: source level + one storage view per written level
+      VkDescriptorSetLayoutBinding bindings[2]{};
+      bindings[0].binding = 0;
+      bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+      bindings[0].descriptorCount = 1;
+      bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+      bindings[1].binding = 1;
+      bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      bindings[1].descriptorCount = kMipLevelsPerDispatch;
+      bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+      VkDescriptorSetLayoutCreateInfo createInfo{};
+      createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+      createInfo.bindingCount = 2;
+      createInfo.pBindings = bindings;
+
+      VK_WRAPPER(vkCreateDescriptorSetLayout(mDevice, &createInfo, nullptr, &mSetLayout));
+    }
+
+    { // Pipeline layout
+      VkPushConstantRange range{ VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(frMipConstants) };
+
+      VkPipelineLayoutCreateInfo createInfo{};
+      createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+      createInfo.setLayoutCount = 1;
+      createInfo.pSetLayouts = &mSetLayout;
+      createInfo.pushConstantRangeCount = 1;
+      createInfo.pPushConstantRanges = &range;
+
+      VK_WRAPPER(vkCreatePipelineLayout(mDevice, &createInfo, nullptr, &mLayout));
+    }
+
+    { // Pipeline
+      VkComputePipelineCreateInfo createInfo{};
+      createInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+      createInfo.stage = shader.mStageInfo;
+      createInfo.layout = mLayout;
+
+      VK_WRAPPER(vkCreateComputePipelines(mDevice, mRenderer->mPipelineCache, 1, &createInfo, nullptr, &mPipeline));
+    }
+
+    return true;
+  }
+
+  void frMipGenerator::cleanup() {
+    if (!mDevice) return;
+    vkDestroyPipeline(mDevice, mPipeline, nullptr);
+    vkDestroyPipelineLayout(mDevice, mLayout, nullptr);
+    vkDestroyDescriptorSetLayout(mDevice, mSetLayout, nullptr);
+    mDevice = VK_NULL_HANDLE;
+  }
+
+  frMipGenerator::frMipResources frMipGenerator::generate(VkCommandBuffer cmdBuf, frImage *image, frMipOptions options) {
+    uint32_t mipLevels = image->getMipLevels();
+    uint32_t layers = image->getLayers();
+    if (mipLevels < 2) return {};
+
+    VkFormat format = UnormFormat(image->getFormat());
+    bool srgb = options.srgb || format != image->getFormat();
+
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(mRenderer->mPhysicalDevice, format, &formatProperties);
+    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)) {
+      throw fr::frVulkanException("Mip generator image format does not support storage images!");
+    }
+
+    // Box reduces up to 6 levels in shared memory per dispatch, Kaiser needs neighbours across tiles
+    uint32_t levelsPerDispatch = options.filter == FR_MIP_FILTER_BOX ? kMipLevelsPerDispatch : 1;
+    uint32_t dispatchCount = (mipLevels - 1 + levelsPerDispatch - 1) / levelsPerDispatch;
+
+    std::vector<VkImageView> views(mipLevels, VK_NULL_HANDLE);
+    for (uint32_t mip = 0; mip < mipLevels; ++mip) views[mip] = createView(image, format, mip);
+
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    { // One set per dispatch, freed with the views once the GPU is done
+      VkDescriptorPoolSize sizes[2] = {
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, dispatchCount },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, dispatchCount * kMipLevelsPerDispatch },
+      };
+
+      VkDescriptorPoolCreateInfo createInfo{};
+      createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+      createInfo.maxSets = dispatchCount;
+      createInfo.poolSizeCount = 2;
+      createInfo.pPoolSizes = sizes;
+
+      VK_WRAPPER(vkCreateDescriptorPool(mDevice, &createInfo, nullptr, &pool));
+    }
+
+    std::vector<VkDescriptorSetLayout> setLayouts(dispatchCount, mSetLayout);
+    std::vector<VkDescriptorSet> sets(dispatchCount);
+    {
+      VkDescriptorSetAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+      allocInfo.descriptorPool = pool;
+      allocInfo.descriptorSetCount = dispatchCount;
+      allocInfo.pSetLayouts = setLayouts.data();
+
+      VK_WRAPPER(vkAllocateDescriptorSets(mDevice, &allocInfo, sets.data()));
+    }
+
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, mPipeline);
+
+    const frImage::frImageAccess sourceAccess{ VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT };
+
+    uint32_t srcMip = 0;
+    for (uint32_t i = 0; i < dispatchCount; ++i) {
+      uint32_t levels = std::min(levelsPerDispatch, mipLevels - 1 - srcMip);
+
+      { // Every array element is statically used, unused ones repeat the last level
+        VkDescriptorImageInfo sourceInfo{ VK_NULL_HANDLE, views[srcMip], VK_IMAGE_LAYOUT_GENERAL };
+        VkDescriptorImageInfo levelInfos[kMipLevelsPerDispatch]{};
+        for (uint32_t l = 0; l < kMipLevelsPerDispatch; ++l) {
+          levelInfos[l] = { VK_NULL_HANDLE, views[srcMip + 1 + std::min(l, levels - 1)], VK_IMAGE_LAYOUT_GENERAL };
+        }
+
+        VkWriteDescriptorSet writes[2]{};
+        writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[0].dstSet = sets[i];
+        writes[0].dstBinding = 0;
+        writes[0].descriptorCount = 1;
+        writes[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        writes[0].pImageInfo = &sourceInfo;
+        writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[1].dstSet = sets[i];
+        writes[1].dstBinding = 1;
+        writes[1].descriptorCount = kMipLevelsPerDispatch;
+        writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        writes[1].pImageInfo = levelInfos;
+
+        vkUpdateDescriptorSets(mDevice, 2, writes, 0, nullptr);
+      }
+
+      // The levels written last time become the source, the ones below are overwritten completely
+      image->require(sourceAccess, frImage::frSubresourceRange{ srcMip, 1 });
+      image->require(FR_IMAGE_USAGE_STORAGE_WRITE, frImage::frSubresourceRange{ srcMip + 1, levels }, true);
+      image->flushBarriers(cmdBuf);
+
+      VkExtent2D extent = image->getExtent();
+      frMipConstants constants{
+        std::max(1, static_cast<int32_t>(extent.width >> srcMip)), std::max(1, static_cast<int32_t>(extent.height >> srcMip)),
+        levels, static_cast<uint32_t>(options.filter), srgb ? 1u : 0u
+      };
+      vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, mLayout, 0, 1, &sets[i], 0, nullptr);
+      vkCmdPushConstants(cmdBuf, mLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+      vkCmdDispatch(cmdBuf,
+        (static_cast<uint32_t>(constants.srcWidth) + kMipTileSize - 1) / kMipTileSize,
+        (static_cast<uint32_t>(constants.srcHeight) + kMipTileSize - 1) / kMipTileSize,
+        layers);
+
+      srcMip += levels;
+    }
+
+    image->transition(cmdBuf, options.finalUsage);
+
+    return { pool, std::move(views) };
+  }
+
+  void frMipGenerator::release(frMipResources resources, frSynchronization *sync) {
+    // sync->value() is only the submit of cmdBuf once it has been attached, hence after the submit
+    VkDevice device = mDevice;
+    mRenderer->deferDeletion([device, resources]() {
+      vkDestroyDescriptorPool(device, resources.pool, nullptr);
+      for (auto view : resources.views) vkDestroyImageView(device, view, nullptr);
+    }, sync);
+  }
+
+  VkImageView frMipGenerator::createView(frImage *image, VkFormat format, uint32_t mip) {
+    VkImageViewCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    createInfo.image = image->get();
+    createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    createInfo.format = format;
+    createInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 1, 0, image->getLayers() };
+
+    VkImageView view = VK_NULL_HANDLE;
+    VK_WRAPPER(vkCreateImageView(mDevice, &createInfo, nullptr, &view));
+    return view;
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frMipGenerator]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
   // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frRenderPass]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  static uint64_t Fnv1a(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+      hash ^= data[i];
+      hash *= 0x100000001b3ull;
+    }
+    return hash;
+  }
+
+  // Raw bytes of trivially copyable values, only for structs without padding or pointers
+  template <typename T>
+  static void AppendKey(std::string &key, const T &value) {
+    key.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template <typename T>
+  static void AppendKey(std::string &key, const T *values, uint32_t count) {
+    AppendKey(key, count);
+    if (values) key.append(reinterpret_cast<const char*>(values), sizeof(T) * count);
+  }
+
+  static bool FormatHasStencil(VkFormat format) {
+    return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT ||
+           format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_S8_UINT;
+  }
+
   frRenderPass::frRenderPass() 
   {}
 
@@ -574,6 +1016,49 @@ namespace fr {
       VK_WRAPPER(vkCreateRenderPass(renderer->mDevice, &createInfo, nullptr, &mRenderPass));
     }
 
+    { // Compatibility: attachment formats and sample counts as referenced by each subpass, layouts and ops don't matter
+      auto appendReference = [&](const VkAttachmentReference *ref) {
+        bool used = ref && ref->attachment != VK_ATTACHMENT_UNUSED;
+        AppendKey(mCompatibilityKey, used ? mAttachments[ref->attachment].format : VK_FORMAT_UNDEFINED);
+        AppendKey(mCompatibilityKey, used ? mAttachments[ref->attachment].samples : VkSampleCountFlagBits(0));
+      };
+
+      mCompatibilityKey.clear();
+      AppendKey(mCompatibilityKey, static_cast<uint32_t>(mSubpasses.size()));
+      for (auto &subpass : mSubpasses) {
+        AppendKey(mCompatibilityKey, subpass.pipelineBindPoint);
+        AppendKey(mCompatibilityKey, subpass.inputAttachmentCount);
+        for (uint32_t i = 0; i < subpass.inputAttachmentCount; ++i) appendReference(&subpass.pInputAttachments[i]);
+        AppendKey(mCompatibilityKey, subpass.colorAttachmentCount);
+        for (uint32_t i = 0; i < subpass.colorAttachmentCount; ++i) {
+          appendReference(&subpass.pColorAttachments[i]);
+          appendReference(subpass.pResolveAttachments ? &subpass.pResolveAttachments[i] : nullptr);
+        }
+        appendReference(subpass.pDepthStencilAttachment);
+      }
+    }
+
+    if (renderer->mShaderObject) { // Shader objects only draw inside vkCmdBeginRendering
+      if (mSubpasses.size() != 1 || mSubpasses[0].inputAttachmentCount > 0)
+        throw fr::frVulkanException("Render passes used with shader objects need a single subpass without input attachments!");
+
+      const VkSubpassDescription &subpass = mSubpasses[0];
+      const VkAttachmentReference unused{ VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+      mColorRefs.assign(subpass.pColorAttachments, subpass.pColorAttachments + subpass.colorAttachmentCount);
+      if (subpass.pResolveAttachments) mResolveRefs.assign(subpass.pResolveAttachments, subpass.pResolveAttachments + subpass.colorAttachmentCount);
+      else                             mResolveRefs.assign(subpass.colorAttachmentCount, unused);
+      mDepthRef = subpass.pDepthStencilAttachment ? *subpass.pDepthStencilAttachment : unused;
+
+      mSubpassLayouts.assign(mAttachments.size(), VK_IMAGE_LAYOUT_UNDEFINED);
+      for (auto &ref : mColorRefs)   if (ref.attachment != VK_ATTACHMENT_UNUSED) mSubpassLayouts[ref.attachment] = ref.layout;
+      for (auto &ref : mResolveRefs) if (ref.attachment != VK_ATTACHMENT_UNUSED) mSubpassLayouts[ref.attachment] = ref.layout;
+      if (mDepthRef.attachment != VK_ATTACHMENT_UNUSED) mSubpassLayouts[mDepthRef.attachment] = mDepthRef.layout;
+
+      mCmdBeginRendering = renderer->mCmdBeginRendering;
+      mCmdEndRendering = renderer->mCmdEndRendering;
+      mDynamicRendering = true;
+    }
+
     mDevice = renderer->mDevice;
   }
 
@@ -581,7 +1066,60 @@ namespace fr {
     vkDestroyRenderPass(mDevice, mRenderPass, nullptr);
   }
 
-  void frRenderPass::begin(VkCommandBuffer cmdBuf, VkExtent2D extent, frFramebuffer *fb, std::vector<VkClearValue> clearValues) {
+  void frRenderPass::begin(VkCommandBuffer cmdBuf, VkExtent2D extent, frFramebuffer *fb, std::vector<VkClearValue> clearValues, VkSubpassContents contents) {
+    if (mDynamicRendering) {
+      transitionAttachments(cmdBuf, fb, true);
+
+      auto attachmentInfo = [&](uint32_t attachment, VkImageLayout layout, bool stencil) {
+        VkRenderingAttachmentInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+        info.imageView = fb->mImages[attachment]->getView();
+        info.imageLayout = layout;
+        info.loadOp = stencil ? mAttachments[attachment].stencilLoadOp : mAttachments[attachment].loadOp;
+        info.storeOp = stencil ? mAttachments[attachment].stencilStoreOp : mAttachments[attachment].storeOp;
+        if (attachment < clearValues.size()) info.clearValue = clearValues[attachment];
+        return info;
+      };
+
+      std::vector<VkRenderingAttachmentInfo> colorAttachments(mColorRefs.size());
+      for (size_t i = 0; i < mColorRefs.size(); ++i) {
+        colorAttachments[i].sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+        if (mColorRefs[i].attachment == VK_ATTACHMENT_UNUSED) continue;
+
+        colorAttachments[i] = attachmentInfo(mColorRefs[i].attachment, mColorRefs[i].layout, false);
+        if (mResolveRefs[i].attachment != VK_ATTACHMENT_UNUSED) {
+          colorAttachments[i].resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+          colorAttachments[i].resolveImageView = fb->mImages[mResolveRefs[i].attachment]->getView();
+          colorAttachments[i].resolveImageLayout = mResolveRefs[i].layout;
+        }
+      }
+
+      VkRenderingAttachmentInfo depthAttachment{}, stencilAttachment{};
+      VkRenderingInfo renderingInfo{};
+      renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+      renderingInfo.flags = contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+      renderingInfo.renderArea.offset = {0, 0};
+      renderingInfo.renderArea.extent = extent;
+      renderingInfo.layerCount = fb->mLayers;
+      renderingInfo.colorAttachmentCount = static_cast<uint32_t>(colorAttachments.size());
+      renderingInfo.pColorAttachments = colorAttachments.data();
+      if (mDepthRef.attachment != VK_ATTACHMENT_UNUSED) {
+        VkFormat format = mAttachments[mDepthRef.attachment].format;
+        if (format != VK_FORMAT_S8_UINT) {
+          depthAttachment = attachmentInfo(mDepthRef.attachment, mDepthRef.layout, false);
+          renderingInfo.pDepthAttachment = &depthAttachment;
+        }
+        if (FormatHasStencil(format)) {
+          stencilAttachment = attachmentInfo(mDepthRef.attachment, mDepthRef.layout, true);
+          renderingInfo.pStencilAttachment = &stencilAttachment;
+        }
+      }
+
+      mCmdBeginRendering(cmdBuf, &renderingInfo);
+      mActiveFramebuffer = fb;
+      return;
+    }
+
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = mRenderPass;
@@ -591,13 +1129,74 @@ namespace fr {
     renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     renderPassInfo.pClearValues = clearValues.data();
 
-    vkCmdBeginRenderPass(cmdBuf, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(cmdBuf, &renderPassInfo, contents);
   }
 
   void frRenderPass::end(VkCommandBuffer cmdBuf) {
+    if (mDynamicRendering) {
+      mCmdEndRendering(cmdBuf);
+      transitionAttachments(cmdBuf, mActiveFramebuffer, false);
+      mActiveFramebuffer = nullptr;
+      return;
+    }
+
     vkCmdEndRenderPass(cmdBuf);
   }
 
+  // What the render pass would do on its own at begin or end: the external dependencies, the implicit ones
+  // when there are none, and the initialLayout -> subpass -> finalLayout transitions of every attachment.
+  void frRenderPass::transitionAttachments(VkCommandBuffer cmdBuf, frFramebuffer *fb, bool begin) {
+    VkPipelineStageFlags srcStage = 0, dstStage = 0;
+    VkAccessFlags srcAccess = 0, dstAccess = 0;
+    for (auto &dependency : mDependencies) {
+      if (begin ? dependency.srcSubpass != VK_SUBPASS_EXTERNAL : dependency.dstSubpass != VK_SUBPASS_EXTERNAL) continue;
+      srcStage  |= dependency.srcStageMask;
+      dstStage  |= dependency.dstStageMask;
+      srcAccess |= dependency.srcAccessMask;
+      dstAccess |= dependency.dstAccessMask;
+    }
+
+    bool external = srcStage != 0;
+    if (!external && begin) {
+      srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+      dstStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+      dstAccess = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    } else if (!external) {
+      srcStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+      dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+      srcAccess = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    }
+
+    std::vector<VkImageMemoryBarrier> barriers{};
+    for (uint32_t i = 0; i < mAttachments.size(); ++i) {
+      if (mSubpassLayouts[i] == VK_IMAGE_LAYOUT_UNDEFINED) continue; // Not used by the subpass
+
+      VkImageLayout oldLayout = begin ? mAttachments[i].initialLayout : mSubpassLayouts[i];
+      VkImageLayout newLayout = begin ? mSubpassLayouts[i] : mAttachments[i].finalLayout;
+      if (oldLayout == newLayout && !external) continue;
+
+      frImage *image = fb->mImages[i];
+      VkImageAspectFlags aspect = image->getAspect();
+      if (FormatHasStencil(image->getFormat())) aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+
+      VkImageMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcAccessMask = srcAccess;
+      barrier.dstAccessMask = dstAccess;
+      barrier.oldLayout = oldLayout;
+      barrier.newLayout = newLayout;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = image->get();
+      barrier.subresourceRange = { aspect, 0, 1, 0, fb->mLayers };
+      barriers.push_back(barrier);
+    }
+
+    if (barriers.empty()) return;
+    vkCmdPipelineBarrier(cmdBuf, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+  }
+
   void frRenderPass::setName(frRenderer *renderer, const char *name) {
     VkDebugUtilsObjectNameInfoEXT objectNameInfo = {};
     objectNameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
@@ -636,6 +1235,8 @@ namespace fr {
       VK_WRAPPER(vkCreateFramebuffer(renderer->mDevice, &createInfo, nullptr, &mFramebuffer));
     }
 
+    mImages = images;
+    mLayers = static_cast<uint32_t>(layers);
     mDevice = renderer->mDevice;
   }
 
@@ -692,6 +1293,8 @@ namespace fr {
     };
 
     VK_WRAPPER(vkCreateShaderModule(renderer->mDevice, &createInfo, nullptr, &mModule));
+    mCodeHash = Fnv1a(reinterpret_cast<const uint8_t*>(code.data()), code.size());
+    if (renderer->mShaderObject) mCode = std::move(code);
 
     mStageInfo = {
       VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, VK_NULL_HANDLE, 0,
@@ -703,7 +1306,9 @@ namespace fr {
   }
 
   void frShader::cleanup() {
+    if (!mModule) return;
     vkDestroyShaderModule(mDevice, mModule, nullptr);
+    mModule = VK_NULL_HANDLE;
   }
   // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frShader]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
@@ -807,9 +1412,17 @@ namespace fr {
   }
 
   void frPipeline::initialize(frRenderer *renderer, frRenderPass *renderPass) {
-    std::vector<VkPipelineShaderStageCreateInfo> stages{};
-    for (auto shader : mShaders) stages.push_back(shader);
+    if (renderer->mShaderObject) {
+      initializeShaderObjects(renderer, renderPass);
+      return;
+    }
+
+    VkGraphicsPipelineCreateInfo createInfo = prepare(renderer, renderPass);
+    VK_WRAPPER(vkCreateGraphicsPipelines(renderer->mDevice, renderer->mPipelineCache, 1, &createInfo, nullptr, &mPipeline));
+    releaseState();
+  }
 
+  VkGraphicsPipelineCreateInfo frPipeline::prepare(frRenderer *renderer, frRenderPass *renderPass) {
     { // Create PipelineLayout
       VkPipelineLayoutCreateInfo createInfo = {
         VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO, VK_NULL_HANDLE, 0,
@@ -820,84 +1433,865 @@ namespace fr {
       VK_WRAPPER(vkCreatePipelineLayout(renderer->mDevice, &createInfo, nullptr, &mLayout));
     }
 
-    { // Create da Pipeline
-      VkGraphicsPipelineCreateInfo createInfo = {
-        VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO, VK_NULL_HANDLE, 0,
-        static_cast<uint32_t>(stages.size()), stages.data(),
-        mVertexInputState, mInputAssemblyState, mTessellationState, mViewportState, mRasterizationState, 
-        mMultisampleInfo, mDepthStencilState, mColorBlendState, mDynamicState, 
-        mLayout, renderPass->mRenderPass, 0,
-        VK_NULL_HANDLE, 0,
-      };
+    mDevice = renderer->mDevice;
 
-      VK_WRAPPER(vkCreateGraphicsPipelines(renderer->mDevice, VK_NULL_HANDLE, 1, &createInfo, nullptr, &mPipeline));
-    }
+    // setDynamicState() and addDynamicState() merged
+    mResolvedDynamicStates = dynamicStates();
+    mResolvedDynamicState = {
+      VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO, VK_NULL_HANDLE, 0,
+      static_cast<uint32_t>(mResolvedDynamicStates.size()), mResolvedDynamicStates.data()
+    };
 
-    if (mVertexInputState) delete mVertexInputState;
-    if (mInputAssemblyState) delete mInputAssemblyState;
-    if (mTessellationState) delete mTessellationState;
-    if (mViewportState) delete mViewportState;
-    if (mRasterizationState) delete mRasterizationState;
-    if (mMultisampleInfo) delete mMultisampleInfo;
-    if (mDepthStencilState) delete mDepthStencilState;
-    if (mColorBlendState) delete mColorBlendState;
-    if (mDynamicState) delete mDynamicState;
+    return VkGraphicsPipelineCreateInfo{
+      VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO, VK_NULL_HANDLE, 0,
+      static_cast<uint32_t>(mShaders.size()), mShaders.data(),
+      mVertexInputState, mInputAssemblyState, mTessellationState, mViewportState, mRasterizationState, 
+      mMultisampleInfo, mDepthStencilState, mColorBlendState, mResolvedDynamicStates.empty() ? nullptr : &mResolvedDynamicState, 
+      mLayout, renderPass->mRenderPass, 0,
+      VK_NULL_HANDLE, 0,
+    };
+  }
 
-    mDevice = renderer->mDevice;
+  void frPipeline::releaseState() {
+    delete mVertexInputState;
+    delete mInputAssemblyState;
+    delete mTessellationState;
+    delete mViewportState;
+    delete mRasterizationState;
+    delete mMultisampleInfo;
+    delete mDepthStencilState;
+    delete mColorBlendState;
+    delete mDynamicState;
+
+    mVertexInputState = nullptr;
+    mInputAssemblyState = nullptr;
+    mTessellationState = nullptr;
+    mViewportState = nullptr;
+    mRasterizationState = nullptr;
+    mMultisampleInfo = nullptr;
+    mDepthStencilState = nullptr;
+    mColorBlendState = nullptr;
+    mDynamicState = nullptr;
   }
 
   void frPipeline::cleanup() {
+    releaseState(); // Never initialized, or dropped by frPipelineRegistry
+    if (!mDevice) return;
+
+    for (auto object : mObjects) mRenderer->mDestroyShader(mDevice, object, nullptr);
+    mObjects.clear();
+    mObjectStages.clear();
+
     vkDestroyPipeline(mDevice, mPipeline, nullptr);
     vkDestroyPipelineLayout(mDevice, mLayout, nullptr);
+    mPipeline = VK_NULL_HANDLE;
+    mLayout = VK_NULL_HANDLE;
+    mDevice = VK_NULL_HANDLE;
   }
 
-  void frPipeline::bind(VkCommandBuffer cmdBuf, VkPipelineBindPoint bindPoint) {
-    vkCmdBindPipeline(cmdBuf, bindPoint, mPipeline);
+  std::string frPipeline::layoutKey() const {
+    std::string key{};
+    AppendKey(key, mDescLayouts.data(), static_cast<uint32_t>(mDescLayouts.size()));
+    AppendKey(key, mPCRanges.data(), static_cast<uint32_t>(mPCRanges.size()));
+    return key;
   }
 
-  void frPipeline::bindDescriptor(VkCommandBuffer cmdBuf, VkPipelineBindPoint bindPoint, uint32_t firstSet, frDescriptor *descriptor) {
-    VkDescriptorSet set = descriptor->mSet;
-    vkCmdBindDescriptorSets(cmdBuf, bindPoint, mLayout, firstSet, 1, &set, 0, VK_NULL_HANDLE);
+  std::vector<VkDynamicState> frPipeline::dynamicStates() const {
+    std::vector<VkDynamicState> states(mAddedDynamicStates);
+    if (mDynamicState) states.insert(states.end(), mDynamicState->pDynamicStates, mDynamicState->pDynamicStates + mDynamicState->dynamicStateCount);
+    std::sort(states.begin(), states.end());
+    states.erase(std::unique(states.begin(), states.end()), states.end());
+    return states;
   }
 
-  void frPipeline::pushConstant(VkCommandBuffer cmdBuf, VkShaderStageFlags stage, uint32_t offset, uint32_t size, const void *value) {
-    vkCmdPushConstants(cmdBuf, mLayout, stage, offset, size, value);
+  bool frPipeline::isDynamic(VkDynamicState state) const {
+    std::vector<VkDynamicState> states = dynamicStates();
+    return std::binary_search(states.begin(), states.end(), state) ||
+           std::find(mResolvedDynamicStates.begin(), mResolvedDynamicStates.end(), state) != mResolvedDynamicStates.end();
   }
 
-  void frPipeline::setName(frRenderer *renderer, const char *name) {
-    { // Set name for mLayout
-      VkDebugUtilsObjectNameInfoEXT objectNameInfo = {};
-      objectNameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
-      objectNameInfo.pNext = nullptr;
-      objectNameInfo.objectType = VK_OBJECT_TYPE_PIPELINE_LAYOUT;
-      objectNameInfo.objectHandle = reinterpret_cast<uint64_t>(mLayout);
-      objectNameInfo.pObjectName = name;
+  bool frPipeline::addDynamicState(frRenderer *renderer, VkDynamicState state) {
+    if (!renderer->supportsDynamicState(state)) return false;
+    mAddedDynamicStates.push_back(state);
+    return true;
+  }
 
-      VK_WRAPPER(renderer->getSetDebugUtilsObjectNameFunc()(mDevice, &objectNameInfo));
-    }
+  std::string frPipeline::partKey(frPipelinePart part, frRenderPass *renderPass) const {
+    std::string key{};
+    key.reserve(256);
 
-    { // Set name for mPipeline
-      VkDebugUtilsObjectNameInfoEXT objectNameInfo = {};
-      objectNameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
-      objectNameInfo.pNext = nullptr;
-      objectNameInfo.objectType = VK_OBJECT_TYPE_PIPELINE;
-      objectNameInfo.objectHandle = reinterpret_cast<uint64_t>(mPipeline);
-      objectNameInfo.pObjectName = name;
+    // Fields covered by a dynamic state are left out, pipelines differing only in those are the same pipeline
+    std::vector<VkDynamicState> dynamic = dynamicStates();
+    auto isDynamic = [&](VkDynamicState state) { return std::binary_search(dynamic.begin(), dynamic.end(), state); };
+    auto appendBaked = [&](VkDynamicState state, const auto &value) { if (!isDynamic(state)) AppendKey(key, value); };
 
-      VK_WRAPPER(renderer->getSetDebugUtilsObjectNameFunc()(mDevice, &objectNameInfo));
-    }
-  }
-  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frPipeline]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+    auto appendShaders = [&](bool fragment) {
+      uint32_t count = 0;
+      for (auto &stage : mShaders) count += (stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT) == fragment;
+      AppendKey(key, count);
 
-  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frCommands]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
-  frCommands::frCommands()
-  {}
+      for (size_t i = 0; i < mShaders.size(); ++i) {
+        const VkPipelineShaderStageCreateInfo &stage = mShaders[i];
+        if ((stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT) != fragment) continue;
 
-  frCommands::~frCommands() {
-    cleanup();
-  }
+        AppendKey(key, stage.stage);
+        AppendKey(key, mShaderHashes[i]);
+        key.append(stage.pName);
+        key.push_back('\0');
 
-  void frCommands::initialize(frRenderer *renderer) {
+        const VkSpecializationInfo *spec = stage.pSpecializationInfo;
+        AppendKey(key, spec ? spec->pMapEntries : nullptr, spec ? spec->mapEntryCount : 0);
+        AppendKey(key, spec ? static_cast<const uint8_t*>(spec->pData) : nullptr, spec ? static_cast<uint32_t>(spec->dataSize) : 0);
+      }
+    };
+
+    // A presence byte in front of every optional state keeps "absent" distinct from "all zero"
+    auto appendMultisample = [&]() {
+      AppendKey(key, mMultisampleInfo != nullptr);
+      if (!mMultisampleInfo) return;
+      AppendKey(key, mMultisampleInfo->rasterizationSamples);
+      AppendKey(key, mMultisampleInfo->sampleShadingEnable);
+      AppendKey(key, mMultisampleInfo->minSampleShading);
+      AppendKey(key, mMultisampleInfo->pSampleMask, mMultisampleInfo->pSampleMask ? (mMultisampleInfo->rasterizationSamples + 31) / 32 : 0);
+      AppendKey(key, mMultisampleInfo->alphaToCoverageEnable);
+      AppendKey(key, mMultisampleInfo->alphaToOneEnable);
+    };
+
+    auto appendStencil = [&](const VkStencilOpState &stencil) {
+      if (!isDynamic(VK_DYNAMIC_STATE_STENCIL_OP)) {
+        AppendKey(key, stencil.failOp);
+        AppendKey(key, stencil.passOp);
+        AppendKey(key, stencil.depthFailOp);
+        AppendKey(key, stencil.compareOp);
+      }
+      appendBaked(VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK, stencil.compareMask);
+      appendBaked(VK_DYNAMIC_STATE_STENCIL_WRITE_MASK, stencil.writeMask);
+      appendBaked(VK_DYNAMIC_STATE_STENCIL_REFERENCE, stencil.reference);
+    };
+
+    AppendKey(key, part);
+    AppendKey(key, dynamic.data(), static_cast<uint32_t>(dynamic.size()));
+
+    switch (part) {
+    case FR_PIPELINE_PART_VERTEX_INPUT: {
+      AppendKey(key, mVertexInputState != nullptr);
+      if (mVertexInputState) {
+        AppendKey(key, mVertexInputState->pVertexBindingDescriptions, mVertexInputState->vertexBindingDescriptionCount);
+        AppendKey(key, mVertexInputState->pVertexAttributeDescriptions, mVertexInputState->vertexAttributeDescriptionCount);
+      }
+
+      AppendKey(key, mInputAssemblyState != nullptr);
+      if (mInputAssemblyState) {
+        VkPrimitiveTopology topology = mInputAssemblyState->topology;
+        if (isDynamic(VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY)) { // Only the topology class is baked in
+          switch (topology) {
+          case VK_PRIMITIVE_TOPOLOGY_POINT_LIST: break;
+          case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+          case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+          case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+          case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY: topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST; break;
+          case VK_PRIMITIVE_TOPOLOGY_PATCH_LIST: break;
+          default: topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; break;
+          }
+        }
+        AppendKey(key, topology);
+        appendBaked(VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE, mInputAssemblyState->primitiveRestartEnable);
+      }
+      return key; // No render pass or layout in this part
+    }
+    case FR_PIPELINE_PART_PRE_RASTERIZATION: {
+      appendShaders(false);
+      key.append(layoutKey());
+
+      AppendKey(key, mTessellationState != nullptr);
+      if (mTessellationState) appendBaked(VK_DYNAMIC_STATE_PATCH_CONTROL_POINTS_EXT, mTessellationState->patchControlPoints);
+
+      AppendKey(key, mViewportState != nullptr);
+      if (mViewportState) {
+        if (!isDynamic(VK_DYNAMIC_STATE_VIEWPORT_WITH_COUNT)) {
+          bool values = !isDynamic(VK_DYNAMIC_STATE_VIEWPORT);
+          AppendKey(key, values ? mViewportState->pViewports : nullptr, mViewportState->viewportCount);
+        }
+        if (!isDynamic(VK_DYNAMIC_STATE_SCISSOR_WITH_COUNT)) {
+          bool values = !isDynamic(VK_DYNAMIC_STATE_SCISSOR);
+          AppendKey(key, values ? mViewportState->pScissors : nullptr, mViewportState->scissorCount);
+        }
+      }
+
+      AppendKey(key, mRasterizationState != nullptr);
+      if (mRasterizationState) {
+        appendBaked(VK_DYNAMIC_STATE_DEPTH_CLAMP_ENABLE_EXT, mRasterizationState->depthClampEnable);
+        appendBaked(VK_DYNAMIC_STATE_RASTERIZER_DISCARD_ENABLE, mRasterizationState->rasterizerDiscardEnable);
+        appendBaked(VK_DYNAMIC_STATE_POLYGON_MODE_EXT, mRasterizationState->polygonMode);
+        appendBaked(VK_DYNAMIC_STATE_CULL_MODE, mRasterizationState->cullMode);
+        appendBaked(VK_DYNAMIC_STATE_FRONT_FACE, mRasterizationState->frontFace);
+        appendBaked(VK_DYNAMIC_STATE_DEPTH_BIAS_ENABLE, mRasterizationState->depthBiasEnable);
+        appendBaked(VK_DYNAMIC_STATE_DEPTH_BIAS, mRasterizationState->depthBiasConstantFactor);
+        appendBaked(VK_DYNAMIC_STATE_DEPTH_BIAS, mRasterizationState->depthBiasClamp);
+        appendBaked(VK_DYNAMIC_STATE_DEPTH_BIAS, mRasterizationState->depthBiasSlopeFactor);
+        appendBaked(VK_DYNAMIC_STATE_LINE_WIDTH, mRasterizationState->lineWidth);
+      }
+    } break;
+    case FR_PIPELINE_PART_FRAGMENT_SHADER: {
+      appendShaders(true);
+      key.append(layoutKey());
+      appendMultisample();
+
+      AppendKey(key, mDepthStencilState != nullptr);
+      if (mDepthStencilState) {
+        appendBaked(VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE, mDepthStencilState->depthTestEnable);
+        appendBaked(VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE, mDepthStencilState->depthWriteEnable);
+        appendBaked(VK_DYNAMIC_STATE_DEPTH_COMPARE_OP, mDepthStencilState->depthCompareOp);
+        appendBaked(VK_DYNAMIC_STATE_DEPTH_BOUNDS_TEST_ENABLE, mDepthStencilState->depthBoundsTestEnable);
+        appendBaked(VK_DYNAMIC_STATE_STENCIL_TEST_ENABLE, mDepthStencilState->stencilTestEnable);
+        appendStencil(mDepthStencilState->front);
+        appendStencil(mDepthStencilState->back);
+        appendBaked(VK_DYNAMIC_STATE_DEPTH_BOUNDS, mDepthStencilState->minDepthBounds);
+        appendBaked(VK_DYNAMIC_STATE_DEPTH_BOUNDS, mDepthStencilState->maxDepthBounds);
+      }
+    } break;
+    case FR_PIPELINE_PART_FRAGMENT_OUTPUT: {
+      appendMultisample();
+
+      AppendKey(key, mColorBlendState != nullptr);
+      if (mColorBlendState) {
+        AppendKey(key, mColorBlendState->logicOpEnable);
+        appendBaked(VK_DYNAMIC_STATE_LOGIC_OP_EXT, mColorBlendState->logicOp);
+        AppendKey(key, mColorBlendState->attachmentCount);
+        for (uint32_t i = 0; mColorBlendState->pAttachments && i < mColorBlendState->attachmentCount; ++i) {
+          const VkPipelineColorBlendAttachmentState &attachment = mColorBlendState->pAttachments[i];
+          appendBaked(VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT, attachment.blendEnable);
+          if (!isDynamic(VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT)) {
+            AppendKey(key, attachment.srcColorBlendFactor);
+            AppendKey(key, attachment.dstColorBlendFactor);
+            AppendKey(key, attachment.colorBlendOp);
+            AppendKey(key, attachment.srcAlphaBlendFactor);
+            AppendKey(key, attachment.dstAlphaBlendFactor);
+            AppendKey(key, attachment.alphaBlendOp);
+          }
+          appendBaked(VK_DYNAMIC_STATE_COLOR_WRITE_MASK_EXT, attachment.colorWriteMask);
+        }
+        appendBaked(VK_DYNAMIC_STATE_BLEND_CONSTANTS, mColorBlendState->blendConstants);
+      }
+    } break;
+    default: break;
+    }
+
+    key.append(renderPass->mCompatibilityKey);
+    return key;
+  }
+
+  std::string frPipeline::stateKey(frRenderPass *renderPass) const {
+    std::string key{};
+    for (uint32_t part = 0; part < FR_PIPELINE_PART_COUNT; ++part) {
+      key.append(partKey(static_cast<frPipelinePart>(part), renderPass));
+    }
+    return key;
+  }
+
+  void frPipeline::bind(VkCommandBuffer cmdBuf, VkPipelineBindPoint bindPoint) {
+    if (!mObjects.empty()) bindShaderObjects(cmdBuf);
+    else vkCmdBindPipeline(cmdBuf, bindPoint, mPipeline);
+  }
+
+  bool frPipeline::hasDynamicState(VkDynamicState state) const {
+    return std::binary_search(mResolvedDynamicStates.begin(), mResolvedDynamicStates.end(), state);
+  }
+
+  void frPipeline::initializeShaderObjects(frRenderer *renderer, frRenderPass *renderPass) {
+    VkGraphicsPipelineCreateInfo full = prepare(renderer, renderPass);
+    mRenderer = renderer;
+
+    { // One linked VkShaderEXT per stage, in pipeline order so each knows the stage after it
+      std::vector<size_t> order(mShaders.size());
+      for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return mShaders[a].stage < mShaders[b].stage; });
+
+      std::vector<VkShaderCreateInfoEXT> createInfos(order.size());
+      for (size_t i = 0; i < order.size(); ++i) {
+        const VkPipelineShaderStageCreateInfo &stage = mShaders[order[i]];
+        const std::vector<char> &code = mShaderSources[order[i]]->mCode;
+
+        VkShaderCreateInfoEXT &createInfo = createInfos[i];
+        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT;
+        createInfo.flags = order.size() > 1 ? VK_SHADER_CREATE_LINK_STAGE_BIT_EXT : 0;
+        createInfo.stage = stage.stage;
+        createInfo.nextStage = i + 1 < order.size() ? mShaders[order[i + 1]].stage : 0;
+        createInfo.codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT;
+        createInfo.codeSize = code.size();
+        createInfo.pCode = code.data();
+        createInfo.pName = stage.pName;
+        createInfo.setLayoutCount = static_cast<uint32_t>(mDescLayouts.size());
+        createInfo.pSetLayouts = mDescLayouts.data();
+        createInfo.pushConstantRangeCount = static_cast<uint32_t>(mPCRanges.size());
+        createInfo.pPushConstantRanges = mPCRanges.data();
+        createInfo.pSpecializationInfo = stage.pSpecializationInfo;
+
+        mObjectStages.push_back(stage.stage);
+      }
+
+      mObjects.resize(createInfos.size());
+      VK_WRAPPER(renderer->mCreateShaders(mDevice, static_cast<uint32_t>(createInfos.size()), createInfos.data(), nullptr, mObjects.data()));
+    }
+
+    { // Everything a pipeline would have baked in, defaults where the state was never set
+      frShaderObjectState &state = mObjectState;
+
+      if (full.pVertexInputState) {
+        const VkPipelineVertexInputStateCreateInfo &input = *full.pVertexInputState;
+        for (uint32_t i = 0; i < input.vertexBindingDescriptionCount; ++i) {
+          const VkVertexInputBindingDescription &binding = input.pVertexBindingDescriptions[i];
+          state.bindings.push_back({
+            VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT, VK_NULL_HANDLE,
+            binding.binding, binding.stride, binding.inputRate, 1
+          });
+        }
+        for (uint32_t i = 0; i < input.vertexAttributeDescriptionCount; ++i) {
+          const VkVertexInputAttributeDescription &attribute = input.pVertexAttributeDescriptions[i];
+          state.attributes.push_back({
+            VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT, VK_NULL_HANDLE,
+            attribute.location, attribute.binding, attribute.format, attribute.offset
+          });
+        }
+      }
+
+      state.inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+      if (full.pInputAssemblyState) state.inputAssembly = *full.pInputAssemblyState;
+      if (full.pTessellationState) state.patchControlPoints = full.pTessellationState->patchControlPoints;
+
+      // Set by bind() only when neither count nor values are dynamic, the caller's frCommands::setViewports stays otherwise
+      uint32_t viewportCount = full.pViewportState ? full.pViewportState->viewportCount : 1;
+      uint32_t scissorCount = full.pViewportState ? full.pViewportState->scissorCount : 1;
+      state.viewports.assign(viewportCount, VkViewport{ 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f });
+      state.scissors.assign(scissorCount, VkRect2D{ { 0, 0 }, { 1, 1 } });
+      if (full.pViewportState && full.pViewportState->pViewports) {
+        state.viewports.assign(full.pViewportState->pViewports, full.pViewportState->pViewports + viewportCount);
+      }
+      if (full.pViewportState && full.pViewportState->pScissors) {
+        state.scissors.assign(full.pViewportState->pScissors, full.pViewportState->pScissors + scissorCount);
+      }
+
+      state.rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+      state.rasterization.lineWidth = 1.0f;
+      if (full.pRasterizationState) state.rasterization = *full.pRasterizationState;
+
+      state.multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+      if (full.pMultisampleState) state.multisample = *full.pMultisampleState;
+      state.sampleMask.assign((state.multisample.rasterizationSamples + 31) / 32, ~0u);
+      if (state.multisample.pSampleMask) {
+        state.sampleMask.assign(state.multisample.pSampleMask, state.multisample.pSampleMask + state.sampleMask.size());
+      }
+
+      state.depthStencil.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+      state.depthStencil.maxDepthBounds = 1.0f;
+      if (full.pDepthStencilState) state.depthStencil = *full.pDepthStencilState;
+
+      if (full.pColorBlendState) {
+        const VkPipelineColorBlendStateCreateInfo &blend = *full.pColorBlendState;
+        state.logicOpEnable = blend.logicOpEnable;
+        state.logicOp = blend.logicOp;
+        memcpy(state.blendConstants, blend.blendConstants, sizeof(state.blendConstants));
+        for (uint32_t i = 0; i < blend.attachmentCount; ++i) {
+          const VkPipelineColorBlendAttachmentState &attachment = blend.pAttachments[i];
+          state.blendEnables.push_back(attachment.blendEnable);
+          state.blendEquations.push_back({
+            attachment.srcColorBlendFactor, attachment.dstColorBlendFactor, attachment.colorBlendOp,
+            attachment.srcAlphaBlendFactor, attachment.dstAlphaBlendFactor, attachment.alphaBlendOp
+          });
+          state.writeMasks.push_back(attachment.colorWriteMask);
+        }
+      }
+      // Every color attachment of the pass needs blend state under shader objects, a pipeline without
+      // any leaves them at blending off and writing RGBA
+      while (state.writeMasks.size() < renderPass->mColorRefs.size()) {
+        state.blendEnables.push_back(VK_FALSE);
+        state.blendEquations.push_back({
+          VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO, VK_BLEND_OP_ADD
+        });
+        state.writeMasks.push_back(VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT);
+      }
+
+      // Pointers into the state released below
+      state.inputAssembly.pNext = nullptr;
+      state.rasterization.pNext = nullptr;
+      state.multisample.pNext = nullptr;
+      state.multisample.pSampleMask = nullptr;
+      state.depthStencil.pNext = nullptr;
+    }
+
+    releaseState();
+    mShaderSources.clear();
+  }
+
+  void frPipeline::bindShaderObjects(VkCommandBuffer cmdBuf) {
+    const frRenderer *r = mRenderer;
+    const frShaderObjectState &state = mObjectState;
+    auto baked = [&](VkDynamicState dynamicState) { return !hasDynamicState(dynamicState); };
+
+    { // Stages the pipeline doesn't have are unbound, as far as the device has them enabled
+      std::vector<VkShaderStageFlagBits> stages = { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT };
+      if (r->mEnabledFeatures.tessellationShader) {
+        stages.push_back(VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT);
+        stages.push_back(VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT);
+      }
+      if (r->mEnabledFeatures.geometryShader) stages.push_back(VK_SHADER_STAGE_GEOMETRY_BIT);
+
+      std::vector<VkShaderEXT> objects(stages.size(), VK_NULL_HANDLE);
+      for (size_t i = 0; i < stages.size(); ++i) {
+        for (size_t j = 0; j < mObjectStages.size(); ++j) {
+          if (mObjectStages[j] == stages[i]) objects[i] = mObjects[j];
+        }
+      }
+      r->mCmdBindShaders(cmdBuf, static_cast<uint32_t>(stages.size()), stages.data(), objects.data());
+    }
+
+    bool tessellation = std::find(mObjectStages.begin(), mObjectStages.end(), VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT) != mObjectStages.end();
+
+    // Vertex input and assembly
+    r->mCmdSetVertexInput(cmdBuf, static_cast<uint32_t>(state.bindings.size()), state.bindings.data(),
+                          static_cast<uint32_t>(state.attributes.size()), state.attributes.data());
+    if (baked(VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY)) r->mCmdSetPrimitiveTopology(cmdBuf, state.inputAssembly.topology);
+    if (baked(VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE)) r->mCmdSetPrimitiveRestartEnable(cmdBuf, state.inputAssembly.primitiveRestartEnable);
+    if (tessellation) {
+      if (baked(VK_DYNAMIC_STATE_PATCH_CONTROL_POINTS_EXT)) r->mCmdSetPatchControlPoints(cmdBuf, state.patchControlPoints);
+      r->mCmdSetTessellationDomainOrigin(cmdBuf, VK_TESSELLATION_DOMAIN_ORIGIN_UPPER_LEFT);
+    }
+
+    // Viewports, a pipeline keeps what was set before bind() when only the values are dynamic and so does this.
+    // The count comes with the values there, frCommands::setViewports/setScissors set both under shader objects.
+    if (baked(VK_DYNAMIC_STATE_VIEWPORT_WITH_COUNT) && baked(VK_DYNAMIC_STATE_VIEWPORT)) {
+      r->mCmdSetViewportWithCount(cmdBuf, static_cast<uint32_t>(state.viewports.size()), state.viewports.data());
+    }
+    if (baked(VK_DYNAMIC_STATE_SCISSOR_WITH_COUNT) && baked(VK_DYNAMIC_STATE_SCISSOR)) {
+      r->mCmdSetScissorWithCount(cmdBuf, static_cast<uint32_t>(state.scissors.size()), state.scissors.data());
+    }
+
+    // Rasterization
+    const VkPipelineRasterizationStateCreateInfo &raster = state.rasterization;
+    if (baked(VK_DYNAMIC_STATE_RASTERIZER_DISCARD_ENABLE)) r->mCmdSetRasterizerDiscardEnable(cmdBuf, raster.rasterizerDiscardEnable);
+    if (baked(VK_DYNAMIC_STATE_CULL_MODE)) r->mCmdSetCullMode(cmdBuf, raster.cullMode);
+    if (baked(VK_DYNAMIC_STATE_FRONT_FACE)) r->mCmdSetFrontFace(cmdBuf, raster.frontFace);
+    if (baked(VK_DYNAMIC_STATE_POLYGON_MODE_EXT)) r->mCmdSetPolygonMode(cmdBuf, raster.polygonMode);
+    if (baked(VK_DYNAMIC_STATE_DEPTH_CLAMP_ENABLE_EXT)) r->mCmdSetDepthClampEnable(cmdBuf, raster.depthClampEnable);
+    if (baked(VK_DYNAMIC_STATE_DEPTH_BIAS_ENABLE)) r->mCmdSetDepthBiasEnable(cmdBuf, raster.depthBiasEnable);
+    if (baked(VK_DYNAMIC_STATE_DEPTH_BIAS)) vkCmdSetDepthBias(cmdBuf, raster.depthBiasConstantFactor, raster.depthBiasClamp, raster.depthBiasSlopeFactor);
+    if (baked(VK_DYNAMIC_STATE_LINE_WIDTH)) vkCmdSetLineWidth(cmdBuf, raster.lineWidth);
+
+    // Multisampling
+    r->mCmdSetRasterizationSamples(cmdBuf, state.multisample.rasterizationSamples);
+    r->mCmdSetSampleMask(cmdBuf, state.multisample.rasterizationSamples, state.sampleMask.data());
+    r->mCmdSetAlphaToCoverageEnable(cmdBuf, state.multisample.alphaToCoverageEnable);
+    if (r->mEnabledFeatures.alphaToOne) r->mCmdSetAlphaToOneEnable(cmdBuf, state.multisample.alphaToOneEnable);
+
+    // Depth and stencil
+    const VkPipelineDepthStencilStateCreateInfo &depth = state.depthStencil;
+    if (baked(VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE)) r->mCmdSetDepthTestEnable(cmdBuf, depth.depthTestEnable);
+    if (baked(VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE)) r->mCmdSetDepthWriteEnable(cmdBuf, depth.depthWriteEnable);
+    if (baked(VK_DYNAMIC_STATE_DEPTH_COMPARE_OP)) r->mCmdSetDepthCompareOp(cmdBuf, depth.depthCompareOp);
+    if (baked(VK_DYNAMIC_STATE_DEPTH_BOUNDS_TEST_ENABLE)) r->mCmdSetDepthBoundsTestEnable(cmdBuf, depth.depthBoundsTestEnable);
+    if (baked(VK_DYNAMIC_STATE_DEPTH_BOUNDS)) vkCmdSetDepthBounds(cmdBuf, depth.minDepthBounds, depth.maxDepthBounds);
+    if (baked(VK_DYNAMIC_STATE_STENCIL_TEST_ENABLE)) r->mCmdSetStencilTestEnable(cmdBuf, depth.stencilTestEnable);
+    const VkStencilOpState *faces[2] = { &depth.front, &depth.back };
+    for (uint32_t i = 0; i < 2; ++i) {
+      VkStencilFaceFlags face = i == 0 ? VK_STENCIL_FACE_FRONT_BIT : VK_STENCIL_FACE_BACK_BIT;
+      const VkStencilOpState &stencil = *faces[i];
+      if (baked(VK_DYNAMIC_STATE_STENCIL_OP)) r->mCmdSetStencilOp(cmdBuf, face, stencil.failOp, stencil.passOp, stencil.depthFailOp, stencil.compareOp);
+      if (baked(VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK)) vkCmdSetStencilCompareMask(cmdBuf, face, stencil.compareMask);
+      if (baked(VK_DYNAMIC_STATE_STENCIL_WRITE_MASK)) vkCmdSetStencilWriteMask(cmdBuf, face, stencil.writeMask);
+      if (baked(VK_DYNAMIC_STATE_STENCIL_REFERENCE)) vkCmdSetStencilReference(cmdBuf, face, stencil.reference);
+    }
+
+    // Color blending
+    if (r->mEnabledFeatures.logicOp) r->mCmdSetLogicOpEnable(cmdBuf, state.logicOpEnable);
+    if (state.logicOpEnable && baked(VK_DYNAMIC_STATE_LOGIC_OP_EXT)) r->mCmdSetLogicOp(cmdBuf, state.logicOp);
+    if (!state.writeMasks.empty()) {
+      uint32_t count = static_cast<uint32_t>(state.writeMasks.size());
+      if (baked(VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT)) r->mCmdSetColorBlendEnable(cmdBuf, 0, count, state.blendEnables.data());
+      if (baked(VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT)) r->mCmdSetColorBlendEquation(cmdBuf, 0, count, state.blendEquations.data());
+      if (baked(VK_DYNAMIC_STATE_COLOR_WRITE_MASK_EXT)) r->mCmdSetColorWriteMask(cmdBuf, 0, count, state.writeMasks.data());
+    }
+    if (baked(VK_DYNAMIC_STATE_BLEND_CONSTANTS)) vkCmdSetBlendConstants(cmdBuf, state.blendConstants);
+  }
+
+  void frPipeline::bindDescriptor(VkCommandBuffer cmdBuf, VkPipelineBindPoint bindPoint, uint32_t firstSet, frDescriptor *descriptor) {
+    VkDescriptorSet set = descriptor->mSet;
+    vkCmdBindDescriptorSets(cmdBuf, bindPoint, mLayout, firstSet, 1, &set, 0, VK_NULL_HANDLE);
+  }
+
+  void frPipeline::bindDescriptor(VkCommandBuffer cmdBuf, VkPipelineBindPoint bindPoint, uint32_t firstSet, frDescriptor *descriptor, std::vector<uint32_t> dynamicOffsets) {
+    VkDescriptorSet set = descriptor->mSet;
+    vkCmdBindDescriptorSets(cmdBuf, bindPoint, mLayout, firstSet, 1, &set, static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+  }
+
+  void frPipeline::pushConstant(VkCommandBuffer cmdBuf, VkShaderStageFlags stage, uint32_t offset, uint32_t size, const void *value) {
+    vkCmdPushConstants(cmdBuf, mLayout, stage, offset, size, value);
+  }
+
+  void frPipeline::setName(frRenderer *renderer, const char *name) {
+    { // Set name for mLayout
+      VkDebugUtilsObjectNameInfoEXT objectNameInfo = {};
+      objectNameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
+      objectNameInfo.pNext = nullptr;
+      objectNameInfo.objectType = VK_OBJECT_TYPE_PIPELINE_LAYOUT;
+      objectNameInfo.objectHandle = reinterpret_cast<uint64_t>(mLayout);
+      objectNameInfo.pObjectName = name;
+
+      VK_WRAPPER(renderer->getSetDebugUtilsObjectNameFunc()(mDevice, &objectNameInfo));
+    }
+
+    if (mPipeline) { // Set name for mPipeline
+      VkDebugUtilsObjectNameInfoEXT objectNameInfo = {};
+      objectNameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
+      objectNameInfo.pNext = nullptr;
+      objectNameInfo.objectType = VK_OBJECT_TYPE_PIPELINE;
+      objectNameInfo.objectHandle = reinterpret_cast<uint64_t>(mPipeline);
+      objectNameInfo.pObjectName = name;
+
+      VK_WRAPPER(renderer->getSetDebugUtilsObjectNameFunc()(mDevice, &objectNameInfo));
+    }
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frPipeline]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frPipelineLibrary]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  static const VkGraphicsPipelineLibraryFlagsEXT kPipelinePartFlags[FR_PIPELINE_PART_COUNT] = {
+    VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+    VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+    VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+    VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+  };
+
+  frPipelineLibrary::frPipelineLibrary()
+  {}
+
+  frPipelineLibrary::~frPipelineLibrary() {
+    cleanup();
+  }
+
+  void frPipelineLibrary::initialize(frRenderer *renderer, frThreadPool *threads) {
+    mRenderer = renderer;
+    mThreads = threads;
+    mEnabled = renderer->mGraphicsPipelineLibrary && !renderer->mShaderObject;
+  }
+
+  void frPipelineLibrary::cleanup() {
+    if (!mRenderer) return;
+
+    { // Background links use the parts
+      std::unique_lock<std::mutex> lock(mOptimizedMutex);
+      mOptimizedCond.wait(lock, [this] { return mOptimizing == 0; });
+    }
+    update();
+
+    VkDevice device = mRenderer->mDevice;
+    for (auto &parts : mParts) {
+      for (auto &entry : parts) vkDestroyPipeline(device, entry.second, nullptr);
+      parts.clear();
+    }
+    for (auto &entry : mLayouts) vkDestroyPipelineLayout(device, entry.second, nullptr);
+    mLayouts.clear();
+
+    mRenderer = nullptr;
+  }
+
+  size_t frPipelineLibrary::partCount() const {
+    size_t count = 0;
+    for (auto &parts : mParts) count += parts.size();
+    return count;
+  }
+
+  // Parts keep their own layout, the pipeline's may be gone long before the part
+  VkPipelineLayout frPipelineLibrary::getLayout(frPipeline *pipeline) {
+    std::string key = pipeline->layoutKey();
+    auto found = mLayouts.find(key);
+    if (found != mLayouts.end()) return found->second;
+
+    VkPipelineLayoutCreateInfo createInfo = {
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO, VK_NULL_HANDLE, 0,
+      static_cast<uint32_t>(pipeline->mDescLayouts.size()), pipeline->mDescLayouts.data(),
+      static_cast<uint32_t>(pipeline->mPCRanges.size()), pipeline->mPCRanges.data()
+    };
+
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VK_WRAPPER(vkCreatePipelineLayout(mRenderer->mDevice, &createInfo, nullptr, &layout));
+    mLayouts.emplace(std::move(key), layout);
+    return layout;
+  }
+
+  VkPipeline frPipelineLibrary::createPart(frPipelinePart part, frPipeline *pipeline, const VkGraphicsPipelineCreateInfo &full, VkPipelineLayout layout) {
+    VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
+    libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+    libraryInfo.flags = kPipelinePartFlags[part];
+
+    VkGraphicsPipelineCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    createInfo.pNext = &libraryInfo;
+    createInfo.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+    createInfo.pDynamicState = full.pDynamicState;
+
+    std::vector<VkPipelineShaderStageCreateInfo> stages{};
+    for (auto &stage : pipeline->mShaders) {
+      bool fragment = stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT;
+      if ((part == FR_PIPELINE_PART_FRAGMENT_SHADER && fragment) || (part == FR_PIPELINE_PART_PRE_RASTERIZATION && !fragment)) {
+        stages.push_back(stage);
+      }
+    }
+    createInfo.stageCount = static_cast<uint32_t>(stages.size());
+    createInfo.pStages = stages.data();
+
+    switch (part) {
+    case FR_PIPELINE_PART_VERTEX_INPUT: {
+      createInfo.pVertexInputState = full.pVertexInputState;
+      createInfo.pInputAssemblyState = full.pInputAssemblyState;
+    } break;
+    case FR_PIPELINE_PART_PRE_RASTERIZATION: {
+      createInfo.pTessellationState = full.pTessellationState;
+      createInfo.pViewportState = full.pViewportState;
+      createInfo.pRasterizationState = full.pRasterizationState;
+      createInfo.layout = layout;
+      createInfo.renderPass = full.renderPass;
+    } break;
+    case FR_PIPELINE_PART_FRAGMENT_SHADER: {
+      createInfo.pMultisampleState = full.pMultisampleState;
+      createInfo.pDepthStencilState = full.pDepthStencilState;
+      createInfo.layout = layout;
+      createInfo.renderPass = full.renderPass;
+    } break;
+    case FR_PIPELINE_PART_FRAGMENT_OUTPUT: {
+      createInfo.pMultisampleState = full.pMultisampleState;
+      createInfo.pColorBlendState = full.pColorBlendState;
+      createInfo.renderPass = full.renderPass;
+    } break;
+    default: break;
+    }
+
+    VkPipeline library = VK_NULL_HANDLE;
+    VK_WRAPPER(vkCreateGraphicsPipelines(mRenderer->mDevice, mRenderer->mPipelineCache, 1, &createInfo, nullptr, &library));
+    return library;
+  }
+
+  void frPipelineLibrary::link(frPipeline *pipeline, frRenderPass *renderPass) {
+    if (!mEnabled) {
+      pipeline->initialize(mRenderer, renderPass);
+      return;
+    }
+
+    VkGraphicsPipelineCreateInfo full = pipeline->prepare(mRenderer, renderPass);
+
+    VkPipeline parts[FR_PIPELINE_PART_COUNT];
+    for (uint32_t i = 0; i < FR_PIPELINE_PART_COUNT; ++i) {
+      frPipelinePart part = static_cast<frPipelinePart>(i);
+      std::string key = pipeline->partKey(part, renderPass);
+
+      auto found = mParts[part].find(key);
+      if (found != mParts[part].end()) {
+        parts[part] = found->second;
+        continue;
+      }
+
+      bool needsLayout = part == FR_PIPELINE_PART_PRE_RASTERIZATION || part == FR_PIPELINE_PART_FRAGMENT_SHADER;
+      parts[part] = createPart(part, pipeline, full, needsLayout ? getLayout(pipeline) : VK_NULL_HANDLE);
+      mParts[part].emplace(std::move(key), parts[part]);
+    }
+    pipeline->releaseState();
+
+    // Without fast linking an unoptimized link costs about as much as an optimized one
+    bool optimizeNow = !mRenderer->mGraphicsPipelineFastLinking;
+
+    VkPipelineLibraryCreateInfoKHR libraryInfo{};
+    libraryInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+    libraryInfo.libraryCount = FR_PIPELINE_PART_COUNT;
+    libraryInfo.pLibraries = parts;
+
+    VkGraphicsPipelineCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    createInfo.pNext = &libraryInfo;
+    createInfo.flags = optimizeNow ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+    createInfo.layout = pipeline->mLayout;
+
+    VK_WRAPPER(vkCreateGraphicsPipelines(mRenderer->mDevice, mRenderer->mPipelineCache, 1, &createInfo, nullptr, &pipeline->mPipeline));
+
+    if (optimizeNow || !mThreads) return;
+
+    {
+      std::lock_guard<std::mutex> lock(mOptimizedMutex);
+      ++mOptimizing;
+    }
+
+    std::vector<VkPipeline> libraries(parts, parts + FR_PIPELINE_PART_COUNT);
+    VkPipelineLayout layout = pipeline->mLayout;
+    mThreads->submit([this, pipeline, libraries, layout](uint32_t) {
+      VkPipelineLibraryCreateInfoKHR libraryInfo{};
+      libraryInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+      libraryInfo.libraryCount = static_cast<uint32_t>(libraries.size());
+      libraryInfo.pLibraries = libraries.data();
+
+      VkGraphicsPipelineCreateInfo createInfo{};
+      createInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+      createInfo.pNext = &libraryInfo;
+      createInfo.flags = VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT;
+      createInfo.layout = layout;
+
+      // A failure keeps the fast-linked pipeline
+      VkPipeline optimized = VK_NULL_HANDLE;
+      VkResult result = vkCreateGraphicsPipelines(mRenderer->mDevice, mRenderer->mPipelineCache, 1, &createInfo, nullptr, &optimized);
+
+      std::lock_guard<std::mutex> lock(mOptimizedMutex);
+      if (result == VK_SUCCESS) mOptimized.push_back({ pipeline, optimized });
+      --mOptimizing;
+      mOptimizedCond.notify_all();
+    });
+  }
+
+  void frPipelineLibrary::update() {
+    std::vector<frOptimizedPipeline> optimized{};
+    {
+      std::lock_guard<std::mutex> lock(mOptimizedMutex);
+      optimized.swap(mOptimized);
+    }
+
+    VkDevice device = mRenderer->mDevice;
+    for (auto &entry : optimized) {
+      VkPipeline fast = entry.pipeline->mPipeline;
+      entry.pipeline->mPipeline = entry.optimized;
+      mRenderer->deferDeletion([device, fast]() { vkDestroyPipeline(device, fast, nullptr); });
+    }
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frPipelineLibrary]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frPipelineRegistry]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frPipelineRegistry::frPipelineRegistry()
+  {}
+
+  frPipelineRegistry::~frPipelineRegistry() {
+    cleanup();
+  }
+
+  void frPipelineRegistry::initialize(frRenderer *renderer, frPipelineLibrary *library) {
+    mRenderer = renderer;
+    mLibrary = library;
+  }
+
+  void frPipelineRegistry::cleanup() {
+    for (auto &entry : mPipelines) delete entry.second;
+    mPipelines.clear();
+    mHits = 0;
+  }
+
+  frPipeline *frPipelineRegistry::acquire(frPipeline *pipeline, frRenderPass *renderPass) {
+    std::string key = pipeline->stateKey(renderPass);
+
+    auto found = mPipelines.find(key);
+    if (found != mPipelines.end()) {
+      ++mHits;
+      delete pipeline;
+      return found->second;
+    }
+
+    if (mLibrary) mLibrary->link(pipeline, renderPass);
+    else pipeline->initialize(mRenderer, renderPass);
+    mPipelines.emplace(std::move(key), pipeline);
+    return pipeline;
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frPipelineRegistry]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frPipelineCompiler]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frPipelineCompiler::frPipelineCompiler()
+  {}
+
+  frPipelineCompiler::~frPipelineCompiler() {
+    cleanup();
+  }
+
+  void frPipelineCompiler::initialize(frRenderer *renderer, frThreadPool *threads, uint32_t batchSize) {
+    mRenderer = renderer;
+    mThreads = threads;
+    mBatchSize = std::max(1u, batchSize);
+  }
+
+  void frPipelineCompiler::cleanup() {
+    if (!mRenderer) return;
+
+    flush();
+    for (auto &future : mOutstanding) future.wait(); // Failures were the caller's to collect
+    mOutstanding.clear();
+    mRenderer = nullptr;
+  }
+
+  std::shared_future<frPipeline*> frPipelineCompiler::compile(frPipeline *pipeline, frRenderPass *renderPass) {
+    if (mRenderer->mShaderObject) { // Nothing worth a worker, shader objects are created right away
+      std::promise<frPipeline*> promise;
+      try {
+        pipeline->initialize(mRenderer, renderPass);
+        promise.set_value(pipeline);
+      } catch (...) {
+        promise.set_exception(std::current_exception());
+      }
+      return promise.get_future().share();
+    }
+
+    frPendingPipeline pending{ pipeline, pipeline->prepare(mRenderer, renderPass), std::make_shared<std::promise<frPipeline*>>() };
+    std::shared_future<frPipeline*> future = pending.promise->get_future().share();
+
+    mQueued.push_back(std::move(pending));
+    mOutstanding.push_back(future);
+    if (mQueued.size() >= mBatchSize) flush();
+
+    return future;
+  }
+
+  void frPipelineCompiler::flush() {
+    if (mQueued.empty()) return;
+
+    auto batch = std::make_shared<std::vector<frPendingPipeline>>(std::move(mQueued));
+    mQueued.clear();
+    mThreads->submit([this, batch](uint32_t) { compileBatch(*batch); });
+  }
+
+  void frPipelineCompiler::wait() {
+    flush();
+
+    std::vector<std::shared_future<frPipeline*>> outstanding;
+    outstanding.swap(mOutstanding);
+    for (auto &future : outstanding) future.wait();
+    for (auto &future : outstanding) future.get(); // Rethrows
+  }
+
+  void frPipelineCompiler::compileBatch(std::vector<frPendingPipeline> &batch) {
+    VkDevice device = mRenderer->mDevice;
+    VkPipelineCache cache = mRenderer->mPipelineCache;
+
+    std::vector<VkGraphicsPipelineCreateInfo> createInfos(batch.size());
+    std::vector<VkPipeline> pipelines(batch.size(), VK_NULL_HANDLE);
+    for (size_t i = 0; i < batch.size(); ++i) createInfos[i] = batch[i].createInfo;
+
+    VkResult result = vkCreateGraphicsPipelines(device, cache, static_cast<uint32_t>(createInfos.size()), createInfos.data(), nullptr, pipelines.data());
+    for (size_t i = 0; i < batch.size(); ++i) {
+      frPendingPipeline &pending = batch[i];
+      if (result != VK_SUCCESS && !pipelines[i]) { // A failed batch doesn't say which one failed, retry alone
+        try {
+          VK_WRAPPER(vkCreateGraphicsPipelines(device, cache, 1, &createInfos[i], nullptr, &pipelines[i]));
+        } catch (...) {
+          pending.promise->set_exception(std::current_exception());
+          continue;
+        }
+      }
+
+      pending.pipeline->mPipeline = pipelines[i];
+      pending.pipeline->releaseState();
+      pending.promise->set_value(pending.pipeline);
+    }
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frPipelineCompiler]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frCommands]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frCommands::frCommands()
+  {}
+
+  frCommands::~frCommands() {
+    cleanup();
+  }
+
+  void frCommands::initialize(frRenderer *renderer) {
     VkCommandPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
@@ -907,167 +2301,3178 @@ namespace fr {
     mDevice = renderer->mDevice;
   }
 
-  void frCommands::cleanup() {
-    vkDestroyCommandPool(mDevice, mPool, nullptr);
+  void frCommands::cleanup() {
+    if (!mDevice) return;
+
+    for (auto &buffer : mPendingBuffers) vkWaitForFences(mDevice, 1, &buffer.fence, VK_TRUE, UINT64_MAX);
+    recycle();
+    for (auto &buffer : mRecordingBuffers) mFreeBuffers.push_back(buffer);
+    mRecordingBuffers.clear();
+
+    for (auto &buffer : mFreeBuffers) vkDestroyFence(mDevice, buffer.fence, nullptr);
+    mFreeBuffers.clear();
+
+    vkDestroyCommandPool(mDevice, mPool, nullptr);
+    mDevice = VK_NULL_HANDLE;
+  }
+
+  std::vector<VkCommandBuffer> frCommands::allocateBuffers(VkCommandBufferLevel level, uint32_t count) {
+    std::vector<VkCommandBuffer> buffers(count);
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = mPool;
+    allocInfo.level = level;
+    allocInfo.commandBufferCount = count;
+    VK_WRAPPER(vkAllocateCommandBuffers(mDevice, &allocInfo, buffers.data()));
+
+    return buffers;
+  }
+
+  void frCommands::freeBuffers(const std::vector<VkCommandBuffer> &buffers) {
+    if (buffers.empty()) return;
+    vkFreeCommandBuffers(mDevice, mPool, static_cast<uint32_t>(buffers.size()), buffers.data());
+  }
+
+  void frCommands::beginSingleTimeFrame() {
+    if (mSingleTimeCommandBuf) return;
+
+    mSingleTimeCommandBuf = beginSingleTime();
+  }
+
+  void frCommands::endSingleTimeFrame(frRenderer *renderer) {
+    if (!mSingleTimeCommandBuf) return;
+    endSingleTime(renderer, mSingleTimeCommandBuf);
+    mSingleTimeCommandBuf = VK_NULL_HANDLE;
+  }
+
+  VkCommandBuffer frCommands::beginSingleTime() {
+    recycle();
+
+    frRecycledBuffer buffer{};
+    if (!mFreeBuffers.empty()) {
+      buffer = mFreeBuffers.back();
+      mFreeBuffers.pop_back();
+      VK_WRAPPER(vkResetFences(mDevice, 1, &buffer.fence));
+      VK_WRAPPER(vkResetCommandBuffer(buffer.cmdBuf, 0));
+    } else {
+      buffer.cmdBuf = allocateBuffers(VK_COMMAND_BUFFER_LEVEL_PRIMARY)[0];
+
+      VkFenceCreateInfo fenceInfo{};
+      fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+      VK_WRAPPER(vkCreateFence(mDevice, &fenceInfo, nullptr, &buffer.fence));
+    }
+    mRecordingBuffers.push_back(buffer);
+
+    frCommands::begin(buffer.cmdBuf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    return buffer.cmdBuf;
+  }
+  
+  void frCommands::endSingleTime(frRenderer *renderer, VkCommandBuffer cmdBuf, bool wait) {
+    auto it = std::find_if(mRecordingBuffers.begin(), mRecordingBuffers.end(),
+      [cmdBuf](const frRecycledBuffer &buffer) { return buffer.cmdBuf == cmdBuf; });
+    if (it == mRecordingBuffers.end()) {
+      throw fr::frVulkanException("endSingleTime called with a command buffer not from beginSingleTime!");
+    }
+    frRecycledBuffer buffer = *it;
+    mRecordingBuffers.erase(it);
+
+    frCommands::end(cmdBuf);
+
+    frSubmission submission{};
+    submission.commandBuffers.push_back(cmdBuf);
+    renderer->mSubmitQueue.submit(renderer->mGraphicsQueue, std::move(submission), buffer.fence);
+
+    if (!wait) {
+      mPendingBuffers.push_back(buffer);
+      return;
+    }
+
+    // Only this submit is waited for, unlike vkQueueWaitIdle other work on the queue keeps running.
+    VK_WRAPPER(vkWaitForFences(mDevice, 1, &buffer.fence, VK_TRUE, UINT64_MAX));
+    mFreeBuffers.push_back(buffer);
+  }
+
+  void frCommands::recycle() {
+    size_t i = 0;
+    while (i < mPendingBuffers.size()) {
+      if (vkGetFenceStatus(mDevice, mPendingBuffers[i].fence) == VK_SUCCESS) {
+        mFreeBuffers.push_back(mPendingBuffers[i]);
+        mPendingBuffers[i] = mPendingBuffers.back();
+        mPendingBuffers.pop_back();
+      } else {
+        i++;
+      }
+    }
+  }
+
+  void frCommands::begin(VkCommandBuffer cmdBuf, VkCommandBufferUsageFlags flags) {
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = flags;
+    beginInfo.pInheritanceInfo = nullptr;
+    VK_WRAPPER(vkBeginCommandBuffer(cmdBuf, &beginInfo));
+  }
+
+  void frCommands::end(VkCommandBuffer cmdBuf) {
+    VK_WRAPPER(vkEndCommandBuffer(cmdBuf));
+  }
+
+  void frCommands::submit(frRenderer *renderer, VkCommandBuffer cmdBuf, frSynchronization *sync) {
+    frSubmission submission{};
+    submission.commandBuffers.push_back(cmdBuf);
+
+    VkFence fence = sync ? sync->attach(submission) : VK_NULL_HANDLE;
+
+    renderer->mSubmitQueue.submit(renderer->mGraphicsQueue, std::move(submission), fence);
+  }
+  void frCommands::setCullMode(frRenderer *renderer, VkCommandBuffer cmdBuf, VkCullModeFlags cullMode) {
+    renderer->mCmdSetCullMode(cmdBuf, cullMode);
+  }
+
+  void frCommands::setFrontFace(frRenderer *renderer, VkCommandBuffer cmdBuf, VkFrontFace frontFace) {
+    renderer->mCmdSetFrontFace(cmdBuf, frontFace);
+  }
+
+  void frCommands::setPrimitiveTopology(frRenderer *renderer, VkCommandBuffer cmdBuf, VkPrimitiveTopology topology) {
+    renderer->mCmdSetPrimitiveTopology(cmdBuf, topology);
+  }
+
+  void frCommands::setDepthTestEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable) {
+    renderer->mCmdSetDepthTestEnable(cmdBuf, enable ? VK_TRUE : VK_FALSE);
+  }
+
+  void frCommands::setDepthWriteEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable) {
+    renderer->mCmdSetDepthWriteEnable(cmdBuf, enable ? VK_TRUE : VK_FALSE);
+  }
+
+  void frCommands::setDepthCompareOp(frRenderer *renderer, VkCommandBuffer cmdBuf, VkCompareOp compareOp) {
+    renderer->mCmdSetDepthCompareOp(cmdBuf, compareOp);
+  }
+
+  void frCommands::setDepthBoundsTestEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable) {
+    renderer->mCmdSetDepthBoundsTestEnable(cmdBuf, enable ? VK_TRUE : VK_FALSE);
+  }
+
+  void frCommands::setStencilTestEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable) {
+    renderer->mCmdSetStencilTestEnable(cmdBuf, enable ? VK_TRUE : VK_FALSE);
+  }
+
+  void frCommands::setStencilOp(frRenderer *renderer, VkCommandBuffer cmdBuf, VkStencilFaceFlags faces,
+                                VkStencilOp failOp, VkStencilOp passOp, VkStencilOp depthFailOp, VkCompareOp compareOp) {
+    renderer->mCmdSetStencilOp(cmdBuf, faces, failOp, passOp, depthFailOp, compareOp);
+  }
+
+  void frCommands::setRasterizerDiscardEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable) {
+    renderer->mCmdSetRasterizerDiscardEnable(cmdBuf, enable ? VK_TRUE : VK_FALSE);
+  }
+
+  void frCommands::setDepthBiasEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable) {
+    renderer->mCmdSetDepthBiasEnable(cmdBuf, enable ? VK_TRUE : VK_FALSE);
+  }
+
+  void frCommands::setPrimitiveRestartEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable) {
+    renderer->mCmdSetPrimitiveRestartEnable(cmdBuf, enable ? VK_TRUE : VK_FALSE);
+  }
+
+  void frCommands::setViewports(frRenderer *renderer, VkCommandBuffer cmdBuf, const std::vector<VkViewport> &viewports) {
+    if (renderer->mShaderObject) { // No pipeline to take the count from
+      renderer->mCmdSetViewportWithCount(cmdBuf, static_cast<uint32_t>(viewports.size()), viewports.data());
+      return;
+    }
+    vkCmdSetViewport(cmdBuf, 0, static_cast<uint32_t>(viewports.size()), viewports.data());
+  }
+
+  void frCommands::setScissors(frRenderer *renderer, VkCommandBuffer cmdBuf, const std::vector<VkRect2D> &scissors) {
+    if (renderer->mShaderObject) {
+      renderer->mCmdSetScissorWithCount(cmdBuf, static_cast<uint32_t>(scissors.size()), scissors.data());
+      return;
+    }
+    vkCmdSetScissor(cmdBuf, 0, static_cast<uint32_t>(scissors.size()), scissors.data());
+  }
+
+  void frCommands::setLogicOp(frRenderer *renderer, VkCommandBuffer cmdBuf, VkLogicOp logicOp) {
+    renderer->mCmdSetLogicOp(cmdBuf, logicOp);
+  }
+
+  void frCommands::setPatchControlPoints(frRenderer *renderer, VkCommandBuffer cmdBuf, uint32_t controlPoints) {
+    renderer->mCmdSetPatchControlPoints(cmdBuf, controlPoints);
+  }
+
+  void frCommands::setPolygonMode(frRenderer *renderer, VkCommandBuffer cmdBuf, VkPolygonMode polygonMode) {
+    renderer->mCmdSetPolygonMode(cmdBuf, polygonMode);
+  }
+
+  void frCommands::setDepthClampEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, bool enable) {
+    renderer->mCmdSetDepthClampEnable(cmdBuf, enable ? VK_TRUE : VK_FALSE);
+  }
+
+  void frCommands::setColorBlendEnable(frRenderer *renderer, VkCommandBuffer cmdBuf, uint32_t firstAttachment, const std::vector<VkBool32> &enables) {
+    renderer->mCmdSetColorBlendEnable(cmdBuf, firstAttachment, static_cast<uint32_t>(enables.size()), enables.data());
+  }
+
+  void frCommands::setColorBlendEquation(frRenderer *renderer, VkCommandBuffer cmdBuf, uint32_t firstAttachment, const std::vector<VkColorBlendEquationEXT> &equations) {
+    renderer->mCmdSetColorBlendEquation(cmdBuf, firstAttachment, static_cast<uint32_t>(equations.size()), equations.data());
+  }
+
+  void frCommands::setColorWriteMask(frRenderer *renderer, VkCommandBuffer cmdBuf, uint32_t firstAttachment, const std::vector<VkColorComponentFlags> &masks) {
+    renderer->mCmdSetColorWriteMask(cmdBuf, firstAttachment, static_cast<uint32_t>(masks.size()), masks.data());
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frCommands]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frSynchronization]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frSynchronization::frSynchronization()
+  {}
+
+  frSynchronization::~frSynchronization() {
+    cleanup();
+  }
+
+  void frSynchronization::initialize(frRenderer *renderer) {
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    VK_WRAPPER(vkCreateSemaphore(renderer->mDevice, &semaphoreInfo, nullptr, &mImageAvailableSemaphore));
+    VK_WRAPPER(vkCreateSemaphore(renderer->mDevice, &semaphoreInfo, nullptr, &mRenderFinishedSemaphore));
+    if (renderer->mTimelineSemaphores) {
+      mTimeline = &renderer->mTimeline;
+    } else {
+      VK_WRAPPER(vkCreateFence(renderer->mDevice, &fenceInfo, nullptr, &mInFlightFence));
+    }
+
+    mRenderer = renderer;
+    mDevice = renderer->mDevice;
+  }
+
+  void frSynchronization::cleanup() {
+    vkDestroySemaphore(mDevice, mImageAvailableSemaphore, nullptr);
+    vkDestroySemaphore(mDevice, mRenderFinishedSemaphore, nullptr);
+    vkDestroyFence(mDevice,     mInFlightFence, nullptr);
+    mImageAvailableSemaphore = VK_NULL_HANDLE;
+    mRenderFinishedSemaphore = VK_NULL_HANDLE;
+    mInFlightFence = VK_NULL_HANDLE;
+  }
+
+  void frSynchronization::wait() {
+    if (mTimeline) {
+      mTimeline->wait(mValue);
+      return;
+    }
+    vkWaitForFences(mDevice, 1, &mInFlightFence, VK_TRUE, UINT64_MAX);
+    // Everything submitted to the graphics queue before this fence is done as well
+    mRenderer->mFramesCompleted = std::max(mRenderer->mFramesCompleted, mValue);
+  }
+   
+  void frSynchronization::reset() {
+    if (mTimeline) return; // Nothing to reset, the next submit signals a fresh value
+    vkResetFences(mDevice, 1, &mInFlightFence);
+  }
+
+  VkFence frSynchronization::attach(frSubmission &submission) {
+    submission.wait(mImageAvailableSemaphore, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    submission.signal(mRenderFinishedSemaphore);
+
+    if (!mTimeline) {
+      mValue = ++mRenderer->mFrameNumber;
+      return mInFlightFence;
+    }
+
+    mValue = mTimeline->next();
+    submission.signal(mTimeline->get(), mValue);
+    return VK_NULL_HANDLE;
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frSynchronization]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frTimeline]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frTimeline::frTimeline()
+  {}
+
+  frTimeline::~frTimeline() {
+    cleanup();
+  }
+
+  void frTimeline::initialize(frRenderer *renderer, uint64_t initialValue) {
+    mDevice = renderer->mDevice;
+
+    bool core = renderer->mApiVersion >= VK_API_VERSION_1_2;
+    mWaitSemaphores = reinterpret_cast<PFN_vkWaitSemaphores>(
+      vkGetDeviceProcAddr(mDevice, core ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR"));
+    mGetSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValue>(
+      vkGetDeviceProcAddr(mDevice, core ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR"));
+    if (!mWaitSemaphores || !mGetSemaphoreCounterValue) {
+      throw fr::frVulkanException("Failed to load timeline semaphore functions!");
+    }
+
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = initialValue;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    VK_WRAPPER(vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &mSemaphore));
+
+    mLastSignaled = initialValue;
+    mCompleted = initialValue;
+  }
+
+  void frTimeline::cleanup() {
+    if (!mSemaphore) return;
+    vkDestroySemaphore(mDevice, mSemaphore, nullptr);
+    mSemaphore = VK_NULL_HANDLE;
+  }
+
+  uint64_t frTimeline::completedValue() {
+    uint64_t value = 0;
+    VK_WRAPPER(mGetSemaphoreCounterValue(mDevice, mSemaphore, &value));
+    mCompleted = std::max(mCompleted, value);
+    return mCompleted;
+  }
+
+  void frTimeline::wait(uint64_t value, uint64_t timeout) {
+    if (value <= mCompleted) return;
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &mSemaphore;
+    waitInfo.pValues = &value;
+
+    VkResult result = mWaitSemaphores(mDevice, &waitInfo, timeout);
+    if (result == VK_SUCCESS) {
+      mCompleted = std::max(mCompleted, value);
+    } else if (result != VK_TIMEOUT) {
+      VK_REPORT(vkWaitSemaphores(mDevice, &waitInfo, timeout));
+    }
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frTimeline]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frAllocator]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+  }
+
+  frAllocator::frAllocator()
+  {}
+
+  frAllocator::~frAllocator() {
+    cleanup();
+  }
+
+  void frAllocator::initialize(frRenderer *renderer) {
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(renderer->mPhysicalDevice, &properties);
+    mBufferImageGranularity = properties.limits.bufferImageGranularity;
+    mNonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+
+    vkGetPhysicalDeviceMemoryProperties(renderer->mPhysicalDevice, &mMemoryProperties);
+
+    mRenderer = renderer;
+    mDevice = renderer->mDevice;
+  }
+
+  void frAllocator::cleanup() {
+    for (auto block : mBlocks) {
+      if (block->mapped) vkUnmapMemory(mDevice, block->memory);
+      vkFreeMemory(mDevice, block->memory, nullptr);
+      delete block;
+    }
+    mBlocks.clear();
+  }
+
+  frAllocation frAllocator::allocate(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties, bool linear) {
+    uint32_t memoryTypeIndex = mRenderer->FindMemoryType(requirements.memoryTypeBits, properties);
+
+    // Flushes and invalidates are widened to whole atoms, which must not reach into a neighbour's memory.
+    VkMemoryPropertyFlags typeFlags = mMemoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    if ((typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+      requirements.alignment = std::max(requirements.alignment, mNonCoherentAtomSize);
+      requirements.size = AlignUp(requirements.size, mNonCoherentAtomSize);
+    }
+
+    // Linear and optimal resources only need separate blocks when the device demands a granularity.
+    bool separateKinds = mBufferImageGranularity > 1;
+
+    // Small heaps (e.g. 256MiB BAR) would be exhausted by a handful of full-size blocks.
+    VkDeviceSize heapSize = mMemoryProperties.memoryHeaps[mMemoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+    VkDeviceSize blockSize = std::min(mBlockSize, heapSize / 8);
+
+    frAllocation allocation{};
+    if (requirements.size > blockSize / 2) {
+      frMemoryBlock *block = createBlock(memoryTypeIndex, requirements.size, linear, true);
+      allocateFromBlock(block, requirements, &allocation);
+      return allocation;
+    }
+
+    frMemoryBlock *best = nullptr;
+    VkDeviceSize bestSize = std::numeric_limits<VkDeviceSize>::max();
+    for (auto block : mBlocks) {
+      if (block->dedicated || block->memoryTypeIndex != memoryTypeIndex) continue;
+      if (separateKinds && block->linear != linear) continue;
+      if (block->size - block->used < requirements.size) continue;
+
+      for (const auto& range : block->freeRanges) {
+        VkDeviceSize padding = AlignUp(range.offset, requirements.alignment) - range.offset;
+        if (range.size >= requirements.size + padding && range.size < bestSize) {
+          best = block;
+          bestSize = range.size;
+        }
+      }
+    }
+
+    if (!best) best = createBlock(memoryTypeIndex, blockSize, linear, false);
+    if (!allocateFromBlock(best, requirements, &allocation)) {
+      throw fr::frVulkanException("Failed to sub-allocate device memory!");
+    }
+
+    return allocation;
+  }
+
+  void frAllocator::free(frAllocation &allocation) {
+    frMemoryBlock *block = allocation.block;
+    if (!block) return;
+
+    block->used -= allocation.size;
+    block->allocationCount--;
+
+    { // Return range and coalesce with neighbours
+      auto &ranges = block->freeRanges;
+      auto it = std::lower_bound(ranges.begin(), ranges.end(), allocation.offset,
+        [](const frMemoryBlock::frRange &range, VkDeviceSize offset) { return range.offset < offset; });
+      it = ranges.insert(it, frMemoryBlock::frRange{allocation.offset, allocation.size});
+
+      auto next = it + 1;
+      if (next != ranges.end() && it->offset + it->size == next->offset) {
+        it->size += next->size;
+        ranges.erase(next);
+      }
+      if (it != ranges.begin()) {
+        auto prev = it - 1;
+        if (prev->offset + prev->size == it->offset) {
+          prev->size += it->size;
+          ranges.erase(it);
+        }
+      }
+    }
+
+    allocation = frAllocation{};
+
+    if (block->allocationCount > 0) return;
+
+    // Keep one empty block per memory type around to avoid vkAllocateMemory churn.
+    bool keep = !block->dedicated;
+    if (keep) {
+      for (auto other : mBlocks) {
+        if (other != block && !other->dedicated && other->allocationCount == 0 &&
+            other->memoryTypeIndex == block->memoryTypeIndex && other->linear == block->linear) {
+          keep = false;
+          break;
+        }
+      }
+    }
+    if (!keep) destroyBlock(block);
+  }
+
+  void *frAllocator::map(frAllocation &allocation) {
+    frMemoryBlock *block = allocation.block;
+    if (!block->mapped) {
+      VK_WRAPPER(vkMapMemory(mDevice, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped));
+    }
+    block->mapCount++;
+    return static_cast<uint8_t*>(block->mapped) + allocation.offset;
+  }
+
+  void frAllocator::unmap(frAllocation &allocation) {
+    frMemoryBlock *block = allocation.block;
+    if (!block->mapCount || --block->mapCount > 0) return;
+    vkUnmapMemory(mDevice, block->memory);
+    block->mapped = nullptr;
+  }
+
+  void frAllocator::flush(const frAllocation &allocation, VkDeviceSize offset, VkDeviceSize size) {
+    if (isCoherent(allocation)) return;
+    VkMappedMemoryRange range = alignedRange(allocation, offset, size);
+    VK_WRAPPER(vkFlushMappedMemoryRanges(mDevice, 1, &range));
+  }
+
+  void frAllocator::invalidate(const frAllocation &allocation, VkDeviceSize offset, VkDeviceSize size) {
+    if (isCoherent(allocation)) return;
+    VkMappedMemoryRange range = alignedRange(allocation, offset, size);
+    VK_WRAPPER(vkInvalidateMappedMemoryRanges(mDevice, 1, &range));
+  }
+
+  bool frAllocator::isCoherent(const frAllocation &allocation) const {
+    return mMemoryProperties.memoryTypes[allocation.block->memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  }
+
+  std::vector<frAllocator::frBlockStats> frAllocator::getStats() const {
+    std::vector<frBlockStats> stats{};
+    for (auto block : mBlocks) {
+      VkDeviceSize largest = 0;
+      for (const auto& range : block->freeRanges) largest = std::max(largest, range.size);
+
+      stats.push_back(frBlockStats{
+        block->memoryTypeIndex, block->size, block->used,
+        block->allocationCount, static_cast<uint32_t>(block->freeRanges.size()), largest,
+        block->dedicated
+      });
+    }
+    return stats;
+  }
+
+  frMemoryBlock *frAllocator::createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool linear, bool dedicated) {
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    frMemoryBlock *block = new frMemoryBlock();
+    VkResult result = vkAllocateMemory(mDevice, &allocInfo, nullptr, &block->memory);
+    if (result != VK_SUCCESS) {
+      delete block;
+      VK_REPORT(vkAllocateMemory(mDevice, &allocInfo, nullptr, &block->memory));
+    }
+
+    block->size = size;
+    block->memoryTypeIndex = memoryTypeIndex;
+    block->linear = linear;
+    block->dedicated = dedicated;
+    block->freeRanges.push_back(frMemoryBlock::frRange{0, size});
+
+    mBlocks.push_back(block);
+    return block;
+  }
+
+  void frAllocator::destroyBlock(frMemoryBlock *block) {
+    if (block->mapped) vkUnmapMemory(mDevice, block->memory);
+    vkFreeMemory(mDevice, block->memory, nullptr);
+    mBlocks.erase(std::find(mBlocks.begin(), mBlocks.end(), block));
+    delete block;
+  }
+
+  VkMappedMemoryRange frAllocator::alignedRange(const frAllocation &allocation, VkDeviceSize offset, VkDeviceSize size) const {
+    if (size == VK_WHOLE_SIZE) size = allocation.size - offset;
+
+    // Ranges are relative to the whole VkDeviceMemory and must be multiples of nonCoherentAtomSize.
+    VkDeviceSize begin = (allocation.offset + offset) / mNonCoherentAtomSize * mNonCoherentAtomSize;
+    VkDeviceSize end = std::min(AlignUp(allocation.offset + offset + size, mNonCoherentAtomSize), allocation.block->size);
+
+    VkMappedMemoryRange range{};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = allocation.block->memory;
+    range.offset = begin;
+    range.size = end - begin;
+    return range;
+  }
+
+  bool frAllocator::allocateFromBlock(frMemoryBlock *block, VkMemoryRequirements requirements, frAllocation *allocation) {
+    auto &ranges = block->freeRanges;
+
+    size_t best = ranges.size();
+    for (size_t i = 0; i < ranges.size(); ++i) {
+      VkDeviceSize padding = AlignUp(ranges[i].offset, requirements.alignment) - ranges[i].offset;
+      if (ranges[i].size < requirements.size + padding) continue;
+      if (best == ranges.size() || ranges[i].size < ranges[best].size) best = i;
+    }
+    if (best == ranges.size()) return false;
+
+    frMemoryBlock::frRange range = ranges[best];
+    VkDeviceSize offset = AlignUp(range.offset, requirements.alignment);
+    VkDeviceSize end = offset + requirements.size;
+
+    { // Split the range into (padding, allocation, tail)
+      ranges.erase(ranges.begin() + best);
+      auto it = ranges.begin() + best;
+      if (range.offset + range.size > end) it = ranges.insert(it, frMemoryBlock::frRange{end, range.offset + range.size - end});
+      if (offset > range.offset)           ranges.insert(it, frMemoryBlock::frRange{range.offset, offset - range.offset});
+    }
+
+    block->used += requirements.size;
+    block->allocationCount++;
+
+    allocation->block = block;
+    allocation->offset = offset;
+    allocation->size = requirements.size;
+    return true;
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frAllocator]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frBarrierBatch]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frBarrierBatch::frBarrierBatch()
+  {}
+
+  void frBarrierBatch::initialize(frRenderer *renderer) {
+    mRenderer = renderer;
+  }
+
+  // Everything but the subresource range
+  static bool SameImageBarrier(const VkImageMemoryBarrier2 &a, const VkImageMemoryBarrier2 &b) {
+    return a.image == b.image && a.oldLayout == b.oldLayout && a.newLayout == b.newLayout &&
+           a.srcStageMask == b.srcStageMask && a.srcAccessMask == b.srcAccessMask &&
+           a.dstStageMask == b.dstStageMask && a.dstAccessMask == b.dstAccessMask &&
+           a.srcQueueFamilyIndex == b.srcQueueFamilyIndex && a.dstQueueFamilyIndex == b.dstQueueFamilyIndex &&
+           a.subresourceRange.aspectMask == b.subresourceRange.aspectMask;
+  }
+
+  void frBarrierBatch::addImage(VkImage image, VkImageSubresourceRange range, VkImageLayout oldLayout, VkImageLayout newLayout,
+                                VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess,
+                                uint32_t srcQueueFamily, uint32_t dstQueueFamily) {
+    VkImageMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = srcStages;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstStageMask = dstStages;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = srcQueueFamily;
+    barrier.dstQueueFamilyIndex = dstQueueFamily;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+
+    if (!mImageBarriers.empty()) {
+      VkImageSubresourceRange &last = mImageBarriers.back().subresourceRange;
+      if (SameImageBarrier(mImageBarriers.back(), barrier) && last.baseArrayLayer == range.baseArrayLayer &&
+          last.layerCount == range.layerCount && last.baseMipLevel + last.levelCount == range.baseMipLevel) {
+        last.levelCount += range.levelCount;
+        return;
+      }
+    }
+    mImageBarriers.push_back(barrier);
+  }
+
+  void frBarrierBatch::addBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                                 VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess,
+                                 uint32_t srcQueueFamily, uint32_t dstQueueFamily) {
+    VkBufferMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    barrier.srcStageMask = srcStages;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstStageMask = dstStages;
+    barrier.dstAccessMask = dstAccess;
+    barrier.srcQueueFamilyIndex = srcQueueFamily;
+    barrier.dstQueueFamilyIndex = dstQueueFamily;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    mBufferBarriers.push_back(barrier);
+  }
+
+  void frBarrierBatch::addMemory(VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess) {
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = srcStages;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstStageMask = dstStages;
+    barrier.dstAccessMask = dstAccess;
+    mMemoryBarriers.push_back(barrier);
+  }
+
+  void frBarrierBatch::flush(VkCommandBuffer cmdBuf) {
+    if (empty()) return;
+    mergeLayers();
+
+    if (mRenderer->mSynchronization2) {
+      VkDependencyInfo dependency = dependencyInfo();
+      mRenderer->mCmdPipelineBarrier2(cmdBuf, &dependency);
+    } else {
+      std::vector<VkImageMemoryBarrier>  images{};
+      std::vector<VkBufferMemoryBarrier> buffers{};
+      std::vector<VkMemoryBarrier>       memory{};
+      VkPipelineStageFlags srcStages = 0, dstStages = 0;
+      legacyBarriers(images, buffers, memory, srcStages, dstStages);
+
+      vkCmdPipelineBarrier(cmdBuf, srcStages, dstStages, 0,
+        static_cast<uint32_t>(memory.size()), memory.data(),
+        static_cast<uint32_t>(buffers.size()), buffers.data(),
+        static_cast<uint32_t>(images.size()), images.data());
+    }
+
+    clear();
+  }
+
+  void frBarrierBatch::clear() {
+    mImageBarriers.clear();
+    mBufferBarriers.clear();
+    mMemoryBarriers.clear();
+  }
+
+  void frBarrierBatch::mergeLayers() {
+    // addImage() merges mips as they come in, the same mips of consecutive layers are folded here
+    std::vector<VkImageMemoryBarrier2> merged{};
+    for (const auto &barrier : mImageBarriers) {
+      if (!merged.empty()) {
+        VkImageMemoryBarrier2 &last = merged.back();
+        bool same = SameImageBarrier(last, barrier) && last.subresourceRange.baseMipLevel == barrier.subresourceRange.baseMipLevel &&
+                    last.subresourceRange.levelCount == barrier.subresourceRange.levelCount;
+        if (same && last.subresourceRange.baseArrayLayer + last.subresourceRange.layerCount == barrier.subresourceRange.baseArrayLayer) {
+          last.subresourceRange.layerCount += barrier.subresourceRange.layerCount;
+          continue;
+        }
+      }
+      merged.push_back(barrier);
+    }
+    mImageBarriers.swap(merged);
+  }
+
+  VkDependencyInfo frBarrierBatch::dependencyInfo() const {
+    VkDependencyInfo dependency{};
+    dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency.memoryBarrierCount = static_cast<uint32_t>(mMemoryBarriers.size());
+    dependency.pMemoryBarriers = mMemoryBarriers.data();
+    dependency.bufferMemoryBarrierCount = static_cast<uint32_t>(mBufferBarriers.size());
+    dependency.pBufferMemoryBarriers = mBufferBarriers.data();
+    dependency.imageMemoryBarrierCount = static_cast<uint32_t>(mImageBarriers.size());
+    dependency.pImageMemoryBarriers = mImageBarriers.data();
+    return dependency;
+  }
+
+  void frBarrierBatch::legacyBarriers(std::vector<VkImageMemoryBarrier> &images, std::vector<VkBufferMemoryBarrier> &buffers,
+                                      std::vector<VkMemoryBarrier> &memory, VkPipelineStageFlags &srcStages, VkPipelineStageFlags &dstStages) const {
+    // The sync2 bits below 2^32 are the original flags, newer ones have no equivalent without the extension
+    for (const auto &barrier : mImageBarriers) {
+      VkImageMemoryBarrier legacy{};
+      legacy.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      legacy.srcAccessMask = static_cast<VkAccessFlags>(barrier.srcAccessMask);
+      legacy.dstAccessMask = static_cast<VkAccessFlags>(barrier.dstAccessMask);
+      legacy.oldLayout = barrier.oldLayout;
+      legacy.newLayout = barrier.newLayout;
+      legacy.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+      legacy.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+      legacy.image = barrier.image;
+      legacy.subresourceRange = barrier.subresourceRange;
+      images.push_back(legacy);
+      srcStages |= static_cast<VkPipelineStageFlags>(barrier.srcStageMask);
+      dstStages |= static_cast<VkPipelineStageFlags>(barrier.dstStageMask);
+    }
+
+    for (const auto &barrier : mBufferBarriers) {
+      VkBufferMemoryBarrier legacy{};
+      legacy.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      legacy.srcAccessMask = static_cast<VkAccessFlags>(barrier.srcAccessMask);
+      legacy.dstAccessMask = static_cast<VkAccessFlags>(barrier.dstAccessMask);
+      legacy.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+      legacy.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+      legacy.buffer = barrier.buffer;
+      legacy.offset = barrier.offset;
+      legacy.size = barrier.size;
+      buffers.push_back(legacy);
+      srcStages |= static_cast<VkPipelineStageFlags>(barrier.srcStageMask);
+      dstStages |= static_cast<VkPipelineStageFlags>(barrier.dstStageMask);
+    }
+
+    for (const auto &barrier : mMemoryBarriers) {
+      VkMemoryBarrier legacy{};
+      legacy.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      legacy.srcAccessMask = static_cast<VkAccessFlags>(barrier.srcAccessMask);
+      legacy.dstAccessMask = static_cast<VkAccessFlags>(barrier.dstAccessMask);
+      memory.push_back(legacy);
+      srcStages |= static_cast<VkPipelineStageFlags>(barrier.srcStageMask);
+      dstStages |= static_cast<VkPipelineStageFlags>(barrier.dstStageMask);
+    }
+
+    // NONE is valid in sync2 only
+    if (!srcStages) srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    if (!dstStages) dstStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frBarrierBatch]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frSplitBarrier]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frSplitBarrier::frSplitBarrier()
+  {}
+
+  frSplitBarrier::~frSplitBarrier() {
+    cleanup();
+  }
+
+  void frSplitBarrier::initialize(frRenderer *renderer) {
+    mRenderer = renderer;
+    mDevice = renderer->mDevice;
+    mBarriers.initialize(renderer);
+
+    VkEventCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO;
+    createInfo.flags = renderer->mSynchronization2 ? VK_EVENT_CREATE_DEVICE_ONLY_BIT : 0;
+
+    VK_WRAPPER(vkCreateEvent(mDevice, &createInfo, nullptr, &mEvent));
+  }
+
+  void frSplitBarrier::cleanup() {
+    if (!mEvent) return;
+    vkDestroyEvent(mDevice, mEvent, nullptr);
+    mEvent = VK_NULL_HANDLE;
+  }
+
+  void frSplitBarrier::release(VkCommandBuffer cmdBuf) {
+    if (mReleased) throw fr::frVulkanException("Split barrier released twice without an acquire!");
+    mBarriers.mergeLayers();
+
+    if (mRenderer->mSynchronization2) {
+      VkDependencyInfo dependency = mBarriers.dependencyInfo();
+      mRenderer->mCmdSetEvent2(cmdBuf, mEvent, &dependency);
+    } else {
+      std::vector<VkImageMemoryBarrier>  images{};
+      std::vector<VkBufferMemoryBarrier> buffers{};
+      std::vector<VkMemoryBarrier>       memory{};
+      VkPipelineStageFlags srcStages = 0, dstStages = 0;
+      mBarriers.legacyBarriers(images, buffers, memory, srcStages, dstStages);
+
+      vkCmdSetEvent(cmdBuf, mEvent, srcStages);
+    }
+    mReleased = true;
+  }
+
+  void frSplitBarrier::acquire(VkCommandBuffer cmdBuf) {
+    if (!mReleased) throw fr::frVulkanException("Split barrier acquired before it was released!");
+
+    if (mRenderer->mSynchronization2) {
+      // Has to be the exact dependency the event was set with
+      VkDependencyInfo dependency = mBarriers.dependencyInfo();
+      mRenderer->mCmdWaitEvents2(cmdBuf, 1, &mEvent, &dependency);
+
+      VkPipelineStageFlags2 dstStages = 0;
+      for (const auto &barrier : mBarriers.mImageBarriers)  dstStages |= barrier.dstStageMask;
+      for (const auto &barrier : mBarriers.mBufferBarriers) dstStages |= barrier.dstStageMask;
+      for (const auto &barrier : mBarriers.mMemoryBarriers) dstStages |= barrier.dstStageMask;
+      mRenderer->mCmdResetEvent2(cmdBuf, mEvent, dstStages ? dstStages : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+    } else {
+      std::vector<VkImageMemoryBarrier>  images{};
+      std::vector<VkBufferMemoryBarrier> buffers{};
+      std::vector<VkMemoryBarrier>       memory{};
+      VkPipelineStageFlags srcStages = 0, dstStages = 0;
+      mBarriers.legacyBarriers(images, buffers, memory, srcStages, dstStages);
+
+      vkCmdWaitEvents(cmdBuf, 1, &mEvent, srcStages, dstStages,
+        static_cast<uint32_t>(memory.size()), memory.data(),
+        static_cast<uint32_t>(buffers.size()), buffers.data(),
+        static_cast<uint32_t>(images.size()), images.data());
+      vkCmdResetEvent(cmdBuf, mEvent, dstStages);
+    }
+
+    mBarriers.clear();
+    mReleased = false;
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frSplitBarrier]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frBuffer]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frBuffer::frBuffer()
+  {}
+
+  frBuffer::~frBuffer() {
+    cleanup();
+  }
+
+  void frBuffer::copyData(VkDeviceSize offset, VkDeviceSize size, void *data) {
+    if (mMapped) {
+      memcpy(mMapped + offset, data, size);
+      mAllocator->flush(mAllocation, offset, size);
+      return;
+    }
+
+    uint8_t *bufData = static_cast<uint8_t*>(mAllocator->map(mAllocation));
+      memcpy(bufData + offset, data, size);
+      mAllocator->flush(mAllocation, offset, size);
+    mAllocator->unmap(mAllocation);
+  }
+
+  void frBuffer::flush(VkDeviceSize offset, VkDeviceSize size) {
+    mAllocator->flush(mAllocation, offset, size);
+  }
+
+  void frBuffer::invalidate(VkDeviceSize offset, VkDeviceSize size) {
+    mAllocator->invalidate(mAllocation, offset, size);
+  }
+
+  void frBuffer::copyFromBuffer(frRenderer *renderer, frCommands *commands, frBuffer *buffer, VkDeviceSize size) {
+    VkCommandBuffer cmdBuf = commands->getSingleTime();
+
+    copyFromBuffer(cmdBuf, buffer->mBuffer, 0, 0, size);
+
+    // Later commands (possibly in the same batched single-time buffer) see the copy
+    frBarrierBatch batch{};
+    batch.initialize(renderer);
+    barrier(batch, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT, 0, size);
+    batch.flush(cmdBuf);
+
+    if (!commands->singleTimeFrameActive()) commands->endSingleTime(renderer, cmdBuf);
+  }
+
+  void frBuffer::copyFromBuffer(VkCommandBuffer cmdBuf, VkBuffer buffer, VkDeviceSize srcOffset, VkDeviceSize dstOffset, VkDeviceSize size) {
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = dstOffset;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(cmdBuf, buffer, mBuffer, 1, &copyRegion);
+  }
+
+  void frBuffer::barrier(frBarrierBatch &batch, VkPipelineStageFlags2 srcStages, VkAccessFlags2 srcAccess,
+                         VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess, VkDeviceSize offset, VkDeviceSize size) {
+    batch.addBuffer(mBuffer, offset, size, srcStages, srcAccess, dstStages, dstAccess);
+  }
+
+  void frBuffer::initialize(frRenderer *renderer, frBufferInfo info, bool bindMemory) {
+    renderer->CreateBuffer(info.size, info.usage, info.properties, mBuffer, bindMemory ? &mAllocation : VK_NULL_HANDLE); // Create mBuffer and if (if bindMemory == true) { bind mAllocation }
+
+    mAllocator = &renderer->mAllocator;
+    mDevice = renderer->mDevice;
+    mSize = info.size;
+
+    if (info.persistentMap && bindMemory) mMapped = static_cast<uint8_t*>(mAllocator->map(mAllocation));
+  }
+
+  void frBuffer::cleanup() {
+    if (mMapped) {
+      mAllocator->unmap(mAllocation);
+      mMapped = nullptr;
+    }
+    if (mBuffer) vkDestroyBuffer(mDevice, mBuffer, VK_NULL_HANDLE);
+    mBuffer = VK_NULL_HANDLE;
+    if (mAllocator) mAllocator->free(mAllocation);
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frBuffer]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frRingBuffer]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frRingBuffer::frRingBuffer()
+  {}
+
+  frRingBuffer::~frRingBuffer() {
+    cleanup();
+  }
+
+  void frRingBuffer::initialize(frRenderer *renderer, VkDeviceSize size, VkBufferUsageFlags usage) {
+    mBuffer.initialize(renderer, frBuffer::frBufferInfo{
+      size, static_cast<VkBufferUsageFlagBits>(usage),
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, {},
+      true
+    });
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(renderer->mPhysicalDevice, &properties);
+    mAlignment = 16;
+    if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) mAlignment = std::max(mAlignment, properties.limits.minUniformBufferOffsetAlignment);
+    if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) mAlignment = std::max(mAlignment, properties.limits.minStorageBufferOffsetAlignment);
+
+    mSize = size;
+    mHead = mTail = mUsed = mFrameUsed = 0;
+    mRegions.clear();
+    mCurrentSync = nullptr;
+  }
+
+  void frRingBuffer::cleanup() {
+    mBuffer.cleanup();
+  }
+
+  void frRingBuffer::beginFrame(frSynchronization *sync) {
+    if (mCurrentSync) mRegions.push_back(frFrameRegion{mCurrentSync, mCurrentSync->value(), mHead, mFrameUsed});
+
+    if (sync->isTimeline()) { // Every region carries a timeline value, retire all that completed
+      retire(sync->getTimeline()->completedValue());
+      mCurrentSync = sync;
+      mFrameUsed = 0;
+      return;
+    }
+
+    // Frames retire in submission order, so everything up to the last region of `sync` is done.
+    size_t retired = 0;
+    for (size_t i = 0; i < mRegions.size(); ++i) {
+      if (mRegions[i].sync == sync) retired = i + 1;
+    }
+    retireRegions(retired);
+
+    mCurrentSync = sync;
+    mFrameUsed = 0;
+  }
+
+  void frRingBuffer::closeRegion(uint64_t value) {
+    mRegions.push_back(frFrameRegion{nullptr, value, mHead, mFrameUsed});
+    mFrameUsed = 0;
+  }
+
+  void frRingBuffer::retire(uint64_t completedValue) {
+    size_t retired = 0;
+    while (retired < mRegions.size() && mRegions[retired].value <= completedValue) retired++;
+    retireRegions(retired);
+  }
+
+  void frRingBuffer::retireRegions(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      mTail = mRegions[i].end;
+      mUsed -= mRegions[i].used;
+    }
+    mRegions.erase(mRegions.begin(), mRegions.begin() + count);
+
+    if (mUsed == 0) mHead = mTail = 0;
+  }
+
+  frRingAllocation frRingBuffer::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+    frRingAllocation allocation{};
+    if (!tryAllocate(size, alignment, &allocation)) {
+      throw fr::frVulkanException("Ring buffer exhausted, increase its size or frames in flight recycle too late!");
+    }
+    return allocation;
+  }
+
+  bool frRingBuffer::tryAllocate(VkDeviceSize size, VkDeviceSize alignment, frRingAllocation *allocation) {
+    alignment = std::max(alignment, mAlignment);
+
+    VkDeviceSize offset = AlignUp(mHead, alignment);
+    bool fits = false;
+    if (mUsed == 0 || mHead > mTail) {
+      if (offset + size <= mSize) {
+        fits = true;
+      } else if (size <= mTail || mUsed == 0) { // Wrap around, skipping the end of the buffer
+        offset = 0;
+        fits = size <= (mUsed == 0 ? mSize : mTail);
+      }
+    } else {
+      fits = offset + size <= mTail;
+    }
+
+    if (!fits) return false;
+
+    VkDeviceSize consumed = offset >= mHead ? offset + size - mHead : (mSize - mHead) + offset + size;
+    mUsed += consumed;
+    mFrameUsed += consumed;
+    mHead = offset + size;
+
+    *allocation = frRingAllocation{mBuffer.get(), offset, mBuffer.mapped<uint8_t>(offset)};
+    return true;
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frRingBuffer]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frTextureFile]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  // Bytes of one layer of a `width` x `height` level, 0 for formats .frtex files don't hold
+  static VkDeviceSize TextureLevelSize(VkFormat format, uint32_t width, uint32_t height) {
+    if (uint32_t blockSize = BlockSize(format)) {
+      return static_cast<VkDeviceSize>((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+    }
+
+    switch (format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+      return static_cast<VkDeviceSize>(width) * height * 4;
+    default: return 0;
+    }
+  }
+
+  frTextureFile::frTextureFile() {}
+
+  frTextureFile::~frTextureFile() {
+    cleanup();
+  }
+
+  bool frTextureFile::initialize(const char *path) {
+    cleanup();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    mFile = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) { cleanup(); return false; }
+    mSize = static_cast<size_t>(fileSize.QuadPart);
+
+    mFileMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mFileMapping) { cleanup(); return false; }
+    mMapping = static_cast<const uint8_t*>(MapViewOfFile(mFileMapping, FILE_MAP_READ, 0, 0, 0));
+    if (!mMapping) { cleanup(); return false; }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); return false; }
+    mSize = static_cast<size_t>(st.st_size);
+
+    void *mapping = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file referenced
+    if (mapping == MAP_FAILED) { mSize = 0; return false; }
+    mMapping = static_cast<const uint8_t*>(mapping);
+#endif
+
+    if (mSize < sizeof(frTextureHeader)) { cleanup(); return false; }
+    mHeader = reinterpret_cast<const frTextureHeader*>(mMapping);
+    mLevels = reinterpret_cast<const frTextureLevel*>(mMapping + sizeof(frTextureHeader));
+
+    const frTextureHeader &h = *mHeader;
+    if (h.magic != FR_TEXTURE_MAGIC || h.version != FR_TEXTURE_VERSION ||
+        h.width == 0 || h.height == 0 || h.mipLevels == 0 || h.mipLevels > 32 || h.layers == 0 ||
+        sizeof(frTextureHeader) + h.mipLevels * sizeof(frTextureLevel) > h.dataOffset ||
+        h.dataOffset > mSize || h.dataSize > mSize - h.dataOffset) {
+      cleanup();
+      return false;
+    }
+    if (TextureLevelSize(static_cast<VkFormat>(h.format), 1, 1) == 0 || (h.flags & ~uint32_t(FR_TEXTURE_CUBE)) ||
+        h.mipLevels > static_cast<uint32_t>(std::floor(std::log2(std::max(h.width, h.height)))) + 1 ||
+        ((h.flags & FR_TEXTURE_CUBE) && (h.layers % 6 != 0 || h.width != h.height))) {
+      cleanup();
+      return false;
+    }
+    for (uint32_t mip = 0; mip < h.mipLevels; ++mip) {
+      // The copy regions read every layer of the level tightly packed, a short level would read past the data
+      VkDeviceSize expected = TextureLevelSize(static_cast<VkFormat>(h.format), std::max(1u, h.width >> mip), std::max(1u, h.height >> mip)) * h.layers;
+      if (mLevels[mip].offset > h.dataSize || mLevels[mip].size > h.dataSize - mLevels[mip].offset || mLevels[mip].size < expected) {
+        cleanup();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void frTextureFile::cleanup() {
+#ifdef _WIN32
+    if (mMapping) UnmapViewOfFile(mMapping);
+    if (mFileMapping) CloseHandle(mFileMapping);
+    if (mFile) CloseHandle(mFile);
+    mFileMapping = nullptr;
+    mFile = nullptr;
+#else
+    if (mMapping) munmap(const_cast<uint8_t*>(mMapping), mSize);
+#endif
+    mMapping = nullptr;
+    mSize = 0;
+    mHeader = nullptr;
+    mLevels = nullptr;
+  }
+
+  frImage::frImageInfo frTextureFile::imageInfo(VkImageUsageFlags usage, uint32_t firstMip) const {
+    frImage::frImageInfo info{};
+    info.width = static_cast<int>(std::max(1u, mHeader->width >> firstMip));
+    info.height = static_cast<int>(std::max(1u, mHeader->height >> firstMip));
+    info.layers = static_cast<int>(mHeader->layers);
+    info.format = format();
+    info.usage = static_cast<VkImageUsageFlagBits>(usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    info.memory = true;
+    info.memoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    info.mipLevels = mHeader->mipLevels - firstMip;
+    info.cube = (mHeader->flags & FR_TEXTURE_CUBE) != 0;
+    return info;
+  }
+
+  std::vector<frImage::frCopyRegion> frTextureFile::regions(uint32_t firstMip) const {
+    std::vector<frImage::frCopyRegion> regions(mHeader->mipLevels - firstMip);
+    for (uint32_t mip = firstMip; mip < mHeader->mipLevels; ++mip) {
+      frImage::frCopyRegion &region = regions[mip - firstMip];
+      region.mip = mip - firstMip;
+      region.offset = mLevels[mip].offset - mLevels[firstMip].offset;
+      region.layerCount = mHeader->layers;
+    }
+    return regions;
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frTextureFile]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frUploadManager]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frUploadManager::frUploadManager()
+  {}
+
+  frUploadManager::~frUploadManager() {
+    cleanup();
+  }
+
+  void frUploadManager::initialize(frRenderer *renderer, VkDeviceSize stagingSize) {
+    mStaging.initialize(renderer, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    mDedicatedTransfer = renderer->hasDedicatedTransferQueue();
+    mBarriers.initialize(renderer);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = renderer->mTransferQueueFamily;
+    VK_WRAPPER(vkCreateCommandPool(renderer->mDevice, &poolInfo, nullptr, &mPool));
+
+    if (mDedicatedTransfer) {
+      poolInfo.queueFamilyIndex = renderer->mGraphicsQueueFamily;
+      VK_WRAPPER(vkCreateCommandPool(renderer->mDevice, &poolInfo, nullptr, &mAcquirePool));
+    }
+
+    mTimeline = renderer->getTimeline();
+    mRenderer = renderer;
+    mDevice = renderer->mDevice;
+  }
+
+  void frUploadManager::cleanup() {
+    if (!mDevice) return;
+
+    wait(flush());
+
+    for (auto batch : mFreeBatches) {
+      if (batch->fence) vkDestroyFence(mDevice, batch->fence, nullptr);
+      if (batch->transferDone) vkDestroySemaphore(mDevice, batch->transferDone, nullptr);
+      delete batch;
+    }
+    mFreeBatches.clear();
+
+    vkDestroyCommandPool(mDevice, mPool, nullptr);
+    if (mAcquirePool) vkDestroyCommandPool(mDevice, mAcquirePool, nullptr);
+    mStaging.cleanup();
+    mDevice = VK_NULL_HANDLE;
+  }
+
+  frUploadToken frUploadManager::uploadBuffer(frBuffer *dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size) {
+    frStagingAllocation staging = stage(size);
+    memcpy(staging.data, data, size);
+
+    dst->copyFromBuffer(getCommandBuffer(), staging.buffer, staging.offset, dstOffset, size);
+
+    if (mDedicatedTransfer) { // Release on the transfer queue, acquire on the graphics queue
+      uint32_t transferFamily = mRenderer->mTransferQueueFamily;
+      uint32_t graphicsFamily = mRenderer->mGraphicsQueueFamily;
+
+      mBarriers.addBuffer(dst->get(), dstOffset, size,
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+        transferFamily, graphicsFamily);
+      mBarriers.flush(mCurrent->cmdBuf);
+
+      mBarriers.addBuffer(dst->get(), dstOffset, size,
+        VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT,
+        transferFamily, graphicsFamily);
+      mBarriers.flush(mCurrent->acquireCmdBuf);
+    }
+    return mNextToken;
+  }
+
+  frUploadToken frUploadManager::uploadImage(frImage *dst, const void *data, VkDeviceSize size, uint32_t layer, VkImageLayout finalLayout) {
+    return uploadImage(dst, data, size, std::vector<frImage::frCopyRegion>{ frImage::frCopyRegion{ 0, layer, 0 } }, finalLayout);
+  }
+
+  frUploadToken frUploadManager::uploadImage(frImage *dst, const void *data, VkDeviceSize size,
+                                             const std::vector<frImage::frCopyRegion> &regions, VkImageLayout finalLayout) {
+    frStagingAllocation staging = stage(size);
+    memcpy(staging.data, data, size);
+
+    std::vector<frImage::frCopyRegion> stagedRegions = regions;
+    for (auto &region : stagedRegions) region.offset += staging.offset;
+
+    return uploadImageFromBuffer(dst, staging.buffer, stagedRegions, finalLayout);
+  }
+
+  frUploadToken frUploadManager::uploadImageFromBuffer(frImage *dst, VkBuffer src, const std::vector<frImage::frCopyRegion> &regions,
+                                                       VkImageLayout finalLayout) {
+    // Only the subresources the regions replace change layout, the rest of the image keeps its contents and state
+    std::vector<frImage::frSubresourceRange> ranges{};
+    for (const auto &region : regions) ranges.push_back(frImage::frSubresourceRange{ region.mip, 1, region.layer, region.layerCount });
+
+    VkCommandBuffer cmdBuf = getCommandBuffer();
+    if (mDedicatedTransfer) { // Stages tracked on the graphics queue mean nothing here, the queues are ordered by semaphores
+      for (const auto &range : ranges) {
+        dst->transitionLayout(cmdBuf, frImage::frImageTransitionInfo{
+          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+          0, VK_ACCESS_TRANSFER_WRITE_BIT
+        }, range);
+      }
+    } else { // Whole mips are copied, their old contents can be discarded
+      for (const auto &range : ranges) dst->require(FR_IMAGE_USAGE_TRANSFER_DST, range, true);
+      dst->flushBarriers(cmdBuf);
+    }
+    dst->copyFromBuffer(cmdBuf, src, regions);
+
+    if (mDedicatedTransfer) { // The layout change happens once, between release and acquire
+      uint32_t transferFamily = mRenderer->mTransferQueueFamily;
+      uint32_t graphicsFamily = mRenderer->mGraphicsQueueFamily;
+      for (const auto &range : ranges) {
+        dst->transitionLayout(cmdBuf, frImage::frImageTransitionInfo{
+          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, finalLayout,
+          VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+          VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+          transferFamily, graphicsFamily
+        }, range);
+        dst->transitionLayout(mCurrent->acquireCmdBuf, frImage::frImageTransitionInfo{
+          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, finalLayout,
+          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+          0, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+          transferFamily, graphicsFamily
+        }, range);
+      }
+    } else if (finalLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+      for (const auto &range : ranges) {
+        dst->require(frImage::frImageAccess{ finalLayout, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT }, range);
+      }
+      dst->flushBarriers(cmdBuf);
+    }
+    return mNextToken;
+  }
+
+  frUploadToken frUploadManager::uploadTexture(frImage *dst, const frTextureFile &file, VkImageLayout finalLayout) {
+    return uploadImage(dst, file.data(), file.dataSize(), file.regions(), finalLayout);
+  }
+
+  frUploadToken frUploadManager::updateImage(frImage *dst, const void *data, uint32_t texelSize, uint32_t rowLength, VkRect2D rect,
+                                             uint32_t mip, uint32_t layer, frImageUsage finalUsage) {
+    // Nothing to copy, and `rows - 1` below must not wrap. Like flush() without work, the last submitted batch
+    if (rect.extent.width == 0 || rect.extent.height == 0) return mNextToken - 1;
+
+    uint32_t blockDim = BlockSize(dst->getFormat()) ? 4 : 1; // BC data is addressed in 4x4 blocks of `texelSize` bytes
+    uint32_t pitch = ((rowLength ? rowLength : rect.extent.width) + blockDim - 1) / blockDim;
+    uint32_t columns = (rect.extent.width + blockDim - 1) / blockDim;
+    uint32_t rows = (rect.extent.height + blockDim - 1) / blockDim;
+    VkDeviceSize size = (static_cast<VkDeviceSize>(pitch) * (rows - 1) + columns) * texelSize;
+
+    frStagingAllocation staging = stage(size, std::max<VkDeviceSize>(16, texelSize));
+    memcpy(staging.data, data, size);
+
+    // Keeps the texture on the graphics queue, no ownership transfer and only this subresource changes layout
+    VkCommandBuffer cmdBuf = getGraphicsCommandBuffer();
+    frImage::frSubresourceRange range{ mip, 1, layer, 1 };
+    dst->transition(cmdBuf, FR_IMAGE_USAGE_TRANSFER_DST, range);
+    dst->copyRectFromBuffer(cmdBuf, staging.buffer, staging.offset, rowLength, rect, mip, layer);
+    dst->transition(cmdBuf, finalUsage, range);
+
+    return mNextToken;
+  }
+
+  frUploadManager::frStagingAllocation frUploadManager::stage(VkDeviceSize size, VkDeviceSize alignment) {
+    frRingAllocation allocation{};
+    if (size <= mStaging.size()) {
+      // Ring is full: submit what we have and wait for the oldest batches to hand memory back.
+      while (!mStaging.tryAllocate(size, alignment, &allocation)) {
+        if (mCurrent) flush();
+        if (mInFlight.empty()) break;
+        wait(mInFlight.front()->token);
+      }
+    }
+
+    if (allocation.data) return frStagingAllocation{allocation.buffer, allocation.offset, allocation.data};
+
+    frBuffer *overflow = new frBuffer();
+    overflow->initialize(mRenderer, frBuffer::frBufferInfo{
+      size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, {},
+      true
+    });
+    getCommandBuffer();
+    mCurrent->overflowBuffers.push_back(overflow);
+
+    return frStagingAllocation{overflow->get(), 0, overflow->mapped()};
+  }
+
+  VkCommandBuffer frUploadManager::getCommandBuffer() {
+    if (!mCurrent) {
+      mCurrent = acquireBatch();
+      mCurrent->token = mNextToken;
+      frCommands::begin(mCurrent->cmdBuf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+      if (mDedicatedTransfer) frCommands::begin(mCurrent->acquireCmdBuf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    }
+    return mCurrent->cmdBuf;
+  }
+
+  VkCommandBuffer frUploadManager::getGraphicsCommandBuffer() {
+    getCommandBuffer();
+    return mDedicatedTransfer ? mCurrent->acquireCmdBuf : mCurrent->cmdBuf;
+  }
+
+  frUploadToken frUploadManager::flush() {
+    if (!mCurrent) return mNextToken - 1;
+
+    VkCommandBuffer graphicsCmdBuf = mDedicatedTransfer ? mCurrent->acquireCmdBuf : mCurrent->cmdBuf;
+    // Make every transfer write of the batch visible to whatever runs after it on the graphics queue
+    mBarriers.addMemory(VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT);
+    mBarriers.flush(graphicsCmdBuf);
+
+    if (mDedicatedTransfer) {
+      frCommands::end(mCurrent->cmdBuf);
+
+      frSubmission transfer{};
+      transfer.commandBuffers.push_back(mCurrent->cmdBuf);
+      transfer.signal(mCurrent->transferDone);
+      mRenderer->mSubmitQueue.submit(mRenderer->mTransferQueue, std::move(transfer));
+    }
+
+    frCommands::end(graphicsCmdBuf);
+
+    frSubmission submission{};
+    submission.commandBuffers.push_back(graphicsCmdBuf);
+    if (mDedicatedTransfer) submission.wait(mCurrent->transferDone, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+    // Completion is signaled on the graphics queue either way, keeping the renderer timeline monotonic
+    if (mTimeline) {
+      mCurrent->timelineValue = mTimeline->next();
+      submission.signal(mTimeline->get(), mCurrent->timelineValue);
+    }
+    mRenderer->mSubmitQueue.submit(mRenderer->mGraphicsQueue, std::move(submission), mCurrent->fence);
+
+    mStaging.closeRegion(mCurrent->token);
+    mInFlight.push_back(mCurrent);
+    mCurrent = nullptr;
+
+    return mNextToken++;
+  }
+
+  bool frUploadManager::isComplete(frUploadToken token) {
+    poll();
+    return token <= mCompletedToken;
+  }
+
+  void frUploadManager::wait(frUploadToken token) {
+    if (mCurrent && token >= mCurrent->token) flush();
+
+    for (auto batch : mInFlight) {
+      if (batch->token > token) break;
+      if (mTimeline) {
+        mTimeline->wait(batch->timelineValue);
+      } else {
+        VK_WRAPPER(vkWaitForFences(mDevice, 1, &batch->fence, VK_TRUE, UINT64_MAX));
+      }
+    }
+    poll();
+  }
+
+  frUploadManager::frUploadBatch *frUploadManager::acquireBatch() {
+    poll();
+
+    if (!mFreeBatches.empty()) {
+      frUploadBatch *batch = mFreeBatches.back();
+      mFreeBatches.pop_back();
+      if (batch->fence) VK_WRAPPER(vkResetFences(mDevice, 1, &batch->fence));
+      VK_WRAPPER(vkResetCommandBuffer(batch->cmdBuf, 0));
+      if (batch->acquireCmdBuf) VK_WRAPPER(vkResetCommandBuffer(batch->acquireCmdBuf, 0));
+      return batch;
+    }
+
+    frUploadBatch *batch = new frUploadBatch();
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = mPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    VK_WRAPPER(vkAllocateCommandBuffers(mDevice, &allocInfo, &batch->cmdBuf));
+
+    if (mDedicatedTransfer) {
+      allocInfo.commandPool = mAcquirePool;
+      VK_WRAPPER(vkAllocateCommandBuffers(mDevice, &allocInfo, &batch->acquireCmdBuf));
+
+      VkSemaphoreCreateInfo semaphoreInfo{};
+      semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+      VK_WRAPPER(vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &batch->transferDone));
+    }
+
+    if (!mTimeline) {
+      VkFenceCreateInfo fenceInfo{};
+      fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+      VK_WRAPPER(vkCreateFence(mDevice, &fenceInfo, nullptr, &batch->fence));
+    }
+
+    return batch;
+  }
+
+  bool frUploadManager::isDone(frUploadBatch *batch) {
+    if (mTimeline) return mTimeline->isComplete(batch->timelineValue);
+    return vkGetFenceStatus(mDevice, batch->fence) == VK_SUCCESS;
+  }
+
+  void frUploadManager::poll() {
+    // Batches complete in submission order, stop at the first one still executing.
+    size_t completed = 0;
+    for (auto batch : mInFlight) {
+      if (!isDone(batch)) break;
+
+      for (auto buffer : batch->overflowBuffers) delete buffer;
+      batch->overflowBuffers.clear();
+
+      mCompletedToken = batch->token;
+      mFreeBatches.push_back(batch);
+      completed++;
+    }
+    mInFlight.erase(mInFlight.begin(), mInFlight.begin() + completed);
+
+    mStaging.retire(mCompletedToken);
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frUploadManager]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frThreadPool]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  // Pool and index of the worker running on this thread, lets parallelFor tell it was called from a job
+  static thread_local const frThreadPool *tPool = nullptr;
+  static thread_local uint32_t            tWorker = 0;
+
+  frThreadPool::frThreadPool()
+  {}
+
+  frThreadPool::~frThreadPool() {
+    cleanup();
+  }
+
+  void frThreadPool::initialize(uint32_t threadCount) {
+    if (threadCount == 0) {
+      uint32_t hardware = std::thread::hardware_concurrency();
+      threadCount = hardware > 1 ? hardware - 1 : 1;
+    }
+
+    mStopping = false;
+    for (uint32_t i = 0; i < threadCount; ++i) mThreads.emplace_back(&frThreadPool::workerLoop, this, i);
+  }
+
+  void frThreadPool::cleanup() {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStopping = true;
+    }
+    mJobAvailable.notify_all();
+
+    for (auto &thread : mThreads) thread.join();
+    mThreads.clear();
+    mJobs.clear();
+  }
+
+  void frThreadPool::submit(std::function<void(uint32_t worker)> job) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mJobs.push_back(std::move(job));
+    }
+    mJobAvailable.notify_one();
+  }
+
+  void frThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mIdle.wait(lock, [this] { return mJobs.empty() && mRunning == 0; });
+
+    if (mError) {
+      std::exception_ptr error = mError;
+      mError = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+  void frThreadPool::parallelFor(uint32_t count, std::function<void(uint32_t index, uint32_t worker)> job) {
+    if (count == 0) return;
+
+    struct frParallelBatch {
+      std::mutex              mutex;
+      std::condition_variable done;
+      uint32_t                next = 0;
+      uint32_t                count;
+      uint32_t                remaining;
+      std::exception_ptr      error = nullptr;
+    };
+    // Shared, runners still queued once every index is done only find nothing left to claim
+    auto batch = std::make_shared<frParallelBatch>();
+    batch->count = count;
+    batch->remaining = count;
+
+    auto run = [batch, &job](uint32_t worker) {
+      for (;;) {
+        uint32_t index = 0;
+        {
+          std::lock_guard<std::mutex> lock(batch->mutex);
+          if (batch->next == batch->count) return;
+          index = batch->next++;
+        }
+
+        std::exception_ptr error = nullptr;
+        try {
+          job(index, worker);
+        } catch (...) {
+          error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        if (error && !batch->error) batch->error = error;
+        if (--batch->remaining == 0) batch->done.notify_all();
+      }
+    };
+
+    uint32_t runners = std::min(count, threadCount());
+    for (uint32_t i = 0; i < runners; ++i) submit(run);
+
+    // Called from one of our jobs, e.g. a texture loader job: every worker could end up blocked here with the
+    // indices still queued behind them, so claim them on this thread under its own worker index instead.
+    if (tPool == this) run(tWorker);
+
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->done.wait(lock, [&batch] { return batch->remaining == 0; });
+    if (batch->error) std::rethrow_exception(batch->error);
+  }
+
+  void frThreadPool::workerLoop(uint32_t worker) {
+    tPool = this;
+    tWorker = worker;
+
+    for (;;) {
+      std::function<void(uint32_t)> job;
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mJobAvailable.wait(lock, [this] { return mStopping || !mJobs.empty(); });
+        if (mStopping && mJobs.empty()) return;
+
+        job = std::move(mJobs.front());
+        mJobs.pop_front();
+        mRunning++;
+      }
+
+      std::exception_ptr error = nullptr;
+      try {
+        job(worker);
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (error && !mError) mError = error;
+        mRunning--;
+        if (mJobs.empty() && mRunning == 0) mIdle.notify_all();
+      }
+    }
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frThreadPool]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frTextureLoader]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  // Staging memory is usually write-combined, every kernel writes whole texels front to back.
+#if defined(FR_SSSE3) || defined(FR_SSSE3_DISPATCH)
+  static bool HasSSSE3() {
+#if defined(FR_SSSE3)
+    return true;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+  }
+
+  // Returns how many texels it expanded, the caller finishes the rest
+  FR_TARGET_SSSE3 static size_t ExpandRGBSSSE3(const uint8_t *src, uint8_t *dst, size_t count) {
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4) { // Loads 16 bytes for 12, stay clear of the end
+      __m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+    }
+    return i;
+  }
+#endif
+
+  static void ExpandRGB(const uint8_t *src, uint8_t *dst, size_t count) {
+    size_t i = 0;
+#if defined(FR_SSSE3) || defined(FR_SSSE3_DISPATCH)
+    static const bool ssse3 = HasSSSE3();
+    if (ssse3) i = ExpandRGBSSSE3(src, dst, count);
+#elif defined(FR_NEON)
+    for (; i + 16 <= count; i += 16) {
+      uint8x16x3_t rgb = vld3q_u8(src + i * 3);
+      uint8x16x4_t rgba;
+      rgba.val[0] = rgb.val[0];
+      rgba.val[1] = rgb.val[1];
+      rgba.val[2] = rgb.val[2];
+      rgba.val[3] = vdupq_n_u8(255);
+      vst4q_u8(dst + i * 4, rgba);
+    }
+#endif
+    for (; i < count; ++i) {
+      dst[i * 4 + 0] = src[i * 3 + 0];
+      dst[i * 4 + 1] = src[i * 3 + 1];
+      dst[i * 4 + 2] = src[i * 3 + 2];
+      dst[i * 4 + 3] = 255;
+    }
+  }
+
+  static void ConvertToRGBA(const uint8_t *src, int channels, uint8_t *dst, size_t count) {
+    switch (channels) {
+    case 4: memcpy(dst, src, count * 4); break;
+    case 3: ExpandRGB(src, dst, count); break;
+    case 2:
+      for (size_t i = 0; i < count; ++i) {
+        dst[i * 4 + 0] = dst[i * 4 + 1] = dst[i * 4 + 2] = src[i * 2];
+        dst[i * 4 + 3] = src[i * 2 + 1];
+      }
+      break;
+    default:
+      for (size_t i = 0; i < count; ++i) {
+        dst[i * 4 + 0] = dst[i * 4 + 1] = dst[i * 4 + 2] = src[i];
+        dst[i * 4 + 3] = 255;
+      }
+      break;
+    }
+  }
+
+  // Exact round(c * a / 255) on UNORM data, in place
+  static void PremultiplyAlpha(uint8_t *rgba, size_t count) {
+    size_t i = 0;
+#if defined(FR_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    const __m128i opaque = _mm_set1_epi16(255);
+    const __m128i bias = _mm_set1_epi16(128);
+    auto premultiply = [&](__m128i texels) { // Two texels, 16 bits per channel
+      __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(texels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+      alpha = _mm_or_si128(_mm_andnot_si128(alphaLanes, alpha), _mm_and_si128(alphaLanes, opaque)); // Alpha times 255 keeps itself
+      __m128i t = _mm_add_epi16(_mm_mullo_epi16(texels, alpha), bias);
+      return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    };
+    for (; i + 4 <= count; i += 4) {
+      __m128i texels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + i * 4));
+      __m128i lo = premultiply(_mm_unpacklo_epi8(texels, zero));
+      __m128i hi = premultiply(_mm_unpackhi_epi8(texels, zero));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(FR_NEON)
+    for (; i + 16 <= count; i += 16) {
+      uint8x16x4_t texels = vld4q_u8(rgba + i * 4);
+      for (int c = 0; c < 3; ++c) {
+        uint16x8_t lo = vmull_u8(vget_low_u8(texels.val[c]), vget_low_u8(texels.val[3]));
+        uint16x8_t hi = vmull_u8(vget_high_u8(texels.val[c]), vget_high_u8(texels.val[3]));
+        texels.val[c] = vcombine_u8(vrshrn_n_u16(vrsraq_n_u16(lo, lo, 8), 8), vrshrn_n_u16(vrsraq_n_u16(hi, hi, 8), 8));
+      }
+      vst4q_u8(rgba + i * 4, texels);
+    }
+#endif
+    for (; i < count; ++i) {
+      uint32_t alpha = rgba[i * 4 + 3];
+      for (int c = 0; c < 3; ++c) {
+        uint32_t t = rgba[i * 4 + c] * alpha + 128;
+        rgba[i * 4 + c] = static_cast<uint8_t>((t + (t >> 8)) >> 8);
+      }
+    }
+  }
+
+  // Decodes to linear, multiplies and encodes again, the tables keep it to lookups per channel
+  static void PremultiplyAlphaSrgb(uint8_t *rgba, size_t count) {
+    struct frSrgbTables {
+      float   toLinear[256];
+      uint8_t toSrgb[4096];
+    };
+    static const frSrgbTables tables = [] {
+      frSrgbTables t{};
+      for (int i = 0; i < 256; ++i) {
+        float c = i / 255.0f;
+        t.toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+      }
+      for (int i = 0; i < 4096; ++i) {
+        float c = i / 4095.0f;
+        c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+        t.toSrgb[i] = static_cast<uint8_t>(c * 255.0f + 0.5f);
+      }
+      return t;
+    }();
+
+    for (size_t i = 0; i < count; ++i) {
+      float alpha = rgba[i * 4 + 3] * (4095.0f / 255.0f);
+      for (int c = 0; c < 3; ++c) {
+        rgba[i * 4 + c] = tables.toSrgb[static_cast<uint32_t>(tables.toLinear[rgba[i * 4 + c]] * alpha + 0.5f)];
+      }
+    }
+  }
+
+  frTextureLoader::frTextureLoader()
+  {}
+
+  frTextureLoader::~frTextureLoader() {
+    cleanup();
+  }
+
+  void frTextureLoader::initialize(frRenderer *renderer, frUploadManager *uploader, frThreadPool *threads, frImageDecoder decoder,
+                                   VkDeviceSize stagingSize) {
+    mRenderer = renderer;
+    mUploader = uploader;
+    mThreads = threads;
+    mDecoder = decoder;
+
+    mStaging.initialize(renderer, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    mStagingSequence = 0;
+  }
+
+  void frTextureLoader::cleanup() {
+    if (!mRenderer) return;
+
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mDecodeDone.wait(lock, [this] { return mDecoding == 0; });
+    }
+    for (auto &use : mStagingUses) {
+      if (use.second) mUploader->wait(use.second);
+    }
+
+    for (auto &request : mRequests) delete request.image;
+    mRequests.clear();
+    mDecoded.clear();
+    mStagingUses.clear();
+    mPending = 0;
+
+    mStaging.cleanup();
+    mRenderer = nullptr;
+  }
+
+  frTextureHandle frTextureLoader::load(const char *path, frTextureLoadInfo info) {
+    frTextureHandle handle;
+    frTextureRequest *request;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      handle = static_cast<frTextureHandle>(mRequests.size());
+      mRequests.emplace_back();
+      request = &mRequests.back(); // Deque elements stay put while others are appended
+      request->path = path;
+      request->info = info;
+      mDecoding++;
+    }
+    mPending++;
+
+    mThreads->submit([this, request](uint32_t) { decode(request); });
+    return handle;
+  }
+
+  void frTextureLoader::decode(frTextureRequest *request) {
+    bool decoded = false;
+    try {
+      int width = 0, height = 0, channels = 0;
+      uint8_t *pixels = mDecoder.decode(request->path.c_str(), &width, &height, &channels);
+      if (pixels && width > 0 && height > 0 && channels >= 1 && channels <= 4) {
+        size_t count = static_cast<size_t>(width) * height;
+        VkDeviceSize size = count * 4;
+
+        frRingAllocation staging{};
+        uint64_t sequence = 0;
+        {
+          std::lock_guard<std::mutex> lock(mMutex);
+          if (mStaging.tryAllocate(size, 16, &staging)) { // One region per allocation, retired by sequence
+            sequence = ++mStagingSequence;
+            mStaging.closeRegion(sequence);
+            mStagingUses[sequence] = 0;
+          }
+        }
+
+        uint8_t *dst = staging.as<uint8_t>();
+        if (!dst) { // Ring full (or image larger than it), the upload manager stages a copy later
+          request->pixels.resize(size);
+          dst = request->pixels.data();
+        }
+        ConvertToRGBA(pixels, channels, dst, count);
+        if (request->info.premultiplyAlpha) {
+          if (request->info.srgb) PremultiplyAlphaSrgb(dst, count);
+          else                    PremultiplyAlpha(dst, count);
+        }
+
+        request->width = static_cast<uint32_t>(width);
+        request->height = static_cast<uint32_t>(height);
+        request->staging = staging;
+        request->stagingSequence = sequence;
+        decoded = true;
+      }
+      if (pixels) mDecoder.release(pixels);
+    } catch (...) { // A throwing decoder only fails its own request
+      decoded = false;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      request->state = decoded ? FR_REQUEST_DECODED : FR_REQUEST_FAILED;
+      mDecoded.push_back(request);
+      mDecoding--;
+    }
+    mDecodeDone.notify_all();
+  }
+
+  uint32_t frTextureLoader::update() {
+    retireStaging();
+
+    std::vector<frTextureRequest*> decoded;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      decoded.swap(mDecoded);
+    }
+    if (decoded.empty()) return 0;
+
+    std::vector<frTextureRequest*> recorded;
+    for (frTextureRequest *request : decoded) {
+      mPending--;
+      if (request->state == FR_REQUEST_FAILED) continue;
+
+      const frTextureLoadInfo &info = request->info;
+      VkImageUsageFlags usage = info.usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+      if (info.generateMipmaps) usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+      frImage *image = new frImage();
+      image->initialize(mRenderer, frImage::frImageInfo{
+        static_cast<int>(request->width), static_cast<int>(request->height), 1,
+        info.srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM,
+        static_cast<VkImageUsageFlagBits>(usage),
+        true, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        VK_IMAGE_ASPECT_COLOR_BIT, info.generateMipmaps
+      });
+
+      VkImageLayout layout = info.generateMipmaps ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      if (request->staging.data) {
+        frUploadToken token = mUploader->uploadImageFromBuffer(image, request->staging.buffer,
+          std::vector<frImage::frCopyRegion>{ frImage::frCopyRegion{ 0, 0, request->staging.offset } }, layout);
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStagingUses[request->stagingSequence] = token;
+      } else {
+        mUploader->uploadImage(image, request->pixels.data(), request->pixels.size(), 0, layout);
+        std::vector<uint8_t>().swap(request->pixels);
+      }
+      if (info.generateMipmaps) image->generateMipmaps(mRenderer, mUploader->getGraphicsCommandBuffer());
+
+      request->image = image;
+      recorded.push_back(request);
+    }
+
+    if (!recorded.empty()) mUploader->flush();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (frTextureRequest *request : recorded) request->state = FR_REQUEST_READY;
+    return static_cast<uint32_t>(recorded.size());
+  }
+
+  void frTextureLoader::finish() {
+    update();
+    while (mPending > 0) {
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDecodeDone.wait(lock, [this] { return !mDecoded.empty(); });
+      }
+      update();
+    }
+  }
+
+  void frTextureLoader::retireStaging() {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // Allocations retire in order, one whose copy isn't recorded yet holds back the ones after it
+    uint64_t retired = 0;
+    while (!mStagingUses.empty()) {
+      auto use = mStagingUses.begin();
+      if (use->second == 0 || !mUploader->isComplete(use->second)) break;
+      retired = use->first;
+      mStagingUses.erase(use);
+    }
+    if (retired) mStaging.retire(retired);
+  }
+
+  bool frTextureLoader::isReady(frTextureHandle handle) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mRequests[handle].state == FR_REQUEST_READY;
+  }
+
+  bool frTextureLoader::hasFailed(frTextureHandle handle) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mRequests[handle].state == FR_REQUEST_FAILED;
+  }
+
+  frImage *frTextureLoader::takeImage(frTextureHandle handle) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    frTextureRequest &request = mRequests[handle];
+    if (request.state != FR_REQUEST_READY) return nullptr;
+
+    frImage *image = request.image;
+    request.image = nullptr;
+    return image;
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frTextureLoader]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frTextureStreamer]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  static const uint32_t kStreamingTailSize = 64; // Mips this size or smaller never leave memory
+
+  frStreamingTexture::frStreamingTexture()
+  {}
+
+  frStreamingTexture::~frStreamingTexture() {
+    cleanup();
+  }
+
+  bool frStreamingTexture::initialize(frRenderer *renderer, const char *path, VkImageUsageFlags usage) {
+    if (!mFile.initialize(path)) return false;
+
+    mRenderer = renderer;
+    mUsage = usage;
+
+    const frTextureHeader &header = mFile.header();
+    uint32_t size = std::max(header.width, header.height);
+    mTailMip = 0;
+    while (mTailMip + 1 < header.mipLevels && (size >> mTailMip) > kStreamingTailSize) mTailMip++;
+
+    mResidentMip = mPendingMip = mTailMip;
+    mRequestedMip = ~0u;
+    mDesiredMip = mTailMip;
+    mVersion = 0;
+    return true;
+  }
+
+  void frStreamingTexture::cleanup() {
+    if (!mRenderer) return;
+
+    // Frames in flight may still sample the image and the replacement may still be uploading
+    frImage *image = mImage, *pending = mPending;
+    mRenderer->deferDeletion([image, pending]() {
+      delete image;
+      delete pending;
+    });
+    mImage = mPending = nullptr;
+
+    mFile.cleanup();
+    mRenderer = nullptr;
+  }
+
+  void frStreamingTexture::requestMip(uint32_t mip) {
+    mRequestedMip = std::min(mRequestedMip, mip);
+  }
+
+  uint32_t frStreamingTexture::mipForDistance(uint32_t textureSize, float worldSize, float distance, float fovY, uint32_t viewportHeight) {
+    if (distance <= 0.0f || worldSize <= 0.0f) return 0;
+
+    float pixels = worldSize * static_cast<float>(viewportHeight) / (2.0f * distance * std::tan(fovY * 0.5f));
+    if (pixels >= static_cast<float>(textureSize)) return 0;
+    return static_cast<uint32_t>(std::floor(std::log2(static_cast<float>(textureSize) / std::max(pixels, 1.0f))));
+  }
+
+  frTextureStreamer::frTextureStreamer()
+  {}
+
+  frTextureStreamer::~frTextureStreamer() {
+    cleanup();
+  }
+
+  void frTextureStreamer::initialize(frRenderer *renderer, frUploadManager *uploader, VkDeviceSize budget,
+                                     VkDeviceSize uploadBytesPerUpdate) {
+    mRenderer = renderer;
+    mUploader = uploader;
+    mBudget = budget;
+    mUploadBytesPerUpdate = uploadBytesPerUpdate;
+  }
+
+  void frTextureStreamer::cleanup() {
+    if (!mRenderer) return;
+
+    if (mStarted) mUploader->flush();
+    mStarted = false;
+    mTextures.clear();
+    mRenderer = nullptr;
+  }
+
+  void frTextureStreamer::add(frStreamingTexture *texture) {
+    mTextures.push_back(texture);
+    if (!texture->mImage && !texture->mPending) startTransition(texture, texture->mTailMip);
+  }
+
+  void frTextureStreamer::remove(frStreamingTexture *texture) {
+    mTextures.erase(std::remove(mTextures.begin(), mTextures.end(), texture), mTextures.end());
+  }
+
+  VkDeviceSize frTextureStreamer::targetBytes(const frStreamingTexture *texture) {
+    return texture->mFile.dataSize(texture->mPending ? texture->mPendingMip : texture->mResidentMip);
+  }
+
+  VkDeviceSize frTextureStreamer::committedBytes() const {
+    VkDeviceSize committed = 0;
+    for (const frStreamingTexture *texture : mTextures) committed += targetBytes(texture);
+    return committed;
+  }
+
+  uint32_t frTextureStreamer::update() {
+    uint32_t changed = 0;
+    for (frStreamingTexture *texture : mTextures) {
+      if (texture->mPending && mUploader->isComplete(texture->mPendingToken)) {
+        frImage *previous = texture->mImage;
+        if (previous) mRenderer->deferDeletion([previous]() { delete previous; });
+
+        texture->mImage = texture->mPending;
+        texture->mResidentMip = texture->mPendingMip;
+        texture->mPending = nullptr;
+        texture->mVersion++;
+        changed++;
+      }
+
+      texture->mDesiredMip = std::min(texture->mRequestedMip, texture->mTailMip);
+      texture->mRequestedMip = ~0u;
+    }
+
+    // The budget covers what textures are headed for, an old image and its replacement overlap briefly
+    VkDeviceSize committed = committedBytes();
+
+    if (committed > mBudget) { // Drop mips where they are least needed: most resolution beyond the request first
+      std::vector<frStreamingTexture*> candidates;
+      for (frStreamingTexture *texture : mTextures) {
+        if (texture->mImage && !texture->mPending && texture->mResidentMip < texture->mTailMip) candidates.push_back(texture);
+      }
+      std::sort(candidates.begin(), candidates.end(), [](const frStreamingTexture *a, const frStreamingTexture *b) {
+        return static_cast<int64_t>(a->mResidentMip) - a->mDesiredMip < static_cast<int64_t>(b->mResidentMip) - b->mDesiredMip;
+      });
+
+      for (frStreamingTexture *texture : candidates) {
+        if (committed <= mBudget) break;
+        uint32_t mip = texture->mResidentMip + 1;
+        committed -= texture->mFile.dataSize(texture->mResidentMip) - texture->mFile.dataSize(mip);
+        startTransition(texture, mip);
+      }
+    } else { // Sharpen the textures furthest from their request first, within budget and upload allowance
+      std::vector<frStreamingTexture*> candidates;
+      for (frStreamingTexture *texture : mTextures) {
+        if (texture->mImage && !texture->mPending && texture->mDesiredMip < texture->mResidentMip) candidates.push_back(texture);
+      }
+      std::sort(candidates.begin(), candidates.end(), [](const frStreamingTexture *a, const frStreamingTexture *b) {
+        return a->mResidentMip - a->mDesiredMip > b->mResidentMip - b->mDesiredMip;
+      });
+
+      VkDeviceSize uploaded = 0;
+      for (frStreamingTexture *texture : candidates) {
+        uint32_t mip = texture->mResidentMip - 1;
+        VkDeviceSize size = texture->mFile.dataSize(mip);
+        VkDeviceSize growth = size - texture->mFile.dataSize(texture->mResidentMip);
+
+        if (committed + growth > mBudget) continue; // A smaller texture may still fit
+        if (uploaded > 0 && uploaded + size > mUploadBytesPerUpdate) break;
+
+        committed += growth;
+        uploaded += size;
+        startTransition(texture, mip);
+      }
+    }
+
+    if (mStarted) mUploader->flush();
+    mStarted = false;
+    return changed;
+  }
+
+  void frTextureStreamer::startTransition(frStreamingTexture *texture, uint32_t mip) {
+    const frTextureFile &file = texture->mFile;
+
+    frImage *image = new frImage();
+    image->initialize(mRenderer, file.imageInfo(texture->mUsage, mip));
+    texture->mPendingToken = mUploader->uploadImage(image, file.data(mip), file.dataSize(mip), file.regions(mip));
+    texture->mPending = image;
+    texture->mPendingMip = mip;
+    mStarted = true;
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frTextureStreamer]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frFrameManager]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frFrameManager::frFrameManager()
+  {}
+
+  frFrameManager::~frFrameManager() {
+    cleanup();
+  }
+
+  void frFrameManager::initialize(frRenderer *renderer, uint32_t framesInFlight, frThreadPool *threads) {
+    mRenderer = renderer;
+    mDevice = renderer->mDevice;
+    mThreads = threads;
+    mThreadSlots = 1 + (threads ? threads->threadCount() : 0);
+
+    framesInFlight = std::max(framesInFlight, 1u);
+    mFrames.resize(framesInFlight);
+    mPools.resize(framesInFlight * mThreadSlots);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = renderer->mGraphicsQueueFamily;
+
+    for (auto &pool : mPools) VK_WRAPPER(vkCreateCommandPool(mDevice, &poolInfo, nullptr, &pool.pool));
+
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+      VkCommandBufferAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = mPools[i * mThreadSlots].pool;
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      allocInfo.commandBufferCount = 1;
+      VK_WRAPPER(vkAllocateCommandBuffers(mDevice, &allocInfo, &mFrames[i].cmdBuf));
+
+      mFrames[i].index = i;
+      mFrames[i].sync = new frSynchronization();
+      mFrames[i].sync->initialize(renderer);
+    }
+
+    mFrameIndex = 0;
+  }
+
+  void frFrameManager::cleanup() {
+    if (!mDevice) return;
+
+    for (auto &frame : mFrames) frame.sync->wait();
+
+    for (auto &frame : mFrames) delete frame.sync;
+    for (auto &pool : mPools) vkDestroyCommandPool(mDevice, pool.pool, nullptr);
+    mFrames.clear();
+    mPools.clear();
+    mImagesInFlight.clear();
+    mDevice = VK_NULL_HANDLE;
+  }
+
+  frFrame *frFrameManager::beginFrame(frSwapchain *swapchain) {
+    frFrame &frame = mFrames[mFrameIndex];
+    frame.sync->wait();
+    mRenderer->collectDeletions(); // Keyed on this fence without timelines
+
+    frame.imageIndex = mRenderer->acquireNextImage(swapchain, frame.sync);
+
+    // With more images than frames an image can come back while an older frame still renders to it.
+    if (mImagesInFlight.size() != swapchain->imageCount()) mImagesInFlight.assign(swapchain->imageCount(), nullptr);
+    frSynchronization *&imageSync = mImagesInFlight[frame.imageIndex];
+    if (imageSync && imageSync != frame.sync) imageSync->wait();
+    imageSync = frame.sync;
+
+    frame.sync->reset();
+    if (frRingBuffer *ring = mRenderer->getRingBuffer()) ring->beginFrame(frame.sync);
+
+    for (uint32_t thread = 0; thread < mThreadSlots; ++thread) {
+      frFramePool &pool = mPools[mFrameIndex * mThreadSlots + thread];
+      VK_WRAPPER(vkResetCommandPool(mDevice, pool.pool, 0));
+      pool.used[0] = pool.used[1] = 0;
+    }
+    frCommands::begin(frame.cmdBuf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+    return &frame;
+  }
+
+  void frFrameManager::endFrame(frSwapchain *swapchain) {
+    frFrame &frame = mFrames[mFrameIndex];
+
+    frCommands::end(frame.cmdBuf);
+
+    // Everything of the frame goes out in one vkQueueSubmit, the frame's own buffer last
+    frSubmitQueue &queue = mRenderer->mSubmitQueue;
+    for (auto &submission : mSubmissions) queue.add(mRenderer->mGraphicsQueue, std::move(submission));
+    mSubmissions.clear();
+
+    frSubmission submission{};
+    submission.commandBuffers.push_back(frame.cmdBuf);
+    VkFence fence = frame.sync->attach(submission);
+    queue.add(mRenderer->mGraphicsQueue, std::move(submission));
+    queue.flush(mRenderer->mGraphicsQueue, fence);
+
+    // Advance before presenting, a resize exception from present must not resubmit this slot.
+    mFrameIndex = (mFrameIndex + 1) % framesInFlight();
+
+    mRenderer->present(swapchain, frame.sync, &frame.imageIndex);
+  }
+
+  VkCommandBuffer frFrameManager::allocateCommandBuffer(VkCommandBufferLevel level, uint32_t thread) {
+    frFramePool &pool = mPools[mFrameIndex * mThreadSlots + thread];
+    std::vector<VkCommandBuffer> &buffers = pool.buffers[level];
+    uint32_t &used = pool.used[level];
+
+    if (used == buffers.size()) {
+      VkCommandBufferAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = pool.pool;
+      allocInfo.level = level;
+      allocInfo.commandBufferCount = 1;
+
+      VkCommandBuffer cmdBuf = VK_NULL_HANDLE;
+      VK_WRAPPER(vkAllocateCommandBuffers(mDevice, &allocInfo, &cmdBuf));
+      buffers.push_back(cmdBuf);
+    }
+
+    return buffers[used++];
+  }
+
+  void frFrameManager::recordParallel(frRenderPass *renderPass, frFramebuffer *framebuffer, uint32_t subpass, uint32_t taskCount,
+                                      std::function<void(VkCommandBuffer cmdBuf, uint32_t task)> record) {
+    if (taskCount == 0) return;
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass->mRenderPass;
+    inheritanceInfo.subpass = subpass;
+    inheritanceInfo.framebuffer = framebuffer ? framebuffer->mFramebuffer : VK_NULL_HANDLE;
+
+    std::vector<VkFormat> colorFormats{};
+    VkCommandBufferInheritanceRenderingInfo renderingInfo{};
+    if (renderPass->mDynamicRendering) { // Secondaries inherit the formats of vkCmdBeginRendering instead
+      renderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+      renderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+      for (auto &ref : renderPass->mColorRefs) {
+        bool used = ref.attachment != VK_ATTACHMENT_UNUSED;
+        colorFormats.push_back(used ? renderPass->mAttachments[ref.attachment].format : VK_FORMAT_UNDEFINED);
+        if (used) renderingInfo.rasterizationSamples = renderPass->mAttachments[ref.attachment].samples;
+      }
+      renderingInfo.colorAttachmentCount = static_cast<uint32_t>(colorFormats.size());
+      renderingInfo.pColorAttachmentFormats = colorFormats.data();
+      if (renderPass->mDepthRef.attachment != VK_ATTACHMENT_UNUSED) {
+        const VkAttachmentDescription &depth = renderPass->mAttachments[renderPass->mDepthRef.attachment];
+        if (depth.format != VK_FORMAT_S8_UINT) renderingInfo.depthAttachmentFormat = depth.format;
+        if (FormatHasStencil(depth.format)) renderingInfo.stencilAttachmentFormat = depth.format;
+        renderingInfo.rasterizationSamples = depth.samples;
+      }
+
+      inheritanceInfo.pNext = &renderingInfo;
+      inheritanceInfo.renderPass = VK_NULL_HANDLE;
+      inheritanceInfo.subpass = 0;
+      inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+    }
+
+    std::vector<VkCommandBuffer> secondaries(taskCount, VK_NULL_HANDLE);
+    auto recordTask = [&](uint32_t task, uint32_t thread) {
+      VkCommandBuffer cmdBuf = allocateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_SECONDARY, thread);
+
+      VkCommandBufferBeginInfo beginInfo{};
+      beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+      beginInfo.pInheritanceInfo = &inheritanceInfo;
+      VK_WRAPPER(vkBeginCommandBuffer(cmdBuf, &beginInfo));
+
+      record(cmdBuf, task);
+
+      frCommands::end(cmdBuf);
+      secondaries[task] = cmdBuf;
+    };
+
+    if (mThreads && taskCount > 1) {
+      // Each worker only ever touches its own pool, so no pool is used from two threads at once.
+      mThreads->parallelFor(taskCount, [&](uint32_t task, uint32_t worker) { recordTask(task, worker + 1); });
+    } else {
+      for (uint32_t task = 0; task < taskCount; ++task) recordTask(task, 0);
+    }
+
+    vkCmdExecuteCommands(mFrames[mFrameIndex].cmdBuf, taskCount, secondaries.data());
+  }
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frFrameManager]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frRenderGraph]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  static const VkAccessFlags kWriteAccessMask =
+    VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+  struct frGraphUsageInfo {
+    VkPipelineStageFlags stages;
+    VkAccessFlags        access;
+    VkImageLayout        layout;
+    VkImageUsageFlags    imageUsage;
+  };
+
+  static frGraphUsageInfo GraphUsageInfo(frGraphUsage usage, bool write) {
+    const VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    switch (usage) {
+    case FR_GRAPH_COLOR_ATTACHMENT:
+      return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+               VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | (write ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : 0u),
+               VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT };
+    case FR_GRAPH_DEPTH_ATTACHMENT:
+      return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | (write ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : 0u),
+               write ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+               VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT };
+    case FR_GRAPH_RESOLVE_ATTACHMENT:
+      return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+               VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT };
+    case FR_GRAPH_SAMPLED:
+      return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT };
+    case FR_GRAPH_STORAGE_READ:
+      return { shaderStages, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT };
+    case FR_GRAPH_STORAGE_WRITE:
+      return { shaderStages, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT };
+    case FR_GRAPH_TRANSFER_SRC:
+      return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT };
+    case FR_GRAPH_TRANSFER_DST:
+      return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT };
+    case FR_GRAPH_VERTEX_BUFFER:
+      return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+    case FR_GRAPH_INDEX_BUFFER:
+      return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+    case FR_GRAPH_UNIFORM_BUFFER:
+      return { shaderStages, VK_ACCESS_UNIFORM_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+    case FR_GRAPH_INDIRECT_BUFFER:
+      return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+    }
+
+    return { VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, 0 };
+  }
+
+  frGraphResource frGraphPassBuilder::createImage(const char *name, frGraphImageInfo info) {
+    frRenderGraph::frGraphResourceData resource{};
+    resource.name = name;
+    resource.info = info;
+    mGraph->mResources.push_back(resource);
+    return static_cast<frGraphResource>(mGraph->mResources.size() - 1);
+  }
+
+  void frGraphPassBuilder::read(frGraphResource resource, frGraphUsage usage) {
+    mGraph->mPasses[mPass].accesses.push_back({ resource, usage, false });
+  }
+
+  void frGraphPassBuilder::write(frGraphResource resource, frGraphUsage usage, bool discard) {
+    frRenderGraph::frGraphAccess access{ resource, usage, true };
+    access.discard = discard;
+    mGraph->mPasses[mPass].accesses.push_back(access);
+  }
+
+  void frGraphPassBuilder::colorAttachment(frGraphResource image, VkAttachmentLoadOp loadOp, VkClearValue clear) {
+    mGraph->mPasses[mPass].accesses.push_back({ image, FR_GRAPH_COLOR_ATTACHMENT, true, true, loadOp, clear });
+  }
+
+  void frGraphPassBuilder::depthAttachment(frGraphResource image, VkAttachmentLoadOp loadOp, VkClearValue clear) {
+    mGraph->mPasses[mPass].accesses.push_back({ image, FR_GRAPH_DEPTH_ATTACHMENT, true, true, loadOp, clear });
+  }
+
+  void frGraphPassBuilder::resolveAttachment(frGraphResource image) {
+    mGraph->mPasses[mPass].accesses.push_back({ image, FR_GRAPH_RESOLVE_ATTACHMENT, true, true, VK_ATTACHMENT_LOAD_OP_DONT_CARE });
+  }
+
+  void frGraphPassBuilder::secondaryCommandBuffers() {
+    mGraph->mPasses[mPass].secondaries = true;
+  }
+
+  void frGraphPassBuilder::sideEffects() {
+    mGraph->mPasses[mPass].sideEffects = true;
+  }
+
+  frRenderGraph::frRenderGraph()
+  {}
+
+  frRenderGraph::~frRenderGraph() {
+    cleanup();
+  }
+
+  void frRenderGraph::initialize(frRenderer *renderer) {
+    mRenderer = renderer;
+    mDevice = renderer->mDevice;
+    mBarriers.initialize(renderer);
+  }
+
+  void frRenderGraph::cleanup() {
+    if (!mDevice) return;
+    reset();
+    mDevice = VK_NULL_HANDLE;
+  }
+
+  frGraphResource frRenderGraph::importImage(const char *name, frImage *image, VkImageLayout initialLayout, VkImageLayout finalLayout) {
+    frGraphResourceData resource{};
+    resource.name = name;
+    resource.imported = true;
+    resource.imageHandle = image;
+    resource.initialLayout = initialLayout;
+    resource.finalLayout = finalLayout;
+    mResources.push_back(resource);
+    return static_cast<frGraphResource>(mResources.size() - 1);
+  }
+
+  frGraphResource frRenderGraph::importBuffer(const char *name, frBuffer *buffer) {
+    frGraphResourceData resource{};
+    resource.name = name;
+    resource.image = false;
+    resource.imported = true;
+    resource.bufferHandle = buffer;
+    mResources.push_back(resource);
+    return static_cast<frGraphResource>(mResources.size() - 1);
+  }
+
+  void frRenderGraph::setImage(frGraphResource resource, frImage *image) {
+    if (!mResources[resource].imported) throw fr::frVulkanException("Only imported render graph images can be replaced!");
+    mResources[resource].imageHandle = image;
+  }
+
+  void frRenderGraph::markOutput(frGraphResource resource) {
+    mResources[resource].output = true;
+  }
+
+  void frRenderGraph::addPass(const char *name, std::function<void(frGraphPassBuilder &builder)> setup, std::function<void(VkCommandBuffer cmdBuf)> execute) {
+    frGraphPass pass{};
+    pass.name = name;
+    pass.execute = execute;
+    mPasses.push_back(pass);
+
+    frGraphPassBuilder builder(this, static_cast<uint32_t>(mPasses.size() - 1));
+    setup(builder);
+  }
+
+  void frRenderGraph::compile() {
+    releaseCompiled();
+
+    cull();
+    createTransients();
+    computeBarriers();
+    createRenderPasses();
+
+    mCompiled = true;
+  }
+
+  void frRenderGraph::execute(VkCommandBuffer cmdBuf) {
+    if (!mCompiled) compile();
+
+    for (auto &pass : mPasses) {
+      if (pass.culled) continue;
+
+      recordBarriers(cmdBuf, pass.barriers);
+
+      if (!pass.renderPass) {
+        pass.execute(cmdBuf);
+        continue;
+      }
+
+      mCurrentRenderPass = pass.renderPass;
+      mCurrentFramebuffer = getFramebuffer(pass);
+
+      frImage *first = mResources[pass.attachments[0]].imageHandle;
+      pass.renderPass->begin(cmdBuf, first->getExtent(), mCurrentFramebuffer, pass.clearValues,
+        pass.secondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+      pass.execute(cmdBuf);
+      pass.renderPass->end(cmdBuf);
+
+      mCurrentRenderPass = nullptr;
+      mCurrentFramebuffer = nullptr;
+    }
+
+    recordBarriers(cmdBuf, mFinalBarriers);
+
+    // Keep the image's own tracking in sync for work recorded after the graph
+    for (const auto &resource : mResources) {
+      if (!resource.imported || !resource.image || resource.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED) continue;
+      resource.imageHandle->setState(frImage::frImageAccess{ resource.finalLayout, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0 });
+    }
+  }
+
+  void frRenderGraph::reset() {
+    releaseCompiled();
+    mResources.clear();
+    mPasses.clear();
+  }
+
+  void frRenderGraph::releaseCompiled() {
+    for (auto &pass : mPasses) {
+      for (auto &framebuffer : pass.framebuffers) delete framebuffer.second;
+      delete pass.renderPass;
+
+      pass.framebuffers.clear();
+      pass.renderPass = nullptr;
+      pass.attachments.clear();
+      pass.clearValues.clear();
+      pass.barriers = frGraphBarrierBatch{};
+      pass.culled = false;
+    }
+
+    for (auto image : mTransientImages) delete image;
+    mTransientImages.clear();
+
+    for (auto &slot : mAliasSlots) mRenderer->mAllocator.free(slot.allocation);
+    mAliasSlots.clear();
+
+    for (auto &resource : mResources) {
+      if (!resource.imported) resource.imageHandle = nullptr;
+      resource.usage = 0;
+      resource.live = false;
+      resource.firstPass = UINT32_MAX;
+      resource.lastPass = 0;
+      resource.aliasSlot = -1;
+    }
+
+    mFinalBarriers = frGraphBarrierBatch{};
+    mCulledPasses = 0;
+    mTransientMemory = 0;
+    mCompiled = false;
   }
 
-  VkCommandBuffer *frCommands::allocateBuffers(VkCommandBufferLevel level, uint32_t count) {
-    VkCommandBuffer *buffers = (VkCommandBuffer*)malloc(sizeof(VkCommandBuffer) * count);
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = mPool;
-    allocInfo.level = level;
-    allocInfo.commandBufferCount = count;
-    VK_WRAPPER(vkAllocateCommandBuffers(mDevice, &allocInfo, buffers));
+  void frRenderGraph::cull() {
+    // Walk backwards: a pass survives if something still needs a resource it writes
+    std::vector<bool> needed(mResources.size(), false);
+    for (size_t i = 0; i < mResources.size(); ++i) needed[i] = mResources[i].imported || mResources[i].output;
 
-    return buffers;
-  }
+    for (size_t p = mPasses.size(); p-- > 0;) {
+      frGraphPass &pass = mPasses[p];
 
-  void frCommands::beginSingleTimeFrame() {
-    if (mSingleTimeCommandBuf) return;
+      bool live = pass.sideEffects;
+      for (const auto &access : pass.accesses) {
+        if (access.write && needed[access.resource]) live = true;
+      }
 
-    mSingleTimeCommandBuf = beginSingleTime();
-  }
+      pass.culled = !live;
+      if (!live) {
+        mCulledPasses++;
+        continue;
+      }
 
-  void frCommands::endSingleTimeFrame(frRenderer *renderer) {
-    if (!mSingleTimeCommandBuf) return;
-    endSingleTime(renderer, mSingleTimeCommandBuf);
-    mSingleTimeCommandBuf = VK_NULL_HANDLE;
+      // Anything this pass overwrites completely does not need earlier writers, unless read in between.
+      // Other writes (storage, transfer, loaded attachments) may only update parts and keep them needed.
+      for (const auto &access : pass.accesses) {
+        if (access.overwrites() && !mResources[access.resource].imported && !mResources[access.resource].output) {
+          needed[access.resource] = false;
+        }
+      }
+      for (const auto &access : pass.accesses) {
+        if (!access.overwrites()) needed[access.resource] = true;
+      }
+    }
   }
 
-  VkCommandBuffer frCommands::beginSingleTime() {
-    VkCommandBuffer cmdBuf = allocateBuffers(VK_COMMAND_BUFFER_LEVEL_PRIMARY)[0];
-    frCommands::begin(cmdBuf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-    return cmdBuf;
-  }
-  
-  void frCommands::endSingleTime(frRenderer *renderer, VkCommandBuffer cmdBuf) {
-    frCommands::end(cmdBuf);
+  void frRenderGraph::createTransients() {
+    for (uint32_t p = 0; p < mPasses.size(); ++p) {
+      if (mPasses[p].culled) continue;
+
+      for (const auto &access : mPasses[p].accesses) {
+        frGraphResourceData &resource = mResources[access.resource];
+        resource.live = true;
+        resource.firstPass = std::min(resource.firstPass, p);
+        resource.lastPass = std::max(resource.lastPass, p);
+        resource.usage |= GraphUsageInfo(access.usage, access.write).imageUsage;
+      }
+    }
+
+    std::vector<frGraphResource> transients{};
+    for (uint32_t i = 0; i < mResources.size(); ++i) {
+      frGraphResourceData &resource = mResources[i];
+      if (resource.imported || !resource.live) continue;
+
+      frImage *image = new frImage();
+      image->initialize(mRenderer, frImage::frImageInfo{
+        static_cast<int>(resource.info.width), static_cast<int>(resource.info.height), 1,
+        resource.info.format, static_cast<VkImageUsageFlagBits>(resource.usage),
+        false, 0,
+        resource.info.aspect, false, 1,
+        resource.info.samples
+      });
+      resource.imageHandle = image;
+      mTransientImages.push_back(image);
+      transients.push_back(i);
+    }
 
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmdBuf;
+    // Greedy interval packing: reuse the tightest slot whose previous occupant is dead by our first use
+    std::sort(transients.begin(), transients.end(), [this](frGraphResource a, frGraphResource b) {
+      return mResources[a].firstPass < mResources[b].firstPass;
+    });
 
-    vkQueueSubmit(renderer->mGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(renderer->mGraphicsQueue);
+    for (auto id : transients) {
+      frGraphResourceData &resource = mResources[id];
+      VkMemoryRequirements requirements = resource.imageHandle->getMemoryRequirements();
 
-    vkFreeCommandBuffers(mDevice, mPool, 1, &cmdBuf);
+      int32_t best = -1;
+      for (int32_t s = 0; s < static_cast<int32_t>(mAliasSlots.size()); ++s) {
+        const frAliasSlot &slot = mAliasSlots[s];
+        if (slot.lastPass >= resource.firstPass) continue;
+        if (!(slot.requirements.memoryTypeBits & requirements.memoryTypeBits)) continue;
+
+        if (best < 0) {
+          best = s;
+          continue;
+        }
+
+        // Prefer slots that already fit, then the one that grows the least
+        VkDeviceSize bestSize = mAliasSlots[best].requirements.size, size = slot.requirements.size;
+        bool fits = size >= requirements.size, bestFits = bestSize >= requirements.size;
+        if ((fits && (!bestFits || size < bestSize)) || (!fits && !bestFits && size > bestSize)) best = s;
+      }
+
+      if (best < 0) {
+        mAliasSlots.push_back(frAliasSlot{ requirements, resource.lastPass, {} });
+        resource.aliasSlot = static_cast<int32_t>(mAliasSlots.size() - 1);
+        continue;
+      }
+
+      frAliasSlot &slot = mAliasSlots[best];
+      slot.requirements.size = std::max(slot.requirements.size, requirements.size);
+      slot.requirements.alignment = std::max(slot.requirements.alignment, requirements.alignment);
+      slot.requirements.memoryTypeBits &= requirements.memoryTypeBits;
+      slot.lastPass = resource.lastPass;
+      resource.aliasSlot = best;
+    }
+
+    for (auto &slot : mAliasSlots) {
+      slot.allocation = mRenderer->mAllocator.allocate(slot.requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+      mTransientMemory += slot.requirements.size;
+    }
+
+    for (auto id : transients) {
+      const frAllocation &allocation = mAliasSlots[mResources[id].aliasSlot].allocation;
+      mResources[id].imageHandle->bindMemory(allocation.block->memory, allocation.offset);
+    }
   }
 
-  void frCommands::begin(VkCommandBuffer cmdBuf, VkCommandBufferUsageFlags flags) {
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = flags;
-    beginInfo.pInheritanceInfo = nullptr;
-    VK_WRAPPER(vkBeginCommandBuffer(cmdBuf, &beginInfo));
+  void frRenderGraph::computeBarriers() {
+    std::vector<frGraphState> states(mResources.size());
+    std::vector<frGraphState> slotStates(mAliasSlots.size());
+    std::vector<bool> touched(mResources.size(), false);
+
+    // Transients and alias slots are reused by every execution, the previous frame in flight may still be using them
+    for (auto &state : states) {
+      state.writeStages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+      state.writeAccess = VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+    for (auto &state : slotStates) {
+      state.writeStages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+      state.writeAccess = VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+
+    for (size_t i = 0; i < mResources.size(); ++i) {
+      if (!mResources[i].imported) continue;
+      // Unknown work from earlier submissions may still use imported resources
+      states[i].layout = mResources[i].initialLayout;
+      states[i].writeAccess = mResources[i].initialLayout == VK_IMAGE_LAYOUT_UNDEFINED && mResources[i].image ? 0 : VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+
+    for (auto &pass : mPasses) {
+      if (pass.culled) continue;
+      frGraphBarrierBatch &batch = pass.barriers;
+
+      for (const auto &access : pass.accesses) {
+        const frGraphResourceData &resource = mResources[access.resource];
+        frGraphUsageInfo info = GraphUsageInfo(access.usage, access.write);
+
+        frGraphState state = states[access.resource];
+        if (!touched[access.resource]) {
+          touched[access.resource] = true;
+          if (resource.aliasSlot >= 0) { // Wait for the previous occupant of the memory, contents are garbage
+            state = slotStates[resource.aliasSlot];
+            state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+          }
+        }
+
+        VkImageLayout layout = resource.image ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+        bool layoutChange = resource.image && state.layout != layout;
+
+        if (access.write || layoutChange) {
+          bool discard = access.overwrites();
+          VkPipelineStageFlags srcStages = state.writeStages | state.readStages;
+
+          batch.barriers.push_back(frGraphBarrier{
+            access.resource, discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout, layout,
+            state.writeAccess, info.access
+          });
+          batch.srcStages |= srcStages ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+          batch.dstStages |= info.stages;
+
+          state.layout = layout;
+          if (access.write) {
+            state.writeStages = info.stages;
+            state.writeAccess = (info.access & kWriteAccessMask) ? (info.access & kWriteAccessMask) : info.access;
+            state.readStages = 0;
+            state.readAccess = 0;
+          } else {
+            state.readStages = info.stages;
+            state.readAccess = info.access;
+          }
+        } else if (state.writeStages && ((info.stages & ~state.readStages) || (info.access & ~state.readAccess))) {
+          // Read after write in the same layout, only needs the write made visible to this reader
+          batch.barriers.push_back(frGraphBarrier{ access.resource, layout, layout, state.writeAccess, info.access });
+          batch.srcStages |= state.writeStages;
+          batch.dstStages |= info.stages;
+
+          state.readStages |= info.stages;
+          state.readAccess |= info.access;
+        }
+
+        states[access.resource] = state;
+        if (resource.aliasSlot >= 0) slotStates[resource.aliasSlot] = state;
+      }
+    }
+
+    for (size_t i = 0; i < mResources.size(); ++i) {
+      const frGraphResourceData &resource = mResources[i];
+      if (!resource.imported || !resource.image || !touched[i]) continue;
+      if (resource.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED || resource.finalLayout == states[i].layout) continue;
+
+      VkPipelineStageFlags srcStages = states[i].writeStages | states[i].readStages;
+      mFinalBarriers.barriers.push_back(frGraphBarrier{
+        static_cast<frGraphResource>(i), states[i].layout, resource.finalLayout, states[i].writeAccess, 0
+      });
+      mFinalBarriers.srcStages |= srcStages ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+      mFinalBarriers.dstStages |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    }
   }
 
-  void frCommands::end(VkCommandBuffer cmdBuf) {
-    VK_WRAPPER(vkEndCommandBuffer(cmdBuf));
+  void frRenderGraph::createRenderPasses() {
+    for (uint32_t p = 0; p < mPasses.size(); ++p) {
+      frGraphPass &pass = mPasses[p];
+      if (pass.culled) continue;
+
+      std::vector<VkAttachmentReference> colorRefs{};
+      std::vector<VkAttachmentReference> resolveRefs{};
+      VkAttachmentReference depthRef{};
+      bool hasDepth = false;
+
+      frRenderPass *renderPass = nullptr;
+      for (const auto &access : pass.accesses) {
+        if (!access.attachment) continue;
+        if (!renderPass) renderPass = new frRenderPass();
+
+        const frGraphResourceData &resource = mResources[access.resource];
+        frImage *image = resource.imageHandle;
+        frGraphUsageInfo info = GraphUsageInfo(access.usage, access.write);
+
+        // Contents only have to reach memory if a later pass or someone outside the graph looks at them
+        bool store = resource.imported || resource.output || resource.lastPass > p;
+        VkAttachmentStoreOp storeOp = store ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        bool stencil = access.usage == FR_GRAPH_DEPTH_ATTACHMENT && FormatHasStencil(image->getFormat());
+
+        renderPass->addAttachment(VkAttachmentDescription{
+          0, image->getFormat(), image->getSamples(),
+          access.loadOp, storeOp,
+          stencil ? access.loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE, stencil ? storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+          info.layout, info.layout
+        });
+
+        VkAttachmentReference ref{ static_cast<uint32_t>(pass.attachments.size()), info.layout };
+        if (access.usage == FR_GRAPH_COLOR_ATTACHMENT) colorRefs.push_back(ref);
+        else if (access.usage == FR_GRAPH_RESOLVE_ATTACHMENT) resolveRefs.push_back(ref);
+        else { depthRef = ref; hasDepth = true; }
+
+        pass.attachments.push_back(access.resource);
+        pass.clearValues.push_back(access.clear);
+      }
+
+      if (!renderPass) continue;
+      if (!resolveRefs.empty() && resolveRefs.size() != colorRefs.size()) {
+        delete renderPass;
+        throw fr::frVulkanException("Render graph pass needs one resolve attachment per color attachment!");
+      }
+
+      // Layout transitions happen in the graph's barriers, the render pass keeps every attachment in place
+      VkSubpassDescription subpass{};
+      subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+      subpass.colorAttachmentCount = static_cast<uint32_t>(colorRefs.size());
+      subpass.pColorAttachments = colorRefs.data();
+      subpass.pResolveAttachments = resolveRefs.empty() ? nullptr : resolveRefs.data();
+      subpass.pDepthStencilAttachment = hasDepth ? &depthRef : nullptr;
+
+      renderPass->addSubpass(subpass);
+      renderPass->initialize(mRenderer);
+      pass.renderPass = renderPass;
+    }
   }
 
-  void frCommands::submit(frRenderer *renderer, VkCommandBuffer cmdBuf, frSynchronization *sync) {
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  void frRenderGraph::recordBarriers(VkCommandBuffer cmdBuf, const frGraphBarrierBatch &batch) {
+    if (batch.barriers.empty()) return;
 
-    VkFence fence = VK_NULL_HANDLE;
-    if (sync) {
-      fence = sync->mInFlightFence;
+    for (const auto &barrier : batch.barriers) {
+      const frGraphResourceData &resource = mResources[barrier.resource];
+
+      if (resource.image) {
+        frImage *image = resource.imageHandle;
+        VkImageAspectFlags aspect = image->getAspect();
+        if ((aspect & VK_IMAGE_ASPECT_DEPTH_BIT) && FormatHasStencil(image->getFormat())) aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+
+        mBarriers.addImage(image->get(), VkImageSubresourceRange{ aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS },
+          barrier.oldLayout, barrier.newLayout,
+          batch.srcStages, barrier.srcAccess, batch.dstStages, barrier.dstAccess);
+      } else {
+        mBarriers.addBuffer(resource.bufferHandle->get(), 0, VK_WHOLE_SIZE,
+          batch.srcStages, barrier.srcAccess, batch.dstStages, barrier.dstAccess);
+      }
+    }
 
-      VkSemaphore waitSemaphores[] = {sync->mImageAvailableSemaphore};
-      VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-      submitInfo.waitSemaphoreCount = 1;
-      submitInfo.pWaitSemaphores = waitSemaphores;
-      submitInfo.pWaitDstStageMask = waitStages;
+    mBarriers.flush(cmdBuf);
+  }
 
-      VkSemaphore signalSemaphores[] = {sync->mRenderFinishedSemaphore};
-      submitInfo.signalSemaphoreCount = 1;
-      submitInfo.pSignalSemaphores = signalSemaphores;
+  frFramebuffer *frRenderGraph::getFramebuffer(frGraphPass &pass) {
+    std::vector<VkImageView> views{};
+    std::vector<frImage*> images{};
+    for (auto id : pass.attachments) {
+      images.push_back(mResources[id].imageHandle);
+      views.push_back(mResources[id].imageHandle->getView());
     }
 
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmdBuf;
+    auto it = pass.framebuffers.find(views);
+    if (it != pass.framebuffers.end()) return it->second;
 
-    VK_WRAPPER(vkQueueSubmit(renderer->mGraphicsQueue, 1, &submitInfo, fence));
+    VkExtent2D extent = images[0]->getExtent();
+    frFramebuffer *framebuffer = new frFramebuffer();
+    framebuffer->initialize(mRenderer, static_cast<int>(extent.width), static_cast<int>(extent.height), 1, pass.renderPass, images);
+    pass.framebuffers[views] = framebuffer;
+    return framebuffer;
   }
-  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frCommands]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frRenderGraph]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
-  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frSynchronization]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
-  frSynchronization::frSynchronization()
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frSubmitQueue]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  frSubmitQueue::frSubmitQueue()
   {}
 
-  frSynchronization::~frSynchronization() {
+  frSubmitQueue::~frSubmitQueue() {
     cleanup();
   }
 
-  void frSynchronization::initialize(frRenderer *renderer) {
-    VkSemaphoreCreateInfo semaphoreInfo{};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    VkFenceCreateInfo fenceInfo{};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+  void frSubmitQueue::initialize(frRenderer *renderer, bool threaded) {
+    mTimelineSemaphores = renderer->mTimelineSemaphores;
+    mDevice = renderer->mDevice;
+    mStopping = false;
+    if (threaded) mThread = std::thread(&frSubmitQueue::threadLoop, this);
+  }
 
-    VK_WRAPPER(vkCreateSemaphore(renderer->mDevice, &semaphoreInfo, nullptr, &mImageAvailableSemaphore));
-    VK_WRAPPER(vkCreateSemaphore(renderer->mDevice, &semaphoreInfo, nullptr, &mRenderFinishedSemaphore));
-    VK_WRAPPER(vkCreateFence(renderer->mDevice, &fenceInfo, nullptr, &mInFlightFence));
+  void frSubmitQueue::cleanup() {
+    if (!mThread.joinable()) return;
 
-    mDevice = renderer->mDevice;
+    {
+      std::lock_guard<std::mutex> lock(mWorkMutex);
+      mStopping = true;
+    }
+    mWorkAvailable.notify_all();
+    mThread.join();
   }
 
-  void frSynchronization::cleanup() {
-    vkDestroySemaphore(mDevice, mImageAvailableSemaphore, nullptr);
-    vkDestroySemaphore(mDevice, mRenderFinishedSemaphore, nullptr);
-    vkDestroyFence(mDevice,     mInFlightFence, nullptr);
+  void frSubmitQueue::add(VkQueue queue, frSubmission submission) {
+    // Pad so every semaphore has a stage and a value, VkTimelineSemaphoreSubmitInfo wants matching counts
+    submission.waitStages.resize(submission.waitSemaphores.size(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    submission.waitValues.resize(submission.waitSemaphores.size(), 0);
+    submission.signalValues.resize(submission.signalSemaphores.size(), 0);
+
+    for (auto &pending : mPending) {
+      if (pending.queue == queue) {
+        pending.submissions.push_back(std::move(submission));
+        return;
+      }
+    }
+
+    frQueueWork work{};
+    work.queue = queue;
+    work.submissions.push_back(std::move(submission));
+    mPending.push_back(std::move(work));
   }
 
-  void frSynchronization::wait() {
-    vkWaitForFences(mDevice, 1, &mInFlightFence, VK_TRUE, UINT64_MAX);
+  void frSubmitQueue::flush(VkQueue queue, VkFence fence) {
+    frQueueWork work{};
+    work.queue = queue;
+    work.fence = fence;
+
+    for (size_t i = 0; i < mPending.size(); ++i) {
+      if (mPending[i].queue != queue) continue;
+      work.submissions = std::move(mPending[i].submissions);
+      mPending.erase(mPending.begin() + i);
+      break;
+    }
+
+    if (work.submissions.empty() && !fence) return;
+
+    if (!threaded()) {
+      auto lock = this->lock();
+      VkResult result = execute(work);
+      if (result != VK_SUCCESS) VK_REPORT(vkQueueSubmit(queue, ..., fence));
+      return;
+    }
+
+    rethrow();
+    {
+      std::lock_guard<std::mutex> lock(mWorkMutex);
+      mWork.push_back(std::move(work));
+    }
+    mWorkAvailable.notify_one();
   }
-   
-  void frSynchronization::reset() {
-    vkResetFences(mDevice, 1, &mInFlightFence);
+
+  void frSubmitQueue::submit(VkQueue queue, frSubmission submission, VkFence fence) {
+    add(queue, std::move(submission));
+    flush(queue, fence);
   }
-  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frSynchronization]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
-  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frBuffer]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
-  frBuffer::frBuffer()
-  {}
+  VkResult frSubmitQueue::present(VkQueue queue, VkSwapchainKHR swapchain, uint32_t imageIndex, VkSemaphore waitSemaphore) {
+    frQueueWork work{};
+    work.queue = queue;
+    work.swapchain = swapchain;
+    work.imageIndex = imageIndex;
+    work.presentWait = waitSemaphore;
 
-  frBuffer::~frBuffer() {
-    cleanup();
+    if (!threaded()) {
+      auto lock = this->lock();
+      return execute(work);
+    }
+
+    rethrow();
+    VkResult result = VK_SUCCESS;
+    {
+      std::lock_guard<std::mutex> lock(mWorkMutex);
+      mWork.push_back(std::move(work));
+      std::swap(result, mPresentResult);
+    }
+    mWorkAvailable.notify_one();
+    return result;
   }
 
-  void frBuffer::copyData(VkDeviceSize offset, VkDeviceSize size, void *data) {
-    void *bufData;
-    vkMapMemory(mDevice, mMemory, offset, size, 0, &bufData);
-      memcpy(bufData, data, size);
-    vkUnmapMemory(mDevice, mMemory);
+  VkResult frSubmitQueue::acquire(VkSwapchainKHR swapchain, VkSemaphore semaphore, uint32_t *imageIndex) {
+    if (!threaded()) {
+      auto lock = this->lock();
+      return vkAcquireNextImageKHR(mDevice, swapchain, UINT64_MAX, semaphore, VK_NULL_HANDLE, imageIndex);
+    }
+
+    rethrow();
+    frAcquire acquire{};
+    acquire.swapchain = swapchain;
+    acquire.semaphore = semaphore;
+
+    frQueueWork work{};
+    work.acquire = &acquire;
+    {
+      std::unique_lock<std::mutex> lock(mWorkMutex);
+      mWork.push_back(std::move(work));
+      mWorkAvailable.notify_one();
+      mAcquired.wait(lock, [&acquire] { return acquire.done; });
+    }
+
+    *imageIndex = acquire.imageIndex;
+    return acquire.result;
   }
 
-  void frBuffer::copyFromBuffer(frRenderer *renderer, frCommands *commands, frBuffer *buffer, VkDeviceSize size) {
-    VkCommandBuffer cmdBuf = commands->getSingleTime();
+  void frSubmitQueue::drain() {
+    if (!threaded()) return;
 
-    VkBufferCopy copyRegion{};
-    copyRegion.size = size;
-    vkCmdCopyBuffer(cmdBuf, buffer->mBuffer, mBuffer, 1, &copyRegion);
+    {
+      std::unique_lock<std::mutex> lock(mWorkMutex);
+      mDrained.wait(lock, [this] { return mWork.empty() && !mBusy; });
+    }
+    rethrow();
+  }
 
-    if (!commands->singleTimeFrameActive()) commands->endSingleTime(renderer, cmdBuf);
+  VkResult frSubmitQueue::execute(frQueueWork &work) {
+    if (work.swapchain) {
+      VkPresentInfoKHR presentInfo{};
+      presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+      presentInfo.waitSemaphoreCount = 1;
+      presentInfo.pWaitSemaphores = &work.presentWait;
+      presentInfo.swapchainCount = 1;
+      presentInfo.pSwapchains = &work.swapchain;
+      presentInfo.pImageIndices = &work.imageIndex;
+      return vkQueuePresentKHR(work.queue, &presentInfo);
+    }
+
+    std::vector<VkSubmitInfo> submitInfos(work.submissions.size());
+    std::vector<VkTimelineSemaphoreSubmitInfo> timelineInfos(work.submissions.size());
+    for (size_t i = 0; i < work.submissions.size(); ++i) {
+      const frSubmission &submission = work.submissions[i];
+
+      VkSubmitInfo &submitInfo = submitInfos[i];
+      submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submitInfo.waitSemaphoreCount = static_cast<uint32_t>(submission.waitSemaphores.size());
+      submitInfo.pWaitSemaphores = submission.waitSemaphores.data();
+      submitInfo.pWaitDstStageMask = submission.waitStages.data();
+      submitInfo.commandBufferCount = static_cast<uint32_t>(submission.commandBuffers.size());
+      submitInfo.pCommandBuffers = submission.commandBuffers.data();
+      submitInfo.signalSemaphoreCount = static_cast<uint32_t>(submission.signalSemaphores.size());
+      submitInfo.pSignalSemaphores = submission.signalSemaphores.data();
+
+      if (mTimelineSemaphores) {
+        VkTimelineSemaphoreSubmitInfo &timelineInfo = timelineInfos[i];
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = submitInfo.waitSemaphoreCount;
+        timelineInfo.pWaitSemaphoreValues = submission.waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = submitInfo.signalSemaphoreCount;
+        timelineInfo.pSignalSemaphoreValues = submission.signalValues.data();
+        submitInfo.pNext = &timelineInfo;
+      }
+    }
+
+    return vkQueueSubmit(work.queue, static_cast<uint32_t>(submitInfos.size()), submitInfos.data(), work.fence);
   }
 
-  void frBuffer::initialize(frRenderer *renderer, frBufferInfo info, bool bindMemory) {
-    renderer->CreateBuffer(info.size, info.usage, info.properties, mBuffer, bindMemory ? &mMemory : VK_NULL_HANDLE); // Create mBuffer and if (if bindMemory == true) { bind mMemory }
+  void frSubmitQueue::threadLoop() {
+    for (;;) {
+      frQueueWork work{};
+      {
+        std::unique_lock<std::mutex> lock(mWorkMutex);
+        mWorkAvailable.wait(lock, [this] { return mStopping || !mWork.empty(); });
+        if (mWork.empty()) return; // Stopping, everything queued has been executed
+
+        work = std::move(mWork.front());
+        mWork.pop_front();
+        mBusy = true;
+      }
 
-    mDevice = renderer->mDevice;
+      VkResult result = VK_SUCCESS;
+      if (work.acquire) { // Presents are the only other swapchain users and they run on this thread, no queue involved
+        frAcquire &acquire = *work.acquire;
+        acquire.result = vkAcquireNextImageKHR(mDevice, acquire.swapchain, UINT64_MAX, acquire.semaphore, VK_NULL_HANDLE, &acquire.imageIndex);
+      } else {
+        auto lock = this->lock();
+        result = execute(work);
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mWorkMutex);
+        if (work.acquire) {
+          work.acquire->done = true;
+          mAcquired.notify_all();
+        } else if (work.swapchain) {
+          if (result != VK_SUCCESS && mPresentResult == VK_SUCCESS) mPresentResult = result;
+        } else if (result != VK_SUCCESS && !mError) {
+          mError = std::make_exception_ptr(fr::frVulkanException("vkQueueSubmit failed on the submit thread!"));
+        }
+        mBusy = false;
+        if (mWork.empty()) mDrained.notify_all();
+      }
+    }
   }
 
-  void frBuffer::cleanup() {
-    vkDestroyBuffer(mDevice, mBuffer, VK_NULL_HANDLE);
-    vkFreeMemory(mDevice, mMemory, VK_NULL_HANDLE);
+  void frSubmitQueue::rethrow() {
+    std::exception_ptr error = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mWorkMutex);
+      std::swap(error, mError);
+    }
+    if (error) std::rethrow_exception(error);
   }
-  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frBuffer]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[-frSubmitQueue]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
   // =-=-=-=-=-=-=-=-=-=-=-=-=-=-[+frRenderer]-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+  // Pipeline cache files: this header, then the data vkGetPipelineCacheData returned. Drivers are not
+  // required to survive foreign or damaged data, so both this header and the cache's own are checked.
+  struct frPipelineCacheFileHeader {
+    uint32_t magic;         // "FRPC"
+    uint32_t dataSize;
+    uint64_t checksum;      // FNV-1a of the data
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+  };
+
+  static const uint32_t kPipelineCacheMagic = 0x43505246; // "FRPC"
+
+  static std::vector<uint8_t> ReadPipelineCache(const char *path, VkPhysicalDevice physicalDevice) {
+    FILE *fd = fopen(path, "rb");
+    if (!fd) return {};
+
+    frPipelineCacheFileHeader header{};
+    std::vector<uint8_t> data{};
+    if (fread(&header, sizeof(header), 1, fd) == 1 && header.magic == kPipelineCacheMagic) {
+      data.resize(header.dataSize);
+      if (fread(data.data(), 1, data.size(), fd) != data.size()) data.clear();
+    }
+    fclose(fd);
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    VkPipelineCacheHeaderVersionOne cacheHeader{};
+    if (data.size() < sizeof(cacheHeader)) return {};
+    memcpy(&cacheHeader, data.data(), sizeof(cacheHeader));
+
+    bool valid = Fnv1a(data.data(), data.size()) == header.checksum &&
+      header.vendorID == properties.vendorID && header.deviceID == properties.deviceID &&
+      header.driverVersion == properties.driverVersion &&
+      memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+      cacheHeader.headerSize >= sizeof(cacheHeader) && cacheHeader.headerSize <= data.size() &&
+      cacheHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+      cacheHeader.vendorID == properties.vendorID && cacheHeader.deviceID == properties.deviceID &&
+      memcmp(cacheHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    if (!valid) return {};
+    return data;
+  }
+
+  static bool WritePipelineCache(const char *path, VkPhysicalDevice physicalDevice, const std::vector<uint8_t> &data) {
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    frPipelineCacheFileHeader header{};
+    header.magic = kPipelineCacheMagic;
+    header.dataSize = static_cast<uint32_t>(data.size());
+    header.checksum = Fnv1a(data.data(), data.size());
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+    // Written next to the target and renamed over it, a crash mid-write leaves the previous file intact
+    std::string temporary = std::string(path) + ".tmp";
+    FILE *fd = fopen(temporary.c_str(), "wb");
+    if (!fd) return false;
+    bool written = fwrite(&header, sizeof(header), 1, fd) == 1 && fwrite(data.data(), 1, data.size(), fd) == data.size();
+    written = fclose(fd) == 0 && written;
+    if (!written) {
+      std::remove(temporary.c_str());
+      return false;
+    }
+
+#ifdef _WIN32
+    return MoveFileExA(temporary.c_str(), path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(temporary.c_str(), path) == 0;
+#endif
+  }
+
   frRenderer::frRenderer() 
   {}
 
@@ -1082,7 +5487,11 @@ namespace fr {
       appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
       appInfo.pEngineName = "FissionRender";
       appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-      appInfo.apiVersion = VK_API_VERSION_1_1;
+      // Request the newest API the loader knows about (capped at 1.3) so optional core features can be enabled
+      uint32_t instanceVersion = VK_API_VERSION_1_0;
+      if (vkEnumerateInstanceVersion(&instanceVersion) != VK_SUCCESS) instanceVersion = VK_API_VERSION_1_0;
+      mApiVersion = std::max(VK_API_VERSION_1_1, std::min(instanceVersion, VK_API_VERSION_1_3));
+      appInfo.apiVersion = mApiVersion;
 
       VkInstanceCreateInfo createInfo{};
       createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -1181,6 +5590,15 @@ namespace fr {
         throw fr::frVulkanException("Failed to pick physical device!");
       }
 
+      VkPhysicalDeviceProperties properties{};
+      vkGetPhysicalDeviceProperties(mPhysicalDevice, &properties);
+      mApiVersion = std::min(mApiVersion, properties.apiVersion);
+
+      uint32_t extensionCount = 0;
+      vkEnumerateDeviceExtensionProperties(mPhysicalDevice, nullptr, &extensionCount, nullptr);
+      mAvailableDeviceExtensions.resize(extensionCount);
+      vkEnumerateDeviceExtensionProperties(mPhysicalDevice, nullptr, &extensionCount, mAvailableDeviceExtensions.data());
+
       { // Queue families
         uint32_t queueFamilyCount = 0;
         vkGetPhysicalDeviceQueueFamilyProperties(mPhysicalDevice, &queueFamilyCount, nullptr);
@@ -1209,12 +5627,28 @@ namespace fr {
         if (!mGraphicsQueueSet || !mPresentQueueSet) {
           throw fr::frVulkanException("Failed to find graphics and/or present queue family!");
         }
+
+        mTransferQueueFamily = mGraphicsQueueFamily;
+        if (mTransferQueueRequested) { // Prefer a transfer-only family (DMA engine), then any non-graphics one
+          int32_t bestScore = 0;
+          for (uint32_t j = 0; j < queueFamilyCount; ++j) {
+            VkQueueFlags flags = queueFamilies[j].queueFlags;
+            if (flags & VK_QUEUE_GRAPHICS_BIT) continue;
+            if (!(flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT))) continue;
+
+            int32_t score = (flags & VK_QUEUE_COMPUTE_BIT) ? 1 : 2;
+            if (score > bestScore) {
+              bestScore = score;
+              mTransferQueueFamily = j;
+            }
+          }
+        }
       }
     }
 
     { // Device
       std::vector<VkDeviceQueueCreateInfo> queueInfos = {};
-      std::set<uint32_t> uniqueQueueFamilies = {mGraphicsQueueFamily, mPresentQueueFamily};
+      std::set<uint32_t> uniqueQueueFamilies = {mGraphicsQueueFamily, mPresentQueueFamily, mTransferQueueFamily};
 
       float priority = 1.0f;
       for (uint32_t family : uniqueQueueFamilies) {
@@ -1232,26 +5666,341 @@ namespace fr {
       createInfo.pQueueCreateInfos = queueInfos.data();
       createInfo.enabledLayerCount = static_cast<uint32_t>(mDeviceLayers.size());
       createInfo.ppEnabledLayerNames = mDeviceLayers.data();
+      VkPhysicalDeviceFeatures enabledFeatures{};
+      if (deviceFeatures) enabledFeatures = *deviceFeatures;
+      { // BC textures whenever the device has them, FindSupportedFormat() reports per-format support
+        VkPhysicalDeviceFeatures supportedFeatures{};
+        vkGetPhysicalDeviceFeatures(mPhysicalDevice, &supportedFeatures);
+        enabledFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+        mTextureCompressionBC = supportedFeatures.textureCompressionBC == VK_TRUE;
+      }
+      createInfo.pEnabledFeatures = &enabledFeatures;
+      mEnabledFeatures = enabledFeatures;
+
+      void *featureChain = nullptr;
+
+      VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+      timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+      if (mTimelineRequested && (mApiVersion >= VK_API_VERSION_1_2 || hasDeviceExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &timelineFeatures;
+        vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &features2);
+
+        if (timelineFeatures.timelineSemaphore) {
+          if (mApiVersion < VK_API_VERSION_1_2) mDeviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+          timelineFeatures.pNext = featureChain;
+          featureChain = &timelineFeatures;
+          mTimelineSemaphores = true;
+        }
+      }
+
+      VkPhysicalDeviceSynchronization2Features sync2Features{};
+      sync2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+      if (mApiVersion >= VK_API_VERSION_1_3 || hasDeviceExtension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &sync2Features;
+        vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &features2);
+
+        if (sync2Features.synchronization2) {
+          if (mApiVersion < VK_API_VERSION_1_3) mDeviceExtensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+          sync2Features.pNext = featureChain;
+          featureChain = &sync2Features;
+          mSynchronization2 = true;
+        }
+      }
+
+      VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT libraryFeatures{};
+      libraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+      if (hasDeviceExtension(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME) && hasDeviceExtension(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &libraryFeatures;
+        vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &features2);
+
+        if (libraryFeatures.graphicsPipelineLibrary) {
+          mDeviceExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+          mDeviceExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+          libraryFeatures.pNext = featureChain;
+          featureChain = &libraryFeatures;
+          mGraphicsPipelineLibrary = true;
+
+          VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT libraryProperties{};
+          libraryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+          VkPhysicalDeviceProperties2 properties2{};
+          properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+          properties2.pNext = &libraryProperties;
+          vkGetPhysicalDeviceProperties2(mPhysicalDevice, &properties2);
+          mGraphicsPipelineFastLinking = libraryProperties.graphicsPipelineLibraryFastLinking == VK_TRUE;
+        }
+      }
+
+      // Extended dynamic state 1 and the first three states of 2 are core in 1.3 without a feature bit
+      VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamicStateFeatures{};
+      dynamicStateFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+      mExtendedDynamicState = mApiVersion >= VK_API_VERSION_1_3;
+      if (!mExtendedDynamicState && hasDeviceExtension(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &dynamicStateFeatures;
+        vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &features2);
+
+        if (dynamicStateFeatures.extendedDynamicState) {
+          mDeviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+          dynamicStateFeatures.pNext = featureChain;
+          featureChain = &dynamicStateFeatures;
+          mExtendedDynamicState = true;
+        }
+      }
+
+      VkPhysicalDeviceExtendedDynamicState2FeaturesEXT dynamicState2Features{};
+      dynamicState2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_2_FEATURES_EXT;
+      mExtendedDynamicState2 = mApiVersion >= VK_API_VERSION_1_3;
+      if (hasDeviceExtension(VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &dynamicState2Features;
+        vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &features2);
+
+        if (dynamicState2Features.extendedDynamicState2) {
+          mDeviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME);
+          dynamicState2Features.pNext = featureChain;
+          featureChain = &dynamicState2Features;
+          mExtendedDynamicState2 = true;
+          mExtendedDynamicState2LogicOp = dynamicState2Features.extendedDynamicState2LogicOp == VK_TRUE;
+          mExtendedDynamicState2PatchControlPoints = dynamicState2Features.extendedDynamicState2PatchControlPoints == VK_TRUE;
+        }
+      }
+
+      VkPhysicalDeviceExtendedDynamicState3FeaturesEXT dynamicState3Features{};
+      dynamicState3Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+      if (hasDeviceExtension(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &dynamicState3Features;
+        vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &features2);
+
+        mExtendedDynamicState3 = dynamicState3Features;
+        mExtendedDynamicState3.pNext = nullptr;
+        mDeviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+        dynamicState3Features.pNext = featureChain;
+        featureChain = &dynamicState3Features;
+      }
+
+      // Only on 1.3, where the dynamic rendering it depends on is core
+      VkPhysicalDeviceShaderObjectFeaturesEXT shaderObjectFeatures{};
+      shaderObjectFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT;
+      VkPhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures{};
+      dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+      if (mShaderObjectRequested && mApiVersion >= VK_API_VERSION_1_3 && hasDeviceExtension(VK_EXT_SHADER_OBJECT_EXTENSION_NAME)) {
+        shaderObjectFeatures.pNext = &dynamicRenderingFeatures;
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &shaderObjectFeatures;
+        vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &features2);
+
+        if (shaderObjectFeatures.shaderObject && dynamicRenderingFeatures.dynamicRendering) {
+          mDeviceExtensions.push_back(VK_EXT_SHADER_OBJECT_EXTENSION_NAME);
+          dynamicRenderingFeatures.pNext = featureChain;
+          featureChain = &shaderObjectFeatures;
+          mShaderObject = true;
+        }
+      }
+
+      createInfo.pNext = featureChain;
       createInfo.enabledExtensionCount = static_cast<uint32_t>(mDeviceExtensions.size());
       createInfo.ppEnabledExtensionNames = mDeviceExtensions.data();
-      createInfo.pEnabledFeatures = deviceFeatures;
 
       VK_WRAPPER(vkCreateDevice(mPhysicalDevice, &createInfo, nullptr, &mDevice));
 
       vkGetDeviceQueue(mDevice, mGraphicsQueueFamily, 0, &mGraphicsQueue);
       vkGetDeviceQueue(mDevice, mPresentQueueFamily, 0, &mPresentQueue);
+      vkGetDeviceQueue(mDevice, mTransferQueueFamily, 0, &mTransferQueue);
+    }
+
+    if (mSynchronization2) {
+      bool core = mApiVersion >= VK_API_VERSION_1_3;
+      mCmdPipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2>(
+        vkGetDeviceProcAddr(mDevice, core ? "vkCmdPipelineBarrier2" : "vkCmdPipelineBarrier2KHR"));
+      mCmdSetEvent2 = reinterpret_cast<PFN_vkCmdSetEvent2>(
+        vkGetDeviceProcAddr(mDevice, core ? "vkCmdSetEvent2" : "vkCmdSetEvent2KHR"));
+      mCmdWaitEvents2 = reinterpret_cast<PFN_vkCmdWaitEvents2>(
+        vkGetDeviceProcAddr(mDevice, core ? "vkCmdWaitEvents2" : "vkCmdWaitEvents2KHR"));
+      mCmdResetEvent2 = reinterpret_cast<PFN_vkCmdResetEvent2>(
+        vkGetDeviceProcAddr(mDevice, core ? "vkCmdResetEvent2" : "vkCmdResetEvent2KHR"));
+      // Fall back to the original commands rather than failing device creation
+      mSynchronization2 = mCmdPipelineBarrier2 && mCmdSetEvent2 && mCmdWaitEvents2 && mCmdResetEvent2;
+    }
+
+    { // Dynamic state commands, a missing one disables its states rather than failing device creation
+      bool core = mApiVersion >= VK_API_VERSION_1_3;
+      auto load = [&](const char *coreName, const char *extName) {
+        return vkGetDeviceProcAddr(mDevice, core ? coreName : extName);
+      };
+
+      if (mExtendedDynamicState) {
+        mCmdSetCullMode = reinterpret_cast<PFN_vkCmdSetCullMode>(load("vkCmdSetCullMode", "vkCmdSetCullModeEXT"));
+        mCmdSetFrontFace = reinterpret_cast<PFN_vkCmdSetFrontFace>(load("vkCmdSetFrontFace", "vkCmdSetFrontFaceEXT"));
+        mCmdSetPrimitiveTopology = reinterpret_cast<PFN_vkCmdSetPrimitiveTopology>(load("vkCmdSetPrimitiveTopology", "vkCmdSetPrimitiveTopologyEXT"));
+        mCmdSetDepthTestEnable = reinterpret_cast<PFN_vkCmdSetDepthTestEnable>(load("vkCmdSetDepthTestEnable", "vkCmdSetDepthTestEnableEXT"));
+        mCmdSetDepthWriteEnable = reinterpret_cast<PFN_vkCmdSetDepthWriteEnable>(load("vkCmdSetDepthWriteEnable", "vkCmdSetDepthWriteEnableEXT"));
+        mCmdSetDepthCompareOp = reinterpret_cast<PFN_vkCmdSetDepthCompareOp>(load("vkCmdSetDepthCompareOp", "vkCmdSetDepthCompareOpEXT"));
+        mCmdSetDepthBoundsTestEnable = reinterpret_cast<PFN_vkCmdSetDepthBoundsTestEnable>(load("vkCmdSetDepthBoundsTestEnable", "vkCmdSetDepthBoundsTestEnableEXT"));
+        mCmdSetStencilTestEnable = reinterpret_cast<PFN_vkCmdSetStencilTestEnable>(load("vkCmdSetStencilTestEnable", "vkCmdSetStencilTestEnableEXT"));
+        mCmdSetStencilOp = reinterpret_cast<PFN_vkCmdSetStencilOp>(load("vkCmdSetStencilOp", "vkCmdSetStencilOpEXT"));
+        mExtendedDynamicState = mCmdSetCullMode && mCmdSetFrontFace && mCmdSetPrimitiveTopology && mCmdSetDepthTestEnable &&
+                                mCmdSetDepthWriteEnable && mCmdSetDepthCompareOp && mCmdSetDepthBoundsTestEnable &&
+                                mCmdSetStencilTestEnable && mCmdSetStencilOp;
+      }
+
+      if (mExtendedDynamicState2) {
+        mCmdSetRasterizerDiscardEnable = reinterpret_cast<PFN_vkCmdSetRasterizerDiscardEnable>(load("vkCmdSetRasterizerDiscardEnable", "vkCmdSetRasterizerDiscardEnableEXT"));
+        mCmdSetDepthBiasEnable = reinterpret_cast<PFN_vkCmdSetDepthBiasEnable>(load("vkCmdSetDepthBiasEnable", "vkCmdSetDepthBiasEnableEXT"));
+        mCmdSetPrimitiveRestartEnable = reinterpret_cast<PFN_vkCmdSetPrimitiveRestartEnable>(load("vkCmdSetPrimitiveRestartEnable", "vkCmdSetPrimitiveRestartEnableEXT"));
+        mExtendedDynamicState2 = mCmdSetRasterizerDiscardEnable && mCmdSetDepthBiasEnable && mCmdSetPrimitiveRestartEnable;
+      }
+      if (mExtendedDynamicState2LogicOp) {
+        mCmdSetLogicOp = reinterpret_cast<PFN_vkCmdSetLogicOpEXT>(vkGetDeviceProcAddr(mDevice, "vkCmdSetLogicOpEXT"));
+        mExtendedDynamicState2LogicOp = mCmdSetLogicOp != nullptr;
+      }
+      if (mExtendedDynamicState2PatchControlPoints) {
+        mCmdSetPatchControlPoints = reinterpret_cast<PFN_vkCmdSetPatchControlPointsEXT>(vkGetDeviceProcAddr(mDevice, "vkCmdSetPatchControlPointsEXT"));
+        mExtendedDynamicState2PatchControlPoints = mCmdSetPatchControlPoints != nullptr;
+      }
+
+      mCmdSetPolygonMode = reinterpret_cast<PFN_vkCmdSetPolygonModeEXT>(vkGetDeviceProcAddr(mDevice, "vkCmdSetPolygonModeEXT"));
+      mCmdSetDepthClampEnable = reinterpret_cast<PFN_vkCmdSetDepthClampEnableEXT>(vkGetDeviceProcAddr(mDevice, "vkCmdSetDepthClampEnableEXT"));
+      mCmdSetColorBlendEnable = reinterpret_cast<PFN_vkCmdSetColorBlendEnableEXT>(vkGetDeviceProcAddr(mDevice, "vkCmdSetColorBlendEnableEXT"));
+      mCmdSetColorBlendEquation = reinterpret_cast<PFN_vkCmdSetColorBlendEquationEXT>(vkGetDeviceProcAddr(mDevice, "vkCmdSetColorBlendEquationEXT"));
+      mCmdSetColorWriteMask = reinterpret_cast<PFN_vkCmdSetColorWriteMaskEXT>(vkGetDeviceProcAddr(mDevice, "vkCmdSetColorWriteMaskEXT"));
+    }
+
+    if (mShaderObject) { // Every state is set per draw, the extension provides the EXT names of all the commands
+      auto loadMissing = [&](auto &function, const char *name) {
+        if (!function) function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(vkGetDeviceProcAddr(mDevice, name));
+        return function != nullptr;
+      };
+
+      bool loaded = true;
+      loaded &= loadMissing(mCreateShaders, "vkCreateShadersEXT");
+      loaded &= loadMissing(mDestroyShader, "vkDestroyShaderEXT");
+      loaded &= loadMissing(mCmdBindShaders, "vkCmdBindShadersEXT");
+      loaded &= loadMissing(mCmdSetVertexInput, "vkCmdSetVertexInputEXT");
+      loaded &= loadMissing(mCmdSetViewportWithCount, "vkCmdSetViewportWithCount");
+      loaded &= loadMissing(mCmdSetScissorWithCount, "vkCmdSetScissorWithCount");
+      loaded &= loadMissing(mCmdSetRasterizationSamples, "vkCmdSetRasterizationSamplesEXT");
+      loaded &= loadMissing(mCmdSetSampleMask, "vkCmdSetSampleMaskEXT");
+      loaded &= loadMissing(mCmdSetAlphaToCoverageEnable, "vkCmdSetAlphaToCoverageEnableEXT");
+      loaded &= loadMissing(mCmdSetAlphaToOneEnable, "vkCmdSetAlphaToOneEnableEXT");
+      loaded &= loadMissing(mCmdSetLogicOpEnable, "vkCmdSetLogicOpEnableEXT");
+      loaded &= loadMissing(mCmdSetTessellationDomainOrigin, "vkCmdSetTessellationDomainOriginEXT");
+      loaded &= loadMissing(mCmdSetCullMode, "vkCmdSetCullModeEXT");
+      loaded &= loadMissing(mCmdSetFrontFace, "vkCmdSetFrontFaceEXT");
+      loaded &= loadMissing(mCmdSetPrimitiveTopology, "vkCmdSetPrimitiveTopologyEXT");
+      loaded &= loadMissing(mCmdSetDepthTestEnable, "vkCmdSetDepthTestEnableEXT");
+      loaded &= loadMissing(mCmdSetDepthWriteEnable, "vkCmdSetDepthWriteEnableEXT");
+      loaded &= loadMissing(mCmdSetDepthCompareOp, "vkCmdSetDepthCompareOpEXT");
+      loaded &= loadMissing(mCmdSetDepthBoundsTestEnable, "vkCmdSetDepthBoundsTestEnableEXT");
+      loaded &= loadMissing(mCmdSetStencilTestEnable, "vkCmdSetStencilTestEnableEXT");
+      loaded &= loadMissing(mCmdSetStencilOp, "vkCmdSetStencilOpEXT");
+      loaded &= loadMissing(mCmdSetRasterizerDiscardEnable, "vkCmdSetRasterizerDiscardEnableEXT");
+      loaded &= loadMissing(mCmdSetDepthBiasEnable, "vkCmdSetDepthBiasEnableEXT");
+      loaded &= loadMissing(mCmdSetPrimitiveRestartEnable, "vkCmdSetPrimitiveRestartEnableEXT");
+      loaded &= loadMissing(mCmdSetLogicOp, "vkCmdSetLogicOpEXT");
+      loaded &= loadMissing(mCmdSetPatchControlPoints, "vkCmdSetPatchControlPointsEXT");
+      loaded &= loadMissing(mCmdSetPolygonMode, "vkCmdSetPolygonModeEXT");
+      loaded &= loadMissing(mCmdSetDepthClampEnable, "vkCmdSetDepthClampEnableEXT");
+      loaded &= loadMissing(mCmdSetColorBlendEnable, "vkCmdSetColorBlendEnableEXT");
+      loaded &= loadMissing(mCmdSetColorBlendEquation, "vkCmdSetColorBlendEquationEXT");
+      loaded &= loadMissing(mCmdSetColorWriteMask, "vkCmdSetColorWriteMaskEXT");
+      loaded &= loadMissing(mCmdBeginRendering, "vkCmdBeginRendering");
+      loaded &= loadMissing(mCmdEndRendering, "vkCmdEndRendering");
+      mShaderObject = loaded; // Regular pipelines otherwise
+
+      if (mShaderObject) { // Every state frCommands knows is settable with shader objects bound
+        mExtendedDynamicState = mExtendedDynamicState2 = true;
+        mExtendedDynamicState2LogicOp = mExtendedDynamicState2PatchControlPoints = true;
+        mExtendedDynamicState3.extendedDynamicState3PolygonMode = VK_TRUE;
+        mExtendedDynamicState3.extendedDynamicState3DepthClampEnable = VK_TRUE;
+        mExtendedDynamicState3.extendedDynamicState3ColorBlendEnable = VK_TRUE;
+        mExtendedDynamicState3.extendedDynamicState3ColorBlendEquation = VK_TRUE;
+        mExtendedDynamicState3.extendedDynamicState3ColorWriteMask = VK_TRUE;
+      }
+    }
+
+    mAllocator.initialize(this);
+
+    { // Pipeline cache, seeded from disk when the file was written by this device and driver
+      std::vector<uint8_t> initialData{};
+      if (mPipelineCachePath) initialData = ReadPipelineCache(mPipelineCachePath, mPhysicalDevice);
+
+      VkPipelineCacheCreateInfo createInfo{};
+      createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+      createInfo.initialDataSize = initialData.size();
+      createInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+      VkResult result = vkCreatePipelineCache(mDevice, &createInfo, nullptr, &mPipelineCache);
+      if (result != VK_SUCCESS && !initialData.empty()) { // Rejected by the driver, start empty
+        createInfo.initialDataSize = 0;
+        createInfo.pInitialData = nullptr;
+        result = vkCreatePipelineCache(mDevice, &createInfo, nullptr, &mPipelineCache);
+      }
+      if (result != VK_SUCCESS) {
+        VK_REPORT(vkCreatePipelineCache(mDevice, &createInfo, nullptr, &mPipelineCache));
+      }
+    }
+
+    if (mTimelineSemaphores) mTimeline.initialize(this);
+
+    mSubmitQueue.initialize(this, mSubmitThreadRequested);
+
+    if (mRingBufferSize) {
+      mRingBuffer.initialize(this, mRingBufferSize,
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
     }
   }
 
   void frRenderer::cleanup() {
+    mSubmitQueue.cleanup();
+    for (auto &deletion : mDeferredDeletions) deletion.deleter();
+    mDeferredDeletions.clear();
+    mRingBuffer.cleanup();
+    mTimeline.cleanup();
+    mAllocator.cleanup();
+    savePipelineCache();
+    vkDestroyPipelineCache(mDevice, mPipelineCache, nullptr);
+    mPipelineCache = VK_NULL_HANDLE;
     vkDestroySurfaceKHR(mInstance, mSurface, nullptr);
     vkDestroyDevice(mDevice, nullptr);
     vkDestroyInstance(mInstance, nullptr);
   }
 
+  bool frRenderer::savePipelineCache() {
+    if (!mPipelineCachePath || !mPipelineCache) return false;
+
+    std::vector<uint8_t> data{};
+    VkResult result = VK_INCOMPLETE;
+    while (result == VK_INCOMPLETE) { // Other threads may grow the cache between the two calls
+      size_t size = 0;
+      VK_WRAPPER(vkGetPipelineCacheData(mDevice, mPipelineCache, &size, nullptr));
+      data.resize(size);
+      result = vkGetPipelineCacheData(mDevice, mPipelineCache, &size, data.data());
+      data.resize(size);
+    }
+    if (result != VK_SUCCESS) {
+      VK_REPORT(vkGetPipelineCacheData(mDevice, mPipelineCache, &size, data.data()));
+    }
+
+    return WritePipelineCache(mPipelineCachePath, mPhysicalDevice, data);
+  }
+
   uint32_t frRenderer::acquireNextImage(frSwapchain *swapchain, frSynchronization *sync) {
+    collectDeletions();
+
     uint32_t imageIndex = 0;
-    VkResult result = vkAcquireNextImageKHR(mDevice, swapchain->mSwapchain, UINT64_MAX, sync->mImageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    // Ordered after the presents the submit thread still has queued for this swapchain
+    VkResult result = mSubmitQueue.acquire(swapchain->mSwapchain, sync->mImageAvailableSemaphore, &imageIndex);
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
       throw fr::frSwapchainResizeException();
       return imageIndex;
@@ -1267,26 +6016,95 @@ namespace fr {
   }
 
   void frRenderer::present(frSwapchain *swapchain, frSynchronization *sync, uint32_t *imageIndex) {
-    VkPresentInfoKHR presentInfo{};
-    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = &sync->mRenderFinishedSemaphore;
-    presentInfo.swapchainCount = 1;
-    presentInfo.pSwapchains = &swapchain->mSwapchain;
-    presentInfo.pImageIndices = imageIndex;
-
-    VkResult result = vkQueuePresentKHR(mPresentQueue, &presentInfo);
+    VkResult result = mSubmitQueue.present(mPresentQueue, swapchain->mSwapchain, *imageIndex, sync->mRenderFinishedSemaphore);
     if (result == VK_SUCCESS) {
       return;
     } else if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
       throw fr::frSwapchainResizeException();
     } else {
-      VK_REPORT(vkQueuePresentKHR(mPresentQueue, &presentInfo));
+      VK_REPORT(vkQueuePresentKHR(mPresentQueue, ...));
     }
   }
 
   void frRenderer::waitIdle() {
-    vkDeviceWaitIdle(mDevice);
+    mSubmitQueue.drain();
+    {
+      auto lock = mSubmitQueue.lock();
+      vkDeviceWaitIdle(mDevice);
+    }
+
+    for (auto &deletion : mDeferredDeletions) deletion.deleter();
+    mDeferredDeletions.clear();
+  }
+
+  void frRenderer::deferDeletion(std::function<void()> deleter) {
+    // Without timelines the next fenced submit, unfenced work submitted so far is ahead of it on the queue
+    uint64_t value = mTimelineSemaphores ? mTimeline.lastSignaled() : mFrameNumber + 1;
+    mDeferredDeletions.push_back({ value, std::move(deleter) });
+  }
+
+  void frRenderer::deferDeletion(std::function<void()> deleter, frSynchronization *sync) {
+    mDeferredDeletions.push_back({ sync->value(), std::move(deleter) });
+  }
+
+  void frRenderer::collectDeletions() {
+    if (mDeferredDeletions.empty()) return;
+
+    uint64_t completed = mTimelineSemaphores ? mTimeline.completedValue() : mFramesCompleted;
+    // Values keyed on a sync can be older than ones deferred before them, so no early out
+    size_t kept = 0;
+    for (size_t i = 0; i < mDeferredDeletions.size(); ++i) {
+      if (mDeferredDeletions[i].value <= completed) {
+        std::function<void()> deleter = std::move(mDeferredDeletions[i].deleter); // It may defer more
+        deleter();
+      } else {
+        if (kept != i) mDeferredDeletions[kept] = std::move(mDeferredDeletions[i]);
+        ++kept;
+      }
+    }
+    mDeferredDeletions.resize(kept);
+  }
+
+  bool frRenderer::supportsDynamicState(VkDynamicState state) const {
+    const VkPhysicalDeviceExtendedDynamicState3FeaturesEXT &eds3 = mExtendedDynamicState3;
+    switch (state) {
+    case VK_DYNAMIC_STATE_VIEWPORT:
+    case VK_DYNAMIC_STATE_SCISSOR:
+    case VK_DYNAMIC_STATE_LINE_WIDTH:
+    case VK_DYNAMIC_STATE_DEPTH_BIAS:
+    case VK_DYNAMIC_STATE_BLEND_CONSTANTS:
+    case VK_DYNAMIC_STATE_DEPTH_BOUNDS:
+    case VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK:
+    case VK_DYNAMIC_STATE_STENCIL_WRITE_MASK:
+    case VK_DYNAMIC_STATE_STENCIL_REFERENCE: return true;
+    case VK_DYNAMIC_STATE_CULL_MODE:
+    case VK_DYNAMIC_STATE_FRONT_FACE:
+    case VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY:
+    case VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE:
+    case VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE:
+    case VK_DYNAMIC_STATE_DEPTH_COMPARE_OP:
+    case VK_DYNAMIC_STATE_DEPTH_BOUNDS_TEST_ENABLE:
+    case VK_DYNAMIC_STATE_STENCIL_TEST_ENABLE:
+    case VK_DYNAMIC_STATE_STENCIL_OP: return mExtendedDynamicState;
+    case VK_DYNAMIC_STATE_RASTERIZER_DISCARD_ENABLE:
+    case VK_DYNAMIC_STATE_DEPTH_BIAS_ENABLE:
+    case VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE: return mExtendedDynamicState2;
+    case VK_DYNAMIC_STATE_LOGIC_OP_EXT: return mExtendedDynamicState2LogicOp;
+    case VK_DYNAMIC_STATE_PATCH_CONTROL_POINTS_EXT: return mExtendedDynamicState2PatchControlPoints;
+    case VK_DYNAMIC_STATE_POLYGON_MODE_EXT: return eds3.extendedDynamicState3PolygonMode && mCmdSetPolygonMode;
+    case VK_DYNAMIC_STATE_DEPTH_CLAMP_ENABLE_EXT: return eds3.extendedDynamicState3DepthClampEnable && mCmdSetDepthClampEnable;
+    case VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT: return eds3.extendedDynamicState3ColorBlendEnable && mCmdSetColorBlendEnable;
+    case VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT: return eds3.extendedDynamicState3ColorBlendEquation && mCmdSetColorBlendEquation;
+    case VK_DYNAMIC_STATE_COLOR_WRITE_MASK_EXT: return eds3.extendedDynamicState3ColorWriteMask && mCmdSetColorWriteMask;
+    default: return false; // No frCommands helper
+    }
+  }
+
+  bool frRenderer::hasDeviceExtension(const char *name) const {
+    for (const auto &extension : mAvailableDeviceExtensions) {
+      if (strcmp(extension.extensionName, name) == 0) return true;
+    }
+    return false;
   }
 
   // - Utilities:
@@ -1303,7 +6121,7 @@ namespace fr {
     return UINT32_MAX;
   }
 
-  void frRenderer::CreateBuffer(VkDeviceSize size, VkBufferUsageFlagBits usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory *bufferMemory) {
+  void frRenderer::CreateBuffer(VkDeviceSize size, VkBufferUsageFlagBits usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, frAllocation *allocation) {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
@@ -1312,18 +6130,13 @@ namespace fr {
 
     VK_WRAPPER(vkCreateBuffer(mDevice, &bufferInfo, nullptr, &buffer));
 
-    if (!bufferMemory) return;
+    if (!allocation) return;
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(mDevice, buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
-
-    VK_WRAPPER(vkAllocateMemory(mDevice, &allocInfo, nullptr, bufferMemory));
+    *allocation = mAllocator.allocate(memRequirements, properties, true);
 
-    vkBindBufferMemory(mDevice, buffer, *bufferMemory, 0);
+    VK_WRAPPER(vkBindBufferMemory(mDevice, buffer, allocation->block->memory, allocation->offset));
   }
  
   VkSampleCountFlagBits frRenderer::GetMaxUsableSampleCount() {
@@ -0,0 +1,290 @@
+#include "bcenc.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BCENC_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace bcenc {
+
+  // Nearest palette entry per texel, only the channels set in `mask` (one byte per channel) count.
+  static void selectIndices(const uint8_t block[64], const uint8_t palette[][4], int count, uint32_t mask, uint8_t indices[16]) {
+#ifdef BCENC_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i channelMask = _mm_set1_epi32(static_cast<int>(mask));
+
+    // Four texels per register, widened to 16 bits two texels at a time
+    __m128i lo[4], hi[4], best[4], bestIndex[4];
+    for (int i = 0; i < 4; ++i) {
+      __m128i texels = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i)), channelMask);
+      lo[i] = _mm_unpacklo_epi8(texels, zero);
+      hi[i] = _mm_unpackhi_epi8(texels, zero);
+      best[i] = _mm_set1_epi32(INT_MAX);
+      bestIndex[i] = zero;
+    }
+
+    for (int k = 0; k < count; ++k) {
+      uint32_t entry;
+      memcpy(&entry, palette[k], 4);
+      __m128i color = _mm_unpacklo_epi8(_mm_set1_epi32(static_cast<int>(entry & mask)), zero);
+      __m128i index = _mm_set1_epi32(k);
+
+      for (int i = 0; i < 4; ++i) {
+        __m128i dl = _mm_sub_epi16(lo[i], color);
+        __m128i dh = _mm_sub_epi16(hi[i], color);
+        __m128 sl = _mm_castsi128_ps(_mm_madd_epi16(dl, dl)); // r²+g², b²+a² per texel
+        __m128 sh = _mm_castsi128_ps(_mm_madd_epi16(dh, dh));
+        __m128i error = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(sl, sh, _MM_SHUFFLE(2, 0, 2, 0))),
+                                      _mm_castps_si128(_mm_shuffle_ps(sl, sh, _MM_SHUFFLE(3, 1, 3, 1))));
+
+        __m128i less = _mm_cmplt_epi32(error, best[i]);
+        best[i] = _mm_or_si128(_mm_and_si128(less, error), _mm_andnot_si128(less, best[i]));
+        bestIndex[i] = _mm_or_si128(_mm_and_si128(less, index), _mm_andnot_si128(less, bestIndex[i]));
+      }
+    }
+
+    int32_t result[16];
+    for (int i = 0; i < 4; ++i) _mm_storeu_si128(reinterpret_cast<__m128i*>(result + 4 * i), bestIndex[i]);
+    for (int i = 0; i < 16; ++i) indices[i] = static_cast<uint8_t>(result[i]);
+#else
+    for (int i = 0; i < 16; ++i) {
+      int best = INT_MAX;
+      for (int k = 0; k < count; ++k) {
+        int error = 0;
+        for (int c = 0; c < 4; ++c) {
+          if (!(mask & (0xFFu << (8 * c)))) continue;
+          int d = block[i * 4 + c] - palette[k][c];
+          error += d * d;
+        }
+        if (error < best) {
+          best = error;
+          indices[i] = static_cast<uint8_t>(k);
+        }
+      }
+    }
+#endif
+  }
+
+  // Extremes of the block along its principal axis, found by power iteration on the covariance
+  static void principalEndpoints(const uint8_t block[64], int channels, float lo[4], float hi[4]) {
+    float mean[4] = {}, minimum[4], maximum[4];
+    for (int c = 0; c < 4; ++c) { minimum[c] = 255.0f; maximum[c] = 0.0f; }
+    for (int i = 0; i < 16; ++i) {
+      for (int c = 0; c < channels; ++c) {
+        float v = block[i * 4 + c];
+        mean[c] += v;
+        minimum[c] = std::min(minimum[c], v);
+        maximum[c] = std::max(maximum[c], v);
+      }
+    }
+    for (int c = 0; c < channels; ++c) mean[c] /= 16.0f;
+
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; ++i) {
+      float d[4] = {};
+      for (int c = 0; c < channels; ++c) d[c] = block[i * 4 + c] - mean[c];
+      for (int a = 0; a < channels; ++a) {
+        for (int b = 0; b < channels; ++b) covariance[a][b] += d[a] * d[b];
+      }
+    }
+
+    float axis[4] = {};
+    for (int c = 0; c < channels; ++c) axis[c] = maximum[c] - minimum[c];
+    for (int iteration = 0; iteration < 8; ++iteration) {
+      float next[4] = {}, scale = 0.0f;
+      for (int a = 0; a < channels; ++a) {
+        for (int b = 0; b < channels; ++b) next[a] += covariance[a][b] * axis[b];
+        scale = std::max(scale, std::fabs(next[a]));
+      }
+      if (scale == 0.0f) break; // Flat block, any axis works
+      for (int c = 0; c < channels; ++c) axis[c] = next[c] / scale;
+    }
+
+    float length = 0.0f;
+    for (int c = 0; c < channels; ++c) length += axis[c] * axis[c];
+    length = std::sqrt(length);
+    if (length > 0.0f) for (int c = 0; c < channels; ++c) axis[c] /= length;
+
+    float tMin = 0.0f, tMax = 0.0f;
+    for (int i = 0; i < 16; ++i) {
+      float t = 0.0f;
+      for (int c = 0; c < channels; ++c) t += (block[i * 4 + c] - mean[c]) * axis[c];
+      tMin = std::min(tMin, t);
+      tMax = std::max(tMax, t);
+    }
+
+    for (int c = 0; c < 4; ++c) {
+      lo[c] = c < channels ? std::min(255.0f, std::max(0.0f, mean[c] + tMin * axis[c])) : 255.0f;
+      hi[c] = c < channels ? std::min(255.0f, std::max(0.0f, mean[c] + tMax * axis[c])) : 255.0f;
+    }
+  }
+
+  static uint16_t pack565(const float color[4]) {
+    uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+    uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+    uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+  }
+
+  static void unpack565(uint16_t packed, uint8_t color[4]) {
+    uint32_t r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+    color[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+    color[2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+    color[3] = 255;
+  }
+
+  // BC1 color block in four-color mode, shared by BC1 and BC3
+  static void encodeColor(const uint8_t block[64], uint8_t out[8]) {
+    float lo[4], hi[4];
+    principalEndpoints(block, 3, lo, hi);
+
+    uint16_t c0 = pack565(hi), c1 = pack565(lo);
+    if (c0 < c1) std::swap(c0, c1);
+
+    uint32_t bits = 0;
+    if (c0 != c1) { // Equal endpoints leave every index at 0, which is c0 in either mode
+      uint8_t palette[4][4];
+      unpack565(c0, palette[0]);
+      unpack565(c1, palette[1]);
+      for (int c = 0; c < 4; ++c) {
+        palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c] + 1) / 3);
+        palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c] + 1) / 3);
+      }
+
+      uint8_t indices[16];
+      selectIndices(block, palette, 4, 0x00FFFFFFu, indices);
+      for (int i = 0; i < 16; ++i) bits |= static_cast<uint32_t>(indices[i]) << (2 * i);
+    }
+
+    out[0] = static_cast<uint8_t>(c0);
+    out[1] = static_cast<uint8_t>(c0 >> 8);
+    out[2] = static_cast<uint8_t>(c1);
+    out[3] = static_cast<uint8_t>(c1 >> 8);
+    for (int i = 0; i < 4; ++i) out[4 + i] = static_cast<uint8_t>(bits >> (8 * i));
+  }
+
+  // BC4 block of one channel in eight-value mode, shared by BC3 alpha, BC4 and BC5
+  static void encodeChannel(const uint8_t block[64], int channel, uint8_t out[8]) {
+    uint8_t single[64] = {};
+    uint8_t minimum = 255, maximum = 0;
+    for (int i = 0; i < 16; ++i) {
+      uint8_t v = block[i * 4 + channel];
+      single[i * 4] = v;
+      minimum = std::min(minimum, v);
+      maximum = std::max(maximum, v);
+    }
+
+    uint64_t bits = 0;
+    if (maximum != minimum) {
+      uint8_t palette[8][4] = {};
+      palette[0][0] = maximum;
+      palette[1][0] = minimum;
+      for (int k = 2; k < 8; ++k) palette[k][0] = static_cast<uint8_t>(((8 - k) * maximum + (k - 1) * minimum + 3) / 7);
+
+      uint8_t indices[16];
+      selectIndices(single, palette, 8, 0x000000FFu, indices);
+      for (int i = 0; i < 16; ++i) bits |= static_cast<uint64_t>(indices[i]) << (3 * i);
+    }
+
+    out[0] = maximum;
+    out[1] = minimum;
+    for (int i = 0; i < 6; ++i) out[2 + i] = static_cast<uint8_t>(bits >> (8 * i));
+  }
+
+  void encodeBC1(const uint8_t block[64], uint8_t out[8]) {
+    encodeColor(block, out);
+  }
+
+  void encodeBC3(const uint8_t block[64], uint8_t out[16]) {
+    encodeChannel(block, 3, out);
+    encodeColor(block, out + 8);
+  }
+
+  void encodeBC4(const uint8_t block[64], uint8_t out[8]) {
+    encodeChannel(block, 0, out);
+  }
+
+  void encodeBC5(const uint8_t block[64], uint8_t out[16]) {
+    encodeChannel(block, 0, out);
+    encodeChannel(block, 1, out + 8);
+  }
+
+  struct BitWriter {
+    uint64_t bits[2] = {};
+    int      position = 0;
+
+    void put(uint32_t value, int count) {
+      for (int i = 0; i < count; ++i, ++position) {
+        if (value & (1u << i)) bits[position / 64] |= uint64_t(1) << (position % 64);
+      }
+    }
+  };
+
+  // 7-bit endpoint plus the p-bit that reconstructs it best
+  static void quantizeEndpoint(const float color[4], uint8_t quantized[4], uint8_t &pbit) {
+    float bestError = 1e30f;
+    for (uint8_t p = 0; p < 2; ++p) {
+      uint8_t q[4];
+      float error = 0.0f;
+      for (int c = 0; c < 4; ++c) {
+        int v = static_cast<int>(std::floor((color[c] - p) / 2.0f + 0.5f));
+        q[c] = static_cast<uint8_t>(std::min(127, std::max(0, v)));
+        float d = static_cast<float>((q[c] << 1) | p) - color[c];
+        error += d * d;
+      }
+      if (error < bestError) {
+        bestError = error;
+        pbit = p;
+        memcpy(quantized, q, 4);
+      }
+    }
+  }
+
+  void encodeBC7(const uint8_t block[64], uint8_t out[16]) {
+    static const uint32_t weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    float lo[4], hi[4];
+    principalEndpoints(block, 4, lo, hi);
+
+    uint8_t endpoints[2][4], pbits[2];
+    quantizeEndpoint(lo, endpoints[0], pbits[0]);
+    quantizeEndpoint(hi, endpoints[1], pbits[1]);
+
+    uint8_t palette[16][4];
+    for (int k = 0; k < 16; ++k) {
+      for (int c = 0; c < 4; ++c) {
+        uint32_t e0 = (endpoints[0][c] << 1) | pbits[0], e1 = (endpoints[1][c] << 1) | pbits[1];
+        palette[k][c] = static_cast<uint8_t>(((64 - weights[k]) * e0 + weights[k] * e1 + 32) >> 6);
+      }
+    }
+
+    uint8_t indices[16];
+    selectIndices(block, palette, 16, 0xFFFFFFFFu, indices);
+
+    if (indices[0] & 8) { // The anchor index drops its top bit, swap the endpoints so it is clear
+      std::swap(endpoints[0], endpoints[1]);
+      std::swap(pbits[0], pbits[1]);
+      for (int i = 0; i < 16; ++i) indices[i] = static_cast<uint8_t>(15 - indices[i]);
+    }
+
+    BitWriter writer;
+    writer.put(1u << 6, 7); // Mode 6
+    for (int c = 0; c < 4; ++c) {
+      writer.put(endpoints[0][c], 7);
+      writer.put(endpoints[1][c], 7);
+    }
+    writer.put(pbits[0], 1);
+    writer.put(pbits[1], 1);
+    writer.put(indices[0], 3);
+    for (int i = 1; i < 16; ++i) writer.put(indices[i], 4);
+
+    for (int i = 0; i < 16; ++i) out[i] = static_cast<uint8_t>(writer.bits[i / 8] >> (8 * (i % 8)));
+  }
+
+}
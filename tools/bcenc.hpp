@@ -0,0 +1,18 @@
+// Block compression used by frtex. Every encoder takes one 4x4 block of RGBA8 texels (row major, 64 bytes)
+// and writes 8 (BC1, BC4) or 16 (BC3, BC5, BC7) bytes. Index selection is SSE2 when available.
+#pragma once
+
+#include <cstdint>
+
+namespace bcenc {
+
+  void encodeBC1(const uint8_t block[64], uint8_t out[8]);
+  void encodeBC3(const uint8_t block[64], uint8_t out[16]);
+  // Red channel only
+  void encodeBC4(const uint8_t block[64], uint8_t out[8]);
+  // Red and green, normal maps
+  void encodeBC5(const uint8_t block[64], uint8_t out[16]);
+  // Mode 6 only: one RGBA subset, 7.7.7.7 endpoints with p-bits and 4-bit indices
+  void encodeBC7(const uint8_t block[64], uint8_t out[16]);
+
+}
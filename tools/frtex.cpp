@@ -0,0 +1,276 @@
+// frtex: converts images into .frtex containers read by fr::frTextureFile.
+//
+//   frtex [-srgb|-linear] [-nomips] [-cube] [-format rgba8|bc1|bc3|bc4|bc5|bc7] -o out.frtex in0.png [in1.png ...]
+//
+// Every input becomes one array layer (six faces in +X,-X,+Y,-Y,+Z,-Z order with -cube), all inputs
+// must have the same size. Mips are box filtered on the CPU, in linear space for sRGB textures, then
+// every level is block compressed (see bcenc.hpp). BC4/BC5 store data, they are always UNORM.
+#include <fr/fr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <string>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "bcenc.hpp"
+
+using namespace fr;
+
+enum Format {
+  FORMAT_RGBA8,
+  FORMAT_BC1,
+  FORMAT_BC3,
+  FORMAT_BC4,
+  FORMAT_BC5,
+  FORMAT_BC7,
+};
+
+struct Options {
+  Format format = FORMAT_RGBA8;
+  bool srgb = true;
+  bool mips = true;
+  bool cube = false;
+  const char *output = nullptr;
+  std::vector<const char*> inputs;
+};
+
+struct Level {
+  uint32_t width, height;
+  std::vector<uint8_t> pixels; // RGBA8
+};
+
+static float srgbToLinearTable[256];
+
+static float linearToSrgb(float c) {
+  c = c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+  return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: frtex [-srgb|-linear] [-nomips] [-cube] [-format rgba8|bc1|bc3|bc4|bc5|bc7] -o out.frtex in0 [in1 ...]\n");
+}
+
+static bool parseArgs(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-srgb") == 0) options.srgb = true;
+    else if (strcmp(argv[i], "-linear") == 0) options.srgb = false;
+    else if (strcmp(argv[i], "-nomips") == 0) options.mips = false;
+    else if (strcmp(argv[i], "-cube") == 0) options.cube = true;
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) options.output = argv[++i];
+    else if (strcmp(argv[i], "-format") == 0 && i + 1 < argc) {
+      const char *name = argv[++i];
+      if (strcmp(name, "rgba8") == 0) options.format = FORMAT_RGBA8;
+      else if (strcmp(name, "bc1") == 0) options.format = FORMAT_BC1;
+      else if (strcmp(name, "bc3") == 0) options.format = FORMAT_BC3;
+      else if (strcmp(name, "bc4") == 0) options.format = FORMAT_BC4;
+      else if (strcmp(name, "bc5") == 0) options.format = FORMAT_BC5;
+      else if (strcmp(name, "bc7") == 0) options.format = FORMAT_BC7;
+      else return false;
+    }
+    else if (argv[i][0] == '-') return false;
+    else options.inputs.push_back(argv[i]);
+  }
+  if (!options.output || options.inputs.empty()) return false;
+  if (options.cube && options.inputs.size() != 6) {
+    fprintf(stderr, "-cube needs exactly six inputs\n");
+    return false;
+  }
+  return true;
+}
+
+// 2x2 box filter, odd edges clamp so the last row/column is not lost
+static Level downsample(const Level &src, bool srgb) {
+  Level dst;
+  dst.width = std::max(1u, src.width / 2);
+  dst.height = std::max(1u, src.height / 2);
+  dst.pixels.resize(static_cast<size_t>(dst.width) * dst.height * 4);
+
+  for (uint32_t y = 0; y < dst.height; ++y) {
+    for (uint32_t x = 0; x < dst.width; ++x) {
+      uint32_t x0 = std::min(x * 2, src.width - 1), x1 = std::min(x * 2 + 1, src.width - 1);
+      uint32_t y0 = std::min(y * 2, src.height - 1), y1 = std::min(y * 2 + 1, src.height - 1);
+      const uint8_t *texels[4] = {
+        &src.pixels[(static_cast<size_t>(y0) * src.width + x0) * 4],
+        &src.pixels[(static_cast<size_t>(y0) * src.width + x1) * 4],
+        &src.pixels[(static_cast<size_t>(y1) * src.width + x0) * 4],
+        &src.pixels[(static_cast<size_t>(y1) * src.width + x1) * 4],
+      };
+
+      uint8_t *out = &dst.pixels[(static_cast<size_t>(y) * dst.width + x) * 4];
+      for (int c = 0; c < 4; ++c) {
+        float sum = 0.0f;
+        for (int i = 0; i < 4; ++i) {
+          sum += (srgb && c < 3) ? srgbToLinearTable[texels[i][c]] : texels[i][c] / 255.0f;
+        }
+        float value = sum * 0.25f;
+        if (srgb && c < 3) value = linearToSrgb(value);
+        out[c] = static_cast<uint8_t>(std::lround(value * 255.0f));
+      }
+    }
+  }
+  return dst;
+}
+
+static VkFormat vulkanFormat(Format format, bool srgb) {
+  switch (format) {
+  case FORMAT_BC1: return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+  case FORMAT_BC3: return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+  case FORMAT_BC4: return VK_FORMAT_BC4_UNORM_BLOCK;
+  case FORMAT_BC5: return VK_FORMAT_BC5_UNORM_BLOCK;
+  case FORMAT_BC7: return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+  default: return srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+  }
+}
+
+static bool isSrgbFormat(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+  case VK_FORMAT_BC3_SRGB_BLOCK:
+  case VK_FORMAT_BC7_SRGB_BLOCK:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+    return true;
+  default: return false;
+  }
+}
+
+// Level data as stored in the file, 4x4 blocks with clamped edges for BC formats
+static std::vector<uint8_t> encodeLevel(const Level &level, Format format) {
+  if (format == FORMAT_RGBA8) return level.pixels;
+
+  size_t blockBytes = (format == FORMAT_BC1 || format == FORMAT_BC4) ? 8 : 16;
+  uint32_t blocksWide = (level.width + 3) / 4, blocksHigh = (level.height + 3) / 4;
+  std::vector<uint8_t> data(static_cast<size_t>(blocksWide) * blocksHigh * blockBytes);
+
+  uint8_t *out = data.data();
+  for (uint32_t by = 0; by < blocksHigh; ++by) {
+    for (uint32_t bx = 0; bx < blocksWide; ++bx, out += blockBytes) {
+      uint8_t block[64];
+      for (uint32_t i = 0; i < 16; ++i) {
+        uint32_t x = std::min(bx * 4 + i % 4, level.width - 1);
+        uint32_t y = std::min(by * 4 + i / 4, level.height - 1);
+        memcpy(block + i * 4, &level.pixels[(static_cast<size_t>(y) * level.width + x) * 4], 4);
+      }
+
+      switch (format) {
+      case FORMAT_BC1: bcenc::encodeBC1(block, out); break;
+      case FORMAT_BC3: bcenc::encodeBC3(block, out); break;
+      case FORMAT_BC4: bcenc::encodeBC4(block, out); break;
+      case FORMAT_BC5: bcenc::encodeBC5(block, out); break;
+      case FORMAT_BC7: bcenc::encodeBC7(block, out); break;
+      default: break;
+      }
+    }
+  }
+  return data;
+}
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseArgs(argc, argv, options)) {
+    usage();
+    return 1;
+  }
+
+  for (int i = 0; i < 256; ++i) {
+    float c = i / 255.0f;
+    srgbToLinearTable[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+  }
+
+  // chain[layer][mip]
+  std::vector<std::vector<Level>> chain(options.inputs.size());
+  for (size_t layer = 0; layer < options.inputs.size(); ++layer) {
+    int width, height, channels;
+    stbi_uc *pixels = stbi_load(options.inputs[layer], &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels) {
+      fprintf(stderr, "Failed to load image %s\n", options.inputs[layer]);
+      return 1;
+    }
+    if (layer > 0 && (static_cast<uint32_t>(width) != chain[0][0].width || static_cast<uint32_t>(height) != chain[0][0].height)) {
+      fprintf(stderr, "%s: every layer must be %ux%u\n", options.inputs[layer], chain[0][0].width, chain[0][0].height);
+      stbi_image_free(pixels);
+      return 1;
+    }
+
+    Level base{ static_cast<uint32_t>(width), static_cast<uint32_t>(height), {} };
+    base.pixels.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+    chain[layer].push_back(std::move(base));
+  }
+
+  uint32_t width = chain[0][0].width, height = chain[0][0].height;
+  if (options.cube && width != height) {
+    fprintf(stderr, "Cube faces must be square\n");
+    return 1;
+  }
+
+  // Only data the GPU decodes as sRGB is averaged in linear light, BC4/BC5 and other UNORM outputs hold linear values
+  VkFormat format = vulkanFormat(options.format, options.srgb);
+  bool srgbFilter = isSrgbFormat(format);
+
+  uint32_t mipLevels = options.mips ? static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1 : 1;
+  for (auto &levels : chain) {
+    for (uint32_t mip = 1; mip < mipLevels; ++mip) levels.push_back(downsample(levels.back(), srgbFilter));
+  }
+
+  // encoded[layer][mip]
+  std::vector<std::vector<std::vector<uint8_t>>> encoded(chain.size());
+  for (size_t layer = 0; layer < chain.size(); ++layer) {
+    for (const Level &level : chain[layer]) encoded[layer].push_back(encodeLevel(level, options.format));
+  }
+
+  // Upload order: all layers of mip 0, then all layers of mip 1, ...
+  std::vector<frTextureLevel> table(mipLevels);
+  uint64_t dataSize = 0;
+  for (uint32_t mip = 0; mip < mipLevels; ++mip) {
+    dataSize = alignUp(dataSize, 16);
+    table[mip].offset = dataSize;
+    table[mip].size = 0;
+    for (auto &levels : encoded) table[mip].size += levels[mip].size();
+    dataSize += table[mip].size;
+  }
+
+  frTextureHeader header{};
+  header.magic = FR_TEXTURE_MAGIC;
+  header.version = FR_TEXTURE_VERSION;
+  header.format = format;
+  header.width = width;
+  header.height = height;
+  header.mipLevels = mipLevels;
+  header.layers = static_cast<uint32_t>(chain.size());
+  header.flags = options.cube ? FR_TEXTURE_CUBE : 0;
+  header.dataOffset = alignUp(sizeof(frTextureHeader) + mipLevels * sizeof(frTextureLevel), 16);
+  header.dataSize = dataSize;
+
+  std::vector<uint8_t> file(header.dataOffset + dataSize, 0);
+  memcpy(file.data(), &header, sizeof(header));
+  memcpy(file.data() + sizeof(header), table.data(), table.size() * sizeof(frTextureLevel));
+  for (uint32_t mip = 0; mip < mipLevels; ++mip) {
+    uint8_t *out = file.data() + header.dataOffset + table[mip].offset;
+    for (auto &levels : encoded) {
+      memcpy(out, levels[mip].data(), levels[mip].size());
+      out += levels[mip].size();
+    }
+  }
+
+  FILE *f = fopen(options.output, "wb");
+  if (!f || fwrite(file.data(), 1, file.size(), f) != file.size()) {
+    fprintf(stderr, "Failed to write %s\n", options.output);
+    if (f) fclose(f);
+    return 1;
+  }
+  fclose(f);
+
+  printf("%s: %ux%u, %u mips, %u layers, %llu bytes\n", options.output, width, height, mipLevels,
+         header.layers, static_cast<unsigned long long>(file.size()));
+  return 0;
+}